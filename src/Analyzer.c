@@ -1,15 +1,49 @@
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include "BiosEmulator/include/biosemu.h"
+#include "BiosEmulator/include/dirty.h"
 #include "BiosEmulator/include/pci_accessReg.h"
+#include "BiosEmulator/include/pmm.h"
+#include "BiosEmulator/include/services.h"
+#include "BiosEmulator/include/shadow.h"
+#include "BiosEmulator/include/vbe.h"
+#include "BiosEmulator/include/watch.h"
+#include "AnalyzerOptions.h"
 #include "cJSON.h"
+#include "RomImage.h"
 #include "MemAllocator.h"
+#include "MemoryMap.h"
+#include "Watchpoints.h"
+#include "OptionRom.h"
+#include "ProfileDb.h"
+#include "ResultCache.h"
+#include "Server.h"
 
 void printUsage()
 {
-    printf("Usage: Analyzer -f <filename>\n" \
-           "Where the file name is a json file describing the PCI configuration space and the rom file name.\n");
+    printf("Usage: Analyzer [options] -f <filename> [<filename>...]\n" \
+           "Where the file name is a json file describing the PCI configuration space and the rom file name.\n" \
+           "Several files are analyzed one after the other.\n" \
+           "       Analyzer -c <directory> <database>\n" \
+           "Compiles the json profiles, sysfs config files and lspci dumps below directory into a profile database.\n" \
+           "       Analyzer [options] -d <socket> [<database>]\n" \
+           "Serves analysis requests on a unix domain socket, see Server.h.\n" \
+           "Options, also settable per run with the json keys in brackets:\n" \
+           "  -t <categories>  trace categories of debug builds, none, all or a comma separated list of\n" \
+           "                   decode, trace, tracecall, tracecall_regs, disassemble, mem, io, sysint and\n" \
+           "                   instrument, none by default (\"trace\")\n" \
+           "  -m <size>        guest memory size, with an optional K or M suffix (\"memory_size\")\n" \
+           "  -b <count>       instructions a run may execute, 0 for no limit (\"instruction_budget\"),\n" \
+           "                   requests to the server are held to it, 200M unless given\n" \
+           "  -F <format>      text or json, json puts one document on the last line (\"output_format\")\n" \
+           "  -o <file>        write the reports to file (\"output_file\")\n" \
+           "Command line options take precedence over the json keys.\n");
 }
 
 cJSON* readConf(const char* fileName)
@@ -36,92 +70,557 @@ cJSON* readConf(const char* fileName)
     return conf;
 }
 
-uintptr_t readROM(const char* filename)
+static double millisecondsSince(const struct timespec* start)
 {
-    FILE* file = fopen(filename, "rb");
-    if (file == NULL)
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+// The slot the PCI data structure names, the primary device when no emulated device matches
+static uint16_t romBusDevFn(const OptionRom* optionRom)
+{
+    PCIslot slot;
+    if (optionRom->pcirOffset == 0)
+        slot = PCI_primarySlot();
+    else if (!PCI_findDevice(optionRom->vendorID, optionRom->deviceID, 0, &slot))
+    {
+        printf("No emulated device matches the option rom ids %04x:%04x, using the primary device\n",
+               optionRom->vendorID, optionRom->deviceID);
+        slot = PCI_primarySlot();
+    }
+    return (uint16_t)(slot.p.Bus << 8 | slot.p.Device << 3 | slot.p.Function);
+}
+
+// Loads a profile database unless it is the one loaded already, the server keeps it across requests
+static int useProfileDb(const char* filename)
+{
+    static char loaded[PATH_MAX];
+    if (filename != NULL && strcmp(filename, loaded) == 0)
+        return 1;
+    loaded[0] = 0;
+    if (filename == NULL)
     {
-        printf("Could not open file %s\n", filename);
+        printf("profile_db must be a file name\n");
         return 0;
     }
+    if (!loadProfileDb(filename))
+        return 0;
+    snprintf(loaded, sizeof(loaded), "%s", filename);
+    return 1;
+}
 
-    // read the file
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
+// Options from the command line, every analysis starts from them
+static AnalyzerOptions commandLineOptions;
+// Highest instruction budget a run may ask for, 0 for no limit
+static uint64_t budgetLimit = 0;
 
-    uintptr_t file_contents = allocateIn4GBRange(file_size + 1);
-    memset((void*)file_contents, 0, file_size + 1);
-    fread((void*)file_contents, file_size, 1, file);
-    fclose(file);
+// The json report of the running analysis, NULL in text format
+static cJSON* jsonReport = NULL;
 
-    return file_contents;
+static void reportTiming(const char* phase, double milliseconds)
+{
+    if (jsonReport == NULL)
+    {
+        printf("phase %s took %.3f ms\n", phase, milliseconds);
+        return;
+    }
+    cJSON* entry = cJSON_AddObjectToObject(cJSON_GetObjectItem(jsonReport, "phases"), phase);
+    cJSON_AddNumberToObject(entry, "ms", milliseconds);
 }
 
-int main(int argc, char* argv[])
+static void reportCount(const char* name, const char* what, double count)
 {
-    // The rom needs to be in the first 4GB of memory so we use uintptr_t instead of void* to allow easier casting
-    uintptr_t rom = 0;
-    cJSON* pciCONF = NULL;
-    int32_t returnCode = 0;
+    if (jsonReport == NULL)
+        printf("%s %.0f\n", what, count);
+    else
+        cJSON_AddNumberToObject(jsonReport, name, count);
+}
 
-    // find -f followed by a filename in argv
-    if (argc < 2)
+// The guest pages written since the last checkpoint, as [first, last] byte ranges
+static cJSON* dirtyPagesToJson(void)
+{
+    cJSON* json = cJSON_CreateArray();
+    uint32_t first;
+    uint32_t last;
+    for (uint32_t page = 0; BE_dirtyNextRange(page, &first, &last); page = last + 1)
     {
-        printUsage();
-        goto error;
+        cJSON* range = cJSON_CreateArray();
+        cJSON_AddItemToArray(range, cJSON_CreateNumber(first << BE_DIRTY_PAGE_SHIFT));
+        cJSON_AddItemToArray(range, cJSON_CreateNumber((last << BE_DIRTY_PAGE_SHIFT) | ((1 << BE_DIRTY_PAGE_SHIFT) - 1)));
+        cJSON_AddItemToArray(json, range);
     }
+    return json;
+}
 
-    if (strcmp(argv[1], "-f") != 0)
+// Runs one entry point of the image at 0xC0000 and reports how long it took,
+// and with dirtyReport the guest pages the phase wrote
+static void runRomPhase(const char* phase, uint16_t vector, uint16_t busDevFn, int dirtyReport)
+{
+    struct timespec start;
+    if (dirtyReport)
+        BE_dirtyCheckpoint();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint16_t ax = vector == ROM_HEADER_INIT_OFFSET ? callOptionRomInit(0xC000, busDevFn)
+                                                   : callOptionRomVector(0xC000, vector, busDevFn);
+    double milliseconds = millisecondsSince(&start);
+    if (jsonReport == NULL)
     {
-        printUsage();
-        goto error;
+        printf("phase %-5s %04x:%04x returned ax=%04x in %.3f ms\n", phase, 0xC000, vector, ax, milliseconds);
+        if (dirtyReport)
+            BE_dirtyReport();
+        return;
+    }
+    cJSON* entry = cJSON_AddObjectToObject(cJSON_GetObjectItem(jsonReport, "phases"), phase);
+    cJSON_AddNumberToObject(entry, "vector", vector);
+    cJSON_AddNumberToObject(entry, "ax", ax);
+    cJSON_AddNumberToObject(entry, "ms", milliseconds);
+    if (dirtyReport)
+    {
+        cJSON_AddNumberToObject(entry, "dirty_pages", BE_dirtyCount());
+        cJSON_AddItemToObject(entry, "dirty", dirtyPagesToJson());
+    }
+}
+
+static void reportServices(void)
+{
+    if (jsonReport == NULL)
+    {
+        BE_serviceReport();
+        BE_pmmReport();
+        return;
+    }
+    cJSON* services = cJSON_AddArrayToObject(jsonReport, "services");
+    for (int i = 0; i < BE_SERVICE_MAX; ++i)
+    {
+        const BE_service* service = BE_serviceGet(i);
+        if (service == NULL || service->calls == 0)
+            continue;
+        cJSON* entry = cJSON_CreateObject();
+        cJSON_AddNumberToObject(entry, "int", service->intno);
+        cJSON_AddNumberToObject(entry, "mask", service->mask);
+        cJSON_AddNumberToObject(entry, "value", service->value);
+        cJSON_AddStringToObject(entry, "name", service->name ? service->name : "");
+        cJSON_AddNumberToObject(entry, "calls", (double)service->calls);
+        cJSON_AddNumberToObject(entry, "ns", (double)service->nanoseconds);
+        cJSON_AddItemToArray(services, entry);
+    }
+    for (int i = 0; i < 256; ++i)
+    {
+        if (BE_serviceUnhandled(i) == 0)
+            continue;
+        cJSON* entry = cJSON_CreateObject();
+        cJSON_AddNumberToObject(entry, "int", i);
+        cJSON_AddNumberToObject(entry, "unhandled", (double)BE_serviceUnhandled(i));
+        cJSON_AddItemToArray(services, entry);
     }
 
-    if (argc < 3)
+    cJSON* pmm = cJSON_AddObjectToObject(jsonReport, "pmm");
+    cJSON_AddNumberToObject(pmm, "allocated", BE_pmmAllocated());
+    cJSON_AddNumberToObject(pmm, "peak", BE_pmmPeak());
+    cJSON* blocks = cJSON_AddArrayToObject(pmm, "blocks");
+    const BE_pmmBlock* block;
+    for (int i = 0; (block = BE_pmmGetBlock(i)) != NULL; ++i)
     {
-        printUsage();
-        goto error;
+        cJSON* entry = cJSON_CreateObject();
+        cJSON_AddNumberToObject(entry, "address", block->address);
+        cJSON_AddNumberToObject(entry, "size", block->size);
+        cJSON_AddNumberToObject(entry, "handle", block->handle);
+        cJSON_AddItemToArray(blocks, entry);
     }
+}
 
-    pciCONF = readConf(argv[2]);
-    if (pciCONF == NULL)
+static void reportUninitializedReads(void)
+{
+    if (jsonReport == NULL)
+    {
+        BE_shadowReport();
+        return;
+    }
+    cJSON* shadow = cJSON_AddObjectToObject(jsonReport, "uninitialized_reads");
+    cJSON* sites = cJSON_AddArrayToObject(shadow, "sites");
+    for (int i = 0; i < BE_SHADOW_MAX_SITES; ++i)
     {
-        printf("Could not parse file %s\n", argv[2]);
+        const BE_shadowSite* site = BE_shadowGetSite(i);
+        if (site == NULL)
+            continue;
+        cJSON* entry = cJSON_CreateObject();
+        cJSON_AddNumberToObject(entry, "cs", site->cs);
+        cJSON_AddNumberToObject(entry, "ip", site->ip);
+        cJSON_AddNumberToObject(entry, "reads", site->count);
+        cJSON_AddNumberToObject(entry, "first", site->firstAddr);
+        cJSON_AddItemToArray(sites, entry);
+    }
+    cJSON_AddNumberToObject(shadow, "dropped", BE_shadowDroppedReads());
+}
+
+// Prints the json report, last thing of the analysis
+static void finishReport(int result)
+{
+    if (jsonReport == NULL)
+        return;
+    cJSON_AddNumberToObject(jsonReport, "status", result ? 0 : 1);
+    char* text = cJSON_PrintUnformatted(jsonReport);
+    if (text != NULL)
+        printf("%s\n", text);
+    free(text);
+    cJSON_Delete(jsonReport);
+    jsonReport = NULL;
+}
+
+// Points stdout at the file. With saved the old stdout is kept there for restoreOutput,
+// -o redirects once for the whole batch and an "output_file" for one analysis
+static int redirectOutput(const char* filename, int* saved)
+{
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+    {
+        printf("Could not create file %s\n", filename);
+        return 0;
+    }
+    fflush(stdout);
+    if (saved != NULL)
+        *saved = dup(STDOUT_FILENO);
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+    return 1;
+}
+
+static void restoreOutput(int* saved)
+{
+    if (*saved < 0)
+        return;
+    fflush(stdout);
+    dup2(*saved, STDOUT_FILENO);
+    close(*saved);
+    *saved = -1;
+}
+
+// stdout of the batch while an "output_file" takes the report of one analysis
+static int savedStdout = -1;
+
+// One analysis of the json configuration, the report goes to stdout. romFd is an open rom file
+// that takes the place of "rom", -1 for none. Returns 0 on errors
+static int analyze(const cJSON* pciCONF, const char* confName, int romFd)
+{
+    // The rom is mapped read-only from the file, see RomImage.h
+    const RomImage* rom = NULL;
+    int result = 1;
+    struct timespec start;
+
+    // Settings of an earlier analysis in the same process do not carry over
+    setHugePagePolicy(HUGE_PAGES_OFF);
+    BE_vbeSetPath(BE_VBE_ROM);
+    BE_serviceResetStats();
+    BE_watchReset();
+
+    AnalyzerOptions options = commandLineOptions;
+    if (!applyJsonOptions(pciCONF, &options))
+        goto error;
+    if (budgetLimit != 0 && (options.instructionBudget == 0 || options.instructionBudget > budgetLimit))
+        options.instructionBudget = budgetLimit;
+    if (!(options.given & OPTION_OUTPUT_FILE) && options.outputFile != NULL && !redirectOutput(options.outputFile, &savedStdout))
         goto error;
+    if (options.format == OUTPUT_JSON)
+    {
+        jsonReport = cJSON_CreateObject();
+        cJSON_AddStringToObject(jsonReport, "config", confName);
+        cJSON_AddObjectToObject(jsonReport, "phases");
     }
 
-    // get the rom file name
-    cJSON* romItem = cJSON_GetObjectItem(pciCONF, "rom");
-    if (romItem == NULL)
+    // Optional huge page backing for guest RAM, bus memory and large bars
+    cJSON* hugePagesItem = cJSON_GetObjectItem(pciCONF, "huge_pages");
+    if (hugePagesItem != NULL)
+    {
+        HugePagePolicy policy;
+        if (!cJSON_IsString(hugePagesItem) || !parseHugePagePolicy(hugePagesItem->valuestring, &policy))
+        {
+            printf("huge_pages must be one of off, transparent or explicit\n");
+            goto error;
+        }
+        setHugePagePolicy(policy);
+    }
+
+    // Which path answers VBE calls, see vbe.h
+    cJSON* vbePathItem = cJSON_GetObjectItem(pciCONF, "vbe_path");
+    if (vbePathItem != NULL)
+    {
+        BE_vbePath path;
+        if (!BE_vbeParsePath(cJSON_GetStringValue(vbePathItem), &path))
+        {
+            printf("vbe_path must be one of rom, fast or checked\n");
+            goto error;
+        }
+        BE_vbeSetPath(path);
+    }
+
+    // Profiles referenced with "profile" come from a compiled database, see ProfileDb.h
+    cJSON* profileDbItem = cJSON_GetObjectItem(pciCONF, "profile_db");
+    if (profileDbItem != NULL && !useProfileDb(cJSON_GetStringValue(profileDbItem)))
+        goto error;
+
+    // get the rom file name, unless the rom came as an open file
+    const char* filename = cJSON_GetStringValue(cJSON_GetObjectItem(pciCONF, "rom"));
+    if (filename == NULL && romFd < 0)
     {
-        printf("Could not find rom file name in %s\n", argv[2]);
+        printf("Could not find rom file name in %s\n", confName);
         goto error;
     }
 
-    const char* filename = romItem->valuestring;
-    rom = readROM(filename);
-    unsigned char* config = buildConfigFromJsonAndRom(pciCONF, rom);
+    // mapROM validates the size and the 0x55AA signature before mapping anything
+    if (romFd >= 0)
+        filename = "(passed file)";
+    rom = romFd >= 0 ? mapROMFd(romFd, filename) : mapROM(filename);
+    if (rom == NULL)
+        goto error;
+
+    unsigned char* config = buildConfigFromJsonAndRom(pciCONF, rom->data, rom->size);
     if (config == NULL)
     {
-        printf("Could not build config from json file %s\n", argv[2]);
+        printf("Could not build config from json file %s\n", confName);
         goto error;
     }
 
-    unsigned char* romBytes = (unsigned char*)rom;
-    // analyze the file
-    // Check if the first two bytes are 0x55 0xAA
-    if (romBytes[0] != 0x55 || romBytes[1] != 0xAA)
+    // Optional layout of the real mode megabyte, laid over the default PC layout
+    cJSON* memoryMapItem = cJSON_GetObjectItem(pciCONF, "memory_map");
+    if (memoryMapItem != NULL && !loadMemoryMap(memoryMapItem))
+        goto error;
+
+    // Optional watchpoints on guest memory and I/O ports, see Watchpoints.h
+    cJSON* watchpointsItem = cJSON_GetObjectItem(pciCONF, "watchpoints");
+    if (watchpointsItem != NULL && !loadWatchpoints(watchpointsItem))
+        goto error;
+
+    // Optional cache of earlier reports, keyed by everything the report depends on, see ResultCache.h
+    const char* cacheDirectory = cJSON_GetStringValue(cJSON_GetObjectItem(pciCONF, "result_cache"));
+    if (cacheDirectory != NULL)
     {
-        printf("File %s is not a bios extension\n", filename);
+        char key[RESULT_KEY_SIZE];
+        char settings[128];
+        describeAnalyzerOptions(&options, settings, sizeof(settings));
+        computeResultKey(rom->data, rom->size, pciCONF, settings, key);
+        if (replayResult(cacheDirectory, key))
+        {
+            cJSON_Delete(jsonReport);
+            jsonReport = NULL;
+            goto replayed;
+        }
+        beginResultCapture(cacheDirectory, key);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    // The file may chain several images, only the x86 one is emulated
+    OptionRomContainer container;
+    if (!parseOptionRomContainer(rom->data, rom->size, &container))
+        goto error;
+    cJSON* images = jsonReport != NULL ? cJSON_AddArrayToObject(jsonReport, "images") : NULL;
+    for (int i = 0; i < container.count; ++i)
+    {
+        if (images == NULL)
+            printOptionRom(&container.images[i]);
+        else
+            cJSON_AddItemToArray(images, optionRomToJson(&container.images[i]));
+    }
+    if (container.x86Image < 0)
+    {
+        printf("Option rom %s holds no x86 image\n", filename);
         goto error;
     }
+    const OptionRom* optionRom = &container.images[container.x86Image];
+    if (!optionRom->checksumValid)
+        printf("Option rom x86 image checksum is wrong, a BIOS would not run it\n");
+    reportTiming("parse", millisecondsSince(&start));
 
-    // Initialize the bios emulator
+    // Initialize the bios emulator, BE_setVGA copies the initialization size of the image to 0xC0000
     BE_VGAInfo vga_info;
     memset(&vga_info, 0, sizeof(vga_info));
+    vga_info.BIOSImage = (void*)optionRom->image;
+    vga_info.BIOSImageLen = optionRom->length;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (!BE_init(options.traceFlags, options.memorySize, &vga_info, 0))
+        goto error;
+    reportTiming("setup", millisecondsSince(&start));
+
+    // Optional memcheck style tracking of reads from guest memory nobody wrote
+    cJSON* trackItem = cJSON_GetObjectItem(pciCONF, "track_uninitialized");
+    int trackUninitialized = cJSON_IsTrue(trackItem) && BE_shadowEnable();
+
+    // The POST path: init, then the boot connection and boot entry vectors when asked for.
+    // The budget covers all of them, once it is used up the remaining phases return at once
+    // "dirty_report" lists the guest pages each phase wrote
+    X86EMU_setInstructionBudget(options.instructionBudget);
+    uint16_t busDevFn = romBusDevFn(optionRom);
+    int dirtyReport = cJSON_IsTrue(cJSON_GetObjectItem(pciCONF, "dirty_report"));
+    runRomPhase("init", ROM_HEADER_INIT_OFFSET, busDevFn, dirtyReport);
+    const uint8_t* size = BE_mapRealPointer(0xC000, ROM_HEADER_SIZE_OFFSET);
+    if (size != NULL && jsonReport == NULL)
+        printf("option rom kept %u of %u bytes\n", *size * ROM_BLOCK_SIZE, optionRom->length);
+    else if (size != NULL)
+        cJSON_AddNumberToObject(jsonReport, "rom_kept", *size * ROM_BLOCK_SIZE);
+
+    // The fast and checked VBE paths answer from the ROM's own blocks once it is initialized
+    if (BE_vbeGetPath() != BE_VBE_ROM)
+        reportCount("vbe_modes", "vbe modes harvested", BE_vbeHarvest());
+
+    if (cJSON_IsTrue(cJSON_GetObjectItem(pciCONF, "invoke_bcv")) && optionRom->bootConnectionVector != 0)
+        runRomPhase("bcv", optionRom->bootConnectionVector, busDevFn, dirtyReport);
+    if (cJSON_IsTrue(cJSON_GetObjectItem(pciCONF, "invoke_bev")) && optionRom->bootEntryVector != 0)
+        runRomPhase("bev", optionRom->bootEntryVector, busDevFn, dirtyReport);
+
+    if (jsonReport == NULL)
+        printf("instructions %llu%s\n", X86EMU_instructionCount(), X86EMU_budgetExhausted() ? ", budget used up" : "");
+    else
+    {
+        cJSON_AddNumberToObject(jsonReport, "instructions", (double)X86EMU_instructionCount());
+        cJSON_AddBoolToObject(jsonReport, "budget_exhausted", X86EMU_budgetExhausted());
+    }
+    if (BE_vbeGetPath() == BE_VBE_CHECKED)
+        reportCount("vbe_mismatches", "vbe mismatches between the rom and the host", BE_vbeMismatches());
+    if (watchpointsItem != NULL && jsonReport == NULL)
+        printWatchpointHits();
+    else if (watchpointsItem != NULL)
+        cJSON_AddItemToObject(jsonReport, "watchpoints", watchpointHitsToJson());
+    reportServices();
+
+    if (trackUninitialized)
+    {
+        reportUninitializedReads();
+        BE_shadowDisable();
+    }
+    BE_exit();
+    goto cleanup;
 
-    BE_init(DEBUG_DECODE_F | DEBUG_TRACECALL_F | DEBUG_MEM_TRACE_F | DEBUG_TRACE_F, 65536, &vga_info, 0);
+error:
+    result = 0;
+
+cleanup:
+    // Every failure of the run ends up here, stdout is restored and the capture file removed
+    // on all of them. Reports of failed runs are not cached
+    finishReport(result);
+    endResultCapture(result);
+
+replayed:
+    restoreOutput(&savedStdout);
+    unloadMemoryMap();
+    unmapROM(rom);
+    return result;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* inputs[argc];
+    int inputCount = 0;
+    const char* compileDirectory = NULL;
+    const char* socketPath = NULL;
+    int32_t returnCode = 0;
+    int option;
+
+    defaultAnalyzerOptions(&commandLineOptions);
+    while ((option = getopt(argc, argv, "f:c:d:t:m:b:F:o:h")) != -1)
+    {
+        AnalyzerOptions* options = &commandLineOptions;
+        switch (option)
+        {
+        case 'f':
+            inputs[inputCount++] = optarg;
+            break;
+        case 'c':
+            compileDirectory = optarg;
+            break;
+        case 'd':
+            socketPath = optarg;
+            break;
+        case 't':
+            if (!parseTraceCategories(optarg, &options->traceFlags))
+                goto error;
+            options->given |= OPTION_TRACE;
+            break;
+        case 'm':
+            if (!parseMemorySize(optarg, &options->memorySize))
+                goto error;
+            options->given |= OPTION_MEMORY_SIZE;
+            break;
+        case 'b':
+            if (!parseInstructionBudget(optarg, &options->instructionBudget))
+                goto error;
+            options->given |= OPTION_INSTRUCTION_BUDGET;
+            break;
+        case 'F':
+            if (!parseOutputFormat(optarg, &options->format))
+                goto error;
+            options->given |= OPTION_FORMAT;
+            break;
+        case 'o':
+            options->outputFile = optarg;
+            options->given |= OPTION_OUTPUT_FILE;
+            break;
+        default:
+            printUsage();
+            goto error;
+        }
+    }
+
+    if (compileDirectory != NULL)
+    {
+        if (optind + 1 != argc)
+        {
+            printUsage();
+            goto error;
+        }
+        if (!compileProfileDb(compileDirectory, argv[optind]))
+            goto error;
+        goto cleanup;
+    }
+
+    // Files after the options are more inputs of the batch
+    if (socketPath == NULL)
+    {
+        while (optind < argc)
+            inputs[inputCount++] = argv[optind++];
+    }
+    if ((socketPath == NULL && inputCount == 0) || (socketPath != NULL && (inputCount != 0 || argc - optind > 1)))
+    {
+        printUsage();
+        goto error;
+    }
+
+    // One report file for the whole batch
+    if (commandLineOptions.outputFile != NULL && !redirectOutput(commandLineOptions.outputFile, NULL))
+        goto error;
+
+    // One up front reservation for the rom and the bars, allocations fall back to mmap if this fails
+    arenaInit(ARENA_DEFAULT_SIZE);
+
+    if (socketPath != NULL)
+    {
+        // One request that never returns would block every client after it
+        if (!(commandLineOptions.given & OPTION_INSTRUCTION_BUDGET))
+            commandLineOptions.instructionBudget = SERVER_INSTRUCTION_BUDGET;
+        budgetLimit = commandLineOptions.instructionBudget;
+        // Requests for the same rom map it once
+        keepUnusedROMs(SERVER_ROM_CACHE);
+        if (optind < argc && !useProfileDb(argv[optind]))
+            goto error;
+        if (!runServer(socketPath, analyze))
+            goto error;
+        goto cleanup;
+    }
+
+    // A failed input does not stop the batch, it fails the exit code
+    for (int i = 0; i < inputCount; ++i)
+    {
+        cJSON* pciCONF = readConf(inputs[i]);
+        if (pciCONF == NULL)
+        {
+            printf("Could not parse file %s\n", inputs[i]);
+            returnCode = 1;
+            continue;
+        }
+        if (!analyze(pciCONF, inputs[i], -1))
+            returnCode = 1;
+        cJSON_Delete(pciCONF);
+    }
 
     goto cleanup;
 
@@ -129,7 +628,7 @@ error:
     returnCode = 1;
 
 cleanup:
-    cJSON_Delete(pciCONF);
-    free((void*)rom);
+    unloadProfileDb();
+    arenaDestroy();
     return returnCode;
-}
\ No newline at end of file
+}
@@ -0,0 +1,193 @@
+#include "AnalyzerOptions.h"
+#include "BiosEmulator/include/x86emu.h"
+#include "cJSON.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct TraceCategory
+{
+    const char* name;
+    uint32_t flags;
+} TraceCategory;
+
+static const TraceCategory traceCategories[] = {
+    { "decode", DEBUG_DECODE_F },
+    { "trace", DEBUG_TRACE_F },
+    { "tracecall", DEBUG_TRACECALL_F },
+    { "tracecall_regs", DEBUG_TRACECALL_REGS_F },
+    { "disassemble", DEBUG_DISASSEMBLE_F },
+    { "mem", DEBUG_MEM_TRACE_F },
+    { "io", DEBUG_IO_TRACE_F },
+    { "sysint", DEBUG_SYSINT_F },
+    { "instrument", DEBUG_INSTRUMENT_F },
+};
+
+#define TRACE_CATEGORY_COUNT (sizeof(traceCategories) / sizeof(traceCategories[0]))
+
+// Runs do not pay for tracing unless -t or "trace" asks for it
+#define DEFAULT_TRACE_FLAGS 0
+
+void defaultAnalyzerOptions(AnalyzerOptions* options)
+{
+    memset(options, 0, sizeof(*options));
+    options->traceFlags = DEFAULT_TRACE_FLAGS;
+    options->memorySize = DEFAULT_MEMORY_SIZE;
+    options->format = OUTPUT_TEXT;
+}
+
+int parseTraceCategories(const char* text, uint32_t* flags)
+{
+    uint32_t result = 0;
+    if (text == NULL)
+        return 0;
+    if (strcmp(text, "none") == 0)
+    {
+        *flags = 0;
+        return 1;
+    }
+
+    while (*text != 0)
+    {
+        size_t length = strcspn(text, ",");
+        uint32_t category = 0;
+        if (length == 3 && strncmp(text, "all", 3) == 0)
+        {
+            for (size_t i = 0; i < TRACE_CATEGORY_COUNT; ++i)
+                category |= traceCategories[i].flags;
+        }
+        for (size_t i = 0; i < TRACE_CATEGORY_COUNT && category == 0; ++i)
+        {
+            if (strlen(traceCategories[i].name) == length && strncmp(text, traceCategories[i].name, length) == 0)
+                category = traceCategories[i].flags;
+        }
+        if (category == 0)
+        {
+            printf("Unknown trace category %.*s\n", (int)length, text);
+            return 0;
+        }
+        result |= category;
+        text += length;
+        if (*text == ',')
+            ++text;
+    }
+    *flags = result;
+    return 1;
+}
+
+// Decimal or 0x hex with an optional K or M suffix
+static int parseCount(const char* text, uint64_t* value)
+{
+    char* end;
+    if (text == NULL || *text == 0 || *text == '-')
+        return 0;
+    errno = 0;
+    unsigned long long count = strtoull(text, &end, 0);
+    if (errno != 0)
+        return 0;
+    int shift = 0;
+    if (*end == 'k' || *end == 'K')
+        shift = 10;
+    else if (*end == 'm' || *end == 'M')
+        shift = 20;
+    if (shift != 0)
+        ++end;
+    if (*end != 0 || count > (ULLONG_MAX >> shift))
+        return 0;
+    count <<= shift;
+    *value = count;
+    return 1;
+}
+
+int parseMemorySize(const char* text, uint32_t* size)
+{
+    uint64_t value;
+    if (!parseCount(text, &value) || value < MIN_MEMORY_SIZE || value > MAX_MEMORY_SIZE)
+    {
+        printf("Memory size must be between %uK and %uK\n", MIN_MEMORY_SIZE >> 10, MAX_MEMORY_SIZE >> 10);
+        return 0;
+    }
+    *size = (uint32_t)value;
+    return 1;
+}
+
+int parseInstructionBudget(const char* text, uint64_t* budget)
+{
+    if (!parseCount(text, budget))
+    {
+        printf("Instruction budget must be a count, 0 for no limit\n");
+        return 0;
+    }
+    return 1;
+}
+
+int parseOutputFormat(const char* text, OutputFormat* format)
+{
+    if (text != NULL && strcmp(text, "text") == 0)
+        *format = OUTPUT_TEXT;
+    else if (text != NULL && strcmp(text, "json") == 0)
+        *format = OUTPUT_JSON;
+    else
+    {
+        printf("Output format must be one of text or json\n");
+        return 0;
+    }
+    return 1;
+}
+
+// Numbers may also be given as json numbers
+static const char* itemText(const cJSON* item, char* buffer, size_t size)
+{
+    if (cJSON_IsNumber(item))
+    {
+        snprintf(buffer, size, "%.0f", item->valuedouble);
+        return buffer;
+    }
+    return cJSON_GetStringValue(item);
+}
+
+int applyJsonOptions(const cJSON* json, AnalyzerOptions* options)
+{
+    const cJSON* item;
+    char buffer[32];
+
+    item = cJSON_GetObjectItem(json, "trace");
+    if (item != NULL && !(options->given & OPTION_TRACE) &&
+        !parseTraceCategories(cJSON_GetStringValue(item), &options->traceFlags))
+        return 0;
+
+    item = cJSON_GetObjectItem(json, "memory_size");
+    if (item != NULL && !(options->given & OPTION_MEMORY_SIZE) &&
+        !parseMemorySize(itemText(item, buffer, sizeof(buffer)), &options->memorySize))
+        return 0;
+
+    item = cJSON_GetObjectItem(json, "instruction_budget");
+    if (item != NULL && !(options->given & OPTION_INSTRUCTION_BUDGET) &&
+        !parseInstructionBudget(itemText(item, buffer, sizeof(buffer)), &options->instructionBudget))
+        return 0;
+
+    item = cJSON_GetObjectItem(json, "output_format");
+    if (item != NULL && !(options->given & OPTION_FORMAT) &&
+        !parseOutputFormat(cJSON_GetStringValue(item), &options->format))
+        return 0;
+
+    item = cJSON_GetObjectItem(json, "output_file");
+    if (item != NULL && !(options->given & OPTION_OUTPUT_FILE))
+    {
+        options->outputFile = cJSON_GetStringValue(item);
+        if (options->outputFile == NULL)
+        {
+            printf("output_file must be a file name\n");
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void describeAnalyzerOptions(const AnalyzerOptions* options, char* text, uint32_t size)
+{
+    snprintf(text, size, "trace=%x memory=%x budget=%llu format=%d", options->traceFlags, options->memorySize,
+             (unsigned long long)options->instructionBudget, (int)options->format);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+
+struct cJSON;
+
+typedef enum OutputFormat
+{
+    OUTPUT_TEXT,    // the report as it is written, module reports included
+    OUTPUT_JSON     // one json document on the last line, diagnostics stay text lines before it
+} OutputFormat;
+
+// Settings of a run that are not about the machine being emulated. Each one comes from the
+// command line, the json configuration or the default, in that order
+typedef struct AnalyzerOptions
+{
+    uint32_t traceFlags;            // DEBUG_*_F, only debug builds of the emulator trace
+    uint32_t memorySize;            // guest RAM from address 0
+    uint64_t instructionBudget;     // instructions all phases of a run may take together, 0 for no limit
+    OutputFormat format;
+    const char* outputFile;         // NULL for stdout
+    uint32_t given;                 // OPTION_* bits of the settings given on the command line
+} AnalyzerOptions;
+
+#define OPTION_TRACE 0x01
+#define OPTION_MEMORY_SIZE 0x02
+#define OPTION_INSTRUCTION_BUDGET 0x04
+#define OPTION_FORMAT 0x08
+#define OPTION_OUTPUT_FILE 0x10
+
+#define DEFAULT_MEMORY_SIZE 65536
+#define MIN_MEMORY_SIZE 20480
+#define MAX_MEMORY_SIZE 0x4000000   // 64MB, extended memory above 1MB; the stack stays below 0xA0000
+
+void defaultAnalyzerOptions(AnalyzerOptions* options);
+
+// "none", "all" or a comma separated list of decode, trace, tracecall, tracecall_regs,
+// disassemble, mem, io, sysint and instrument
+int parseTraceCategories(const char* text, uint32_t* flags);
+
+// Decimal or 0x hex, with an optional K or M suffix
+int parseMemorySize(const char* text, uint32_t* size);
+int parseInstructionBudget(const char* text, uint64_t* budget);
+int parseOutputFormat(const char* text, OutputFormat* format);
+
+// Fills in the settings of "trace", "memory_size", "instruction_budget", "output_format" and
+// "output_file" that were not given on the command line. Returns 0 on malformed values
+int applyJsonOptions(const struct cJSON* json, AnalyzerOptions* options);
+
+// The settings that change the report, as text for the result cache key
+void describeAnalyzerOptions(const AnalyzerOptions* options, char* text, uint32_t size);
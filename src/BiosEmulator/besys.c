@@ -49,16 +49,15 @@
 
 #include "biosemui.h"
 #include "include/pci_accessReg.h"
+#include "include/mmio.h"
+#include "include/watch.h"
+#include "include/dirty.h"
+#include "include/shadow.h"
+#include "include/memmap.h"
 #include <stdio.h>
 
 /*------------------------- Global Variables ------------------------------*/
 
-#ifndef CONFIG_X86EMU_RAW_IO
-static const char *BE_biosDate = "08/14/99";
-static u8 BE_model = 0xFC;
-static u8 BE_submodel = 0x00;
-#endif
-
 #undef DEBUG_IO_ACCESS
 
 #ifdef DEBUG_IO_ACCESS
@@ -74,60 +73,190 @@ static u8 BE_submodel = 0x00;
 #define LOG_outpw(port, val)	printf("outw.%04X <- %04X\n", (u16) port, val)
 #define LOG_outpd(port, val)	printf("outl.%04X <- %08X\n", (u16) port, val)
 
+
 /*----------------------------- Implementation ----------------------------*/
 
 /****************************************************************************
 PARAMETERS:
 addr    - Emulator memory address to convert
+size    - Size of the access in bytes
+write   - Non zero for a write access
 
 RETURNS:
-Actual memory address to read or write the data
+Actual memory address to read or write the data, or NULL if the access has
+to take the slow path.
 
 REMARKS:
 This function converts an emulator memory address in a 32-bit range to
-a real memory address that we wish to access. It handles splitting up the
-memory address space appropriately to access the emulator BIOS image, video
-memory and system BIOS etc.
+a real memory address that we wish to access. Below 1MB the compiled memory
+map (see memmap.h) decides where a page lives, above it guest RAM is linear
+up to M.mem_size. Accesses to MMIO, unmapped memory, writes to ROM and
+accesses straddling two pages return NULL.
 ****************************************************************************/
-static u8 *BE_memaddr(u32 addr)
+static u8 *BE_memaddr(u32 addr, int size, int write)
 {
-	if (addr >= 0xC0000 && addr <= _BE_env.biosmem_limit) {
-		return (u8*)(_BE_env.biosmem_base + addr - 0xC0000);
-	} else if (addr > _BE_env.biosmem_limit && addr < 0xD0000) {
-		DB(printf("BE_memaddr: address %#lx may be invalid!\n",
-			  (ulong)addr);)
-		return (u8 *)M.mem_base;
-	} else if (addr >= 0xA0000 && addr <= 0xBFFFF) {
-		return (u8*)(_BE_env.busmem_base + addr - 0xA0000);
+	if (addr <= 0xFFFFF) {
+		const BE_memPage *page = &_BE_memPages[addr >> BE_MEM_PAGE_SHIFT];
+		u8 *host = write ? page->write : page->read;
+		u32 offset = addr & (BE_MEM_PAGE_SIZE - 1);
+
+		if (host == NULL || offset > (u32)(BE_MEM_PAGE_SIZE - size))
+			return NULL;
+		return host + offset;
 	}
-#ifdef CONFIG_X86EMU_RAW_IO
-	else if (addr >= 0xD0000 && addr <= 0xFFFFF) {
-		/* We map the real System BIOS directly on real PC's */
-		DB(printf("BE_memaddr: System BIOS address %#lx\n",
-			  (ulong)addr);)
-		    return (u8 *)_BE_env.busmem_base + addr - 0xA0000;
+	if (addr < M.mem_size && M.mem_size - addr >= (u32)size)
+		return M.mem_base + addr;
+	return NULL;
+}
+
+/****************************************************************************
+PARAMETERS:
+addr    - Emulator memory address to read
+size    - Size of the access in bytes
+
+RETURNS:
+Value read from emulator memory.
+
+REMARKS:
+Slow path for reads BE_memaddr can not resolve to host memory. Accesses
+straddling a page boundary below 1MB are split into bytes, MMIO goes
+through the MMIO region registry and unmapped memory reads as all ones.
+****************************************************************************/
+static u32 BE_slowRead(u32 addr, int size)
+{
+	u32 val = 0;
+	int i;
+
+	if (size > 1 && addr < 0x100000 &&
+	    (addr & (BE_MEM_PAGE_SIZE - 1)) > (u32)(BE_MEM_PAGE_SIZE - size)) {
+		for (i = 0; i < size; i++) {
+			u8 *base = BE_memaddr(addr + i, 1, 0);
+			val |= (base ? *base : BE_slowRead(addr + i, 1)) << (i * 8);
+		}
+		return val;
 	}
-#else
-	else if (addr >= 0xFFFF5 && addr < 0xFFFFE) {
-		/* Return a faked BIOS date string for non-x86 machines */
-		debug_io("BE_memaddr - Returning BIOS date\n");
-		return (u8 *)(BE_biosDate + addr - 0xFFFF5);
-	} else if (addr == 0xFFFFE) {
-		/* Return system model identifier for non-x86 machines */
-		debug_io("BE_memaddr - Returning model\n");
-		return &BE_model;
-	} else if (addr == 0xFFFFF) {
-		/* Return system submodel identifier for non-x86 machines */
-		debug_io("BE_memaddr - Returning submodel\n");
-		return &BE_submodel;
+	if (addr > 0xFFFFF ? addr >= M.mem_size
+			   : _BE_memPages[addr >> BE_MEM_PAGE_SHIFT].type == BE_MEM_MMIO)
+		return BE_mmioRead(addr, size);
+
+	DB(printf("BE_slowRead: unmapped address %#lx\n", (ulong)addr);)
+	return size == 4 ? 0xFFFFFFFF : (1u << (size * 8)) - 1;
+}
+
+/****************************************************************************
+PARAMETERS:
+addr    - Emulator memory address written
+size    - Size of the write in bytes
+
+REMARKS:
+Called once a write has been stored in guest memory, so that dropped writes
+to ROM or unmapped memory leave no trace. Marks the pages dirty and the
+bytes initialized, and reports stores to pages code was executed from.
+****************************************************************************/
+static void BE_stored(u32 addr, int size)
+{
+	u8 flags = X86EMU_PAGE_FLAGS(addr, size);
+
+	if (flags & BE_PAGE_CLEAN)
+		BE_dirtyMark(addr, size);
+	if (flags & BE_PAGE_SHADOW)
+		BE_shadowMarkRange(addr, size);
+	if (flags & X86EMU_PAGE_CODE)
+		X86EMU_codeWritten(addr, size);
+}
+
+/****************************************************************************
+PARAMETERS:
+addr    - Emulator memory address to write
+val     - Value to store
+size    - Size of the access in bytes
+
+REMARKS:
+Slow path for writes BE_memaddr can not resolve to host memory. Writes to
+ROM and unmapped memory are dropped, MMIO writes count as stored when they
+land in a region's backing memory rather than a callback.
+****************************************************************************/
+static void BE_slowWrite(u32 addr, u32 val, int size)
+{
+	int i;
+
+	if (size > 1 && addr < 0x100000 &&
+	    (addr & (BE_MEM_PAGE_SIZE - 1)) > (u32)(BE_MEM_PAGE_SIZE - size)) {
+		for (i = 0; i < size; i++) {
+			u8 *base = BE_memaddr(addr + i, 1, 1);
+			if (base) {
+				*base = (u8)(val >> (i * 8));
+				BE_stored(addr + i, 1);
+			} else
+				BE_slowWrite(addr + i, (val >> (i * 8)) & 0xFF, 1);
+		}
+		return;
 	}
-#endif
-	else if (addr > M.mem_size - 1) {
-		HALT_SYS();
-		return (u8 *)M.mem_base;
+	if (addr > 0xFFFFF ? addr >= M.mem_size
+			   : _BE_memPages[addr >> BE_MEM_PAGE_SHIFT].type == BE_MEM_MMIO) {
+		if (BE_mmioWrite(addr, val, size))
+			BE_stored(addr, size);
+		return;
 	}
 
-	return (u8 *)(M.mem_base + addr);
+	DB(printf("BE_slowWrite: dropped write to %#lx\n", (ulong)addr);)
+}
+
+/****************************************************************************
+PARAMETERS:
+addr    - Emulator memory address read
+val     - Value read
+size    - Size of the access in bytes
+
+REMARKS:
+Read path for pages with BE_PAGE_WATCH or BE_PAGE_SHADOW set.
+****************************************************************************/
+static void BE_flaggedRead(u32 addr, u32 val, int size)
+{
+	u8 flags = X86EMU_PAGE_FLAGS(addr, size);
+
+	if (flags & BE_PAGE_WATCH)
+		BE_watchCheck(BE_WATCH_MEM, BE_WATCH_READ, addr, size, val);
+	if (flags & BE_PAGE_SHADOW)
+		BE_shadowRead(addr, size);
+}
+
+/****************************************************************************
+PARAMETERS:
+addr    - Emulator memory address to write
+val     - Value to store
+size    - Size of the access in bytes
+
+REMARKS:
+Write path for pages with any page flag set. The BE_wr functions only test
+the flags once and leave everything else to this function.
+****************************************************************************/
+static void BE_flaggedWrite(u32 addr, u32 val, int size)
+{
+	u8 flags = X86EMU_PAGE_FLAGS(addr, size);
+	u8 *base;
+
+	if (flags & BE_PAGE_WATCH)
+		BE_watchCheck(BE_WATCH_MEM, BE_WATCH_WRITE, addr, size, val);
+	if (_BE_env.emulateVGA && addr >= 0xA0000 && addr <= 0xBFFFF)
+		return;
+	base = BE_memaddr(addr, size, 1);
+	if (base == NULL) {
+		BE_slowWrite(addr, val, size);
+		return;
+	}
+	switch (size) {
+	case 1:
+		writeb_le(base, val);
+		break;
+	case 2:
+		writew_le(base, val);
+		break;
+	default:
+		writel_le(base, val);
+		break;
+	}
+	BE_stored(addr, size);
 }
 
 /****************************************************************************
@@ -143,12 +272,18 @@ regions that are handled differently, which this function handles.
 ****************************************************************************/
 u8 X86API BE_rdb(u32 addr)
 {
+	u8 val;
+
 	if (_BE_env.emulateVGA && addr >= 0xA0000 && addr <= 0xBFFFF)
-		return 0;
+		val = 0;
 	else {
-		u8 val = readb_le(BE_memaddr(addr));
-		return val;
+		u8 *base = BE_memaddr(addr, 1, 0);
+		val = base ? readb_le(base) : (u8)BE_slowRead(addr, 1);
 	}
+
+	if (X86EMU_PAGE_FLAGS(addr, 1) & (BE_PAGE_WATCH | BE_PAGE_SHADOW))
+		BE_flaggedRead(addr, val, 1);
+	return val;
 }
 
 /****************************************************************************
@@ -164,13 +299,18 @@ regions that are handled differently, which this function handles.
 ****************************************************************************/
 u16 X86API BE_rdw(u32 addr)
 {
+	u16 val;
+
 	if (_BE_env.emulateVGA && addr >= 0xA0000 && addr <= 0xBFFFF)
-		return 0;
+		val = 0;
 	else {
-		u8 *base = BE_memaddr(addr);
-		u16 val = readw_le(base);
-		return val;
+		u8 *base = BE_memaddr(addr, 2, 0);
+		val = base ? readw_le(base) : (u16)BE_slowRead(addr, 2);
 	}
+
+	if (X86EMU_PAGE_FLAGS(addr, 2) & (BE_PAGE_WATCH | BE_PAGE_SHADOW))
+		BE_flaggedRead(addr, val, 2);
+	return val;
 }
 
 /****************************************************************************
@@ -186,13 +326,18 @@ regions that are handled differently, which this function handles.
 ****************************************************************************/
 u32 X86API BE_rdl(u32 addr)
 {
+	u32 val;
+
 	if (_BE_env.emulateVGA && addr >= 0xA0000 && addr <= 0xBFFFF)
-		return 0;
+		val = 0;
 	else {
-		u8 *base = BE_memaddr(addr);
-		u32 val = readl_le(base);
-		return val;
+		u8 *base = BE_memaddr(addr, 4, 0);
+		val = base ? readl_le(base) : BE_slowRead(addr, 4);
 	}
+
+	if (X86EMU_PAGE_FLAGS(addr, 4) & (BE_PAGE_WATCH | BE_PAGE_SHADOW))
+		BE_flaggedRead(addr, val, 4);
+	return val;
 }
 
 /****************************************************************************
@@ -206,9 +351,19 @@ regions that are handled differently, which this function handles.
 ****************************************************************************/
 void X86API BE_wrb(u32 addr, u8 val)
 {
-	if (!(_BE_env.emulateVGA && addr >= 0xA0000 && addr <= 0xBFFFF)) {
-		writeb_le(BE_memaddr(addr), val);
+	u8 *base;
+
+	if (X86EMU_PAGE_FLAGS(addr, 1) != 0) {
+		BE_flaggedWrite(addr, val, 1);
+		return;
 	}
+	if (_BE_env.emulateVGA && addr >= 0xA0000 && addr <= 0xBFFFF)
+		return;
+	base = BE_memaddr(addr, 1, 1);
+	if (base)
+		writeb_le(base, val);
+	else
+		BE_slowWrite(addr, val, 1);
 }
 
 /****************************************************************************
@@ -222,11 +377,19 @@ regions that are handled differently, which this function handles.
 ****************************************************************************/
 void X86API BE_wrw(u32 addr, u16 val)
 {
-	if (!(_BE_env.emulateVGA && addr >= 0xA0000 && addr <= 0xBFFFF)) {
-		u8 *base = BE_memaddr(addr);
-		writew_le(base, val);
+	u8 *base;
 
+	if (X86EMU_PAGE_FLAGS(addr, 2) != 0) {
+		BE_flaggedWrite(addr, val, 2);
+		return;
 	}
+	if (_BE_env.emulateVGA && addr >= 0xA0000 && addr <= 0xBFFFF)
+		return;
+	base = BE_memaddr(addr, 2, 1);
+	if (base)
+		writew_le(base, val);
+	else
+		BE_slowWrite(addr, val, 2);
 }
 
 /****************************************************************************
@@ -240,10 +403,19 @@ regions that are handled differently, which this function handles.
 ****************************************************************************/
 void X86API BE_wrl(u32 addr, u32 val)
 {
-	if (!(_BE_env.emulateVGA && addr >= 0xA0000 && addr <= 0xBFFFF)) {
-		u8 *base = BE_memaddr(addr);
-		writel_le(base, val);
+	u8 *base;
+
+	if (X86EMU_PAGE_FLAGS(addr, 4) != 0) {
+		BE_flaggedWrite(addr, val, 4);
+		return;
 	}
+	if (_BE_env.emulateVGA && addr >= 0xA0000 && addr <= 0xBFFFF)
+		return;
+	base = BE_memaddr(addr, 4, 1);
+	if (base)
+		writel_le(base, val);
+	else
+		BE_slowWrite(addr, val, 4);
 }
 
 #if !defined(CONFIG_X86EMU_RAW_IO)
@@ -419,11 +591,13 @@ Value read from configuration register for PCI_READ_* operations
 REMARKS:
 Accesses a PCI configuration space register by decoding the value currently
 stored in the _BE_env.configAddress variable and passing it through to the
-portable PCI_accessReg function.
+portable PCI_accessReg function. Bits 27:24 of the address carry bits 11:8
+of the register number, giving access to the PCIe extended config space.
 ****************************************************************************/
 static u32 BE_accessReg(int regOffset, u32 value, int func)
 {
 	PCIDeviceInfo pciInfo;
+	int reg = ((_BE_env.configAddress >> 16) & 0xF00) | (_BE_env.configAddress & 0xFC);
 
 	pciInfo.mech1 = 1;
 	pciInfo.slot.i = 0;
@@ -432,14 +606,8 @@ static u32 BE_accessReg(int regOffset, u32 value, int func)
 	pciInfo.slot.p.Bus = (_BE_env.configAddress >> 16) & 0xFF;
 	pciInfo.slot.p.Enable = 1;
 
-	/* Ignore accesses to all devices other than the one we're POSTing */
-	if ((pciInfo.slot.p.Function ==
-	     _BE_env.vgaInfo.pciInfo->slot.p.Function)
-	    && (pciInfo.slot.p.Device == _BE_env.vgaInfo.pciInfo->slot.p.Device)
-	    && (pciInfo.slot.p.Bus == _BE_env.vgaInfo.pciInfo->slot.p.Bus))
-		return PCI_accessReg((_BE_env.configAddress & 0xFF) + regOffset,
-				     value, func, &pciInfo);
-	return 0;
+	/* PCI_accessReg decides which devices answer */
+	return PCI_accessReg(reg + regOffset, value, func, &pciInfo);
 }
 
 /****************************************************************************
@@ -499,7 +667,7 @@ static void PCI_outp(int port, u32 val, int type)
 	case REG_WRITE_DWORD:
 		if (port == 0xCF8)
 		{
-			_BE_env.configAddress = val & 0x80FFFFFC;
+			_BE_env.configAddress = val & 0x8FFFFFFC;
 		}
 		else if ((_BE_env.configAddress & 0x80000000) && port == 0xCFC)
 			BE_accessReg(0, val, REG_WRITE_DWORD);
@@ -552,6 +720,8 @@ u8 X86API BE_inb(X86EMU_pioAddr port)
 		debug_io("%02X\n", val);
 	}
 
+	if (BE_WATCH_PORT_HIT(port))
+		BE_watchCheck(BE_WATCH_IO, BE_WATCH_READ, port, 1, val);
 	return val;
 }
 
@@ -585,6 +755,8 @@ u16 X86API BE_inw(X86EMU_pioAddr port)
 		debug_io("%04X\n", val);
 	}
 
+	if (BE_WATCH_PORT_HIT(port))
+		BE_watchCheck(BE_WATCH_IO, BE_WATCH_READ, port, 2, val);
 	return val;
 }
 
@@ -617,6 +789,8 @@ u32 X86API BE_inl(X86EMU_pioAddr port)
 		debug_io("%08X\n", val);
 	}
 
+	if (BE_WATCH_PORT_HIT(port))
+		BE_watchCheck(BE_WATCH_IO, BE_WATCH_READ, port, 4, val);
 	return val;
 }
 
@@ -632,6 +806,9 @@ through to the real hardware if we don't need to special case it.
 ****************************************************************************/
 void X86API BE_outb(X86EMU_pioAddr port, u8 val)
 {
+	if (BE_WATCH_PORT_HIT(port))
+		BE_watchCheck(BE_WATCH_IO, BE_WATCH_WRITE, port, 1, val);
+
 #if !defined(CONFIG_X86EMU_RAW_IO)
 	if (IS_VGA_PORT(port))
 		VGA_outpb(port, val);
@@ -667,6 +844,9 @@ through to the real hardware if we don't need to special case it.
 ****************************************************************************/
 void X86API BE_outw(X86EMU_pioAddr port, u16 val)
 {
+	if (BE_WATCH_PORT_HIT(port))
+		BE_watchCheck(BE_WATCH_IO, BE_WATCH_WRITE, port, 2, val);
+
 #if !defined(CONFIG_X86EMU_RAW_IO)
 	if (IS_VGA_PORT(port)) {
 		VGA_outpb(port, val);
@@ -698,6 +878,9 @@ through to the real hardware if we don't need to special case it.
 ****************************************************************************/
 void X86API BE_outl(X86EMU_pioAddr port, u32 val)
 {
+	if (BE_WATCH_PORT_HIT(port))
+		BE_watchCheck(BE_WATCH_IO, BE_WATCH_WRITE, port, 4, val);
+
 #if !defined(CONFIG_X86EMU_RAW_IO)
 	if (IS_PCI_PORT(port)) {
 		PCI_outp(port, val, REG_WRITE_DWORD);
@@ -45,8 +45,13 @@
 //#include <common.h>
 //#include <asm/io.h>
 #include <stdio.h>
+#include <string.h>
 #include "biosemui.h"
 #include "include/pci_accessReg.h"
+#include "include/vbe.h"
+#include "include/services.h"
+#include "include/memmap.h"
+#include "include/pmm.h"
 
 /*----------------------------- Implementation ----------------------------*/
 
@@ -54,21 +59,6 @@
 PARAMETERS:
 intno   - Interrupt number being serviced
 
-REMARKS:
-Handler for undefined interrupts.
-****************************************************************************/
-static void X86API undefined_intr(int intno)
-{
-	if (BE_rdw(intno * 4 + 2) == BIOS_SEG) {
-		DB(printf("biosEmu: undefined interrupt %xh called!\n", intno);)
-	} else
-		X86EMU_prepareForInt(intno);
-}
-
-/****************************************************************************
-PARAMETERS:
-intno   - Interrupt number being serviced
-
 REMARKS:
 This function handles the default system BIOS Int 10h (the default is stored
 in the Int 42h vector by the system BIOS at bootup). We only need to handle
@@ -110,10 +100,13 @@ This function handles the default system BIOS Int 10h. If the POST code
 has not yet re-vectored the Int 10h BIOS interrupt vector, we handle this
 by simply calling the int42 interrupt handler above. Very early in the
 BIOS POST process, the vector gets replaced and we simply let the real
-mode interrupt handler process the interrupt.
+mode interrupt handler process the interrupt. VBE calls (AH=4Fh) go to the
+host provider in vbe.c when it is selected or no ROM has hooked Int 10h.
 ****************************************************************************/
 static void X86API int10(int intno)
 {
+	if (intno == 0x10 && M.x86.R_AH == 0x4F && _BE_vbeInt10())
+		return;
 	if (BE_rdw(intno * 4 + 2) == BIOS_SEG)
 		int42(intno);
 	else
@@ -130,160 +123,478 @@ static void X86API int10(int intno)
 #define SET_FAILED          0x88
 #define BUFFER_TOO_SMALL    0x89
 
+/* Interrupt routing reported by B10Eh: every pin of every device can go to
+ * any of these IRQs, through links 60h-63h (the PIRQA-D router registers)
+ * swizzled by device number like the pins behind a bridge */
+
+#define PCI_IRQ_BITMAP      0x0E20	/* IRQ 5, 9, 10 and 11 */
+#define PCI_LINK_BASE       0x60
+#define PCI_ROUTING_ENTRY   16
+
+static u8 linkIrq[4];		/* IRQ connected to each link by B10Fh, 0 when unrouted */
+
+/* The BIOS32 service directory, the $PMM structure and the stubs behind
+ * their entry points live in the F segment. The stubs trap to the host
+ * through Int 1Ah, for the PCI BIOS, and through private vectors. */
+
+#define BIOS32_DIRECTORY    0xE000
+#define BIOS32_ENTRY        0xE010
+#define PCI_BIOS_ENTRY      0xE020
+#define PMM_HEADER          0xE030
+#define PMM_ENTRY           0xE040
+#define BIOS32_TRAP         0xF8
+#define PMM_TRAP            0xF9
+#define BIOS32_PCI_SERVICE  0x49435024	/* "$PCI" */
+
+/****************************************************************************
+PARAMETERS:
+func	- PCI_READ_* or PCI_WRITE_* code of the access
+
+REMARKS:
+Performs the configuration access of functions B108h-B10Dh. The register
+number in DI has to be naturally aligned for the access width.
+****************************************************************************/
+static int configAccess(int func)
+{
+	static const int widths[] = { 1, 2, 4, 1, 2, 4 };
+	PCIDeviceInfo configInfo;
+
+	if (M.x86.R_DI >= PCI_CONFIG_SIZE || (M.x86.R_DI & (widths[func] - 1)))
+		return BAD_REGISTER_NUMBER;
+
+	configInfo.mech1 = 1;
+	configInfo.slot.i = (u32) M.x86.R_BX << 8;
+	configInfo.slot.p.Enable = 1;
+
+	switch (func) {
+	case PCI_READ_BYTE:
+		M.x86.R_CL = (u8) PCI_accessReg(M.x86.R_DI, 0, func, &configInfo);
+		break;
+	case PCI_READ_WORD:
+		M.x86.R_CX = (u16) PCI_accessReg(M.x86.R_DI, 0, func, &configInfo);
+		break;
+	case PCI_READ_DWORD:
+		M.x86.R_ECX = (u32) PCI_accessReg(M.x86.R_DI, 0, func, &configInfo);
+		break;
+	case PCI_WRITE_BYTE:
+		PCI_accessReg(M.x86.R_DI, M.x86.R_CL, func, &configInfo);
+		break;
+	case PCI_WRITE_WORD:
+		PCI_accessReg(M.x86.R_DI, M.x86.R_CX, func, &configInfo);
+		break;
+	case PCI_WRITE_DWORD:
+		PCI_accessReg(M.x86.R_DI, M.x86.R_ECX, func, &configInfo);
+		break;
+	}
+	return SUCCESSFUL;
+}
+
+/* Value of the vendor ID register of the function BX names, all ones when absent */
+static u16 vendorAt(u16 busDevFn)
+{
+	PCIDeviceInfo configInfo;
+
+	configInfo.mech1 = 1;
+	configInfo.slot.i = (u32) busDevFn << 8;
+	configInfo.slot.p.Enable = 1;
+	return (u16) PCI_accessReg(0, 0, PCI_READ_WORD, &configInfo);
+}
+
+/****************************************************************************
+REMARKS:
+Get PCI Interrupt Routing Options (B10Eh). ES:DI points to a buffer header
+holding the buffer size and a far pointer to the buffer. One 16 byte entry
+is returned per device (not per function) of the topology.
+****************************************************************************/
+static int getRoutingOptions(void)
+{
+	u32 header = ((u32) M.x86.R_ES << 4) + M.x86.R_DI;
+	u16 size = BE_rdw(header);
+	u32 buffer = ((u32) BE_rdw(header + 4) << 4) + BE_rdw(header + 2);
+	PCIslot slot;
+	int count = 0;
+	int last = -1;
+
+	for (int i = 0; PCI_enumerate(i, &slot); ++i) {
+		int busDev = (slot.p.Bus << 5) | slot.p.Device;
+		u32 entry = buffer + count * PCI_ROUTING_ENTRY;
+
+		if (busDev == last)
+			continue;
+		last = busDev;
+		if ((count + 1) * PCI_ROUTING_ENTRY <= size) {
+			BE_wrb(entry, (u8) slot.p.Bus);
+			BE_wrb(entry + 1, (u8) (slot.p.Device << 3));
+			for (int pin = 0; pin < 4; ++pin) {
+				BE_wrb(entry + 2 + pin * 3, PCI_LINK_BASE + ((pin + slot.p.Device) & 3));
+				BE_wrw(entry + 3 + pin * 3, PCI_IRQ_BITMAP);
+			}
+			BE_wrb(entry + 14, 0);	/* embedded, no physical slot */
+			BE_wrb(entry + 15, 0);
+		}
+		++count;
+	}
+
+	BE_wrw(header, (u16) (count * PCI_ROUTING_ENTRY));
+	if (count * PCI_ROUTING_ENTRY > size)
+		return BUFFER_TOO_SMALL;
+	M.x86.R_BX = 0;		/* no IRQ is dedicated to PCI */
+	return SUCCESSFUL;
+}
+
+/****************************************************************************
+REMARKS:
+Set PCI Hardware Interrupt (B10Fh). Connects pin CH (0Ah-0Dh) of the device
+in BX to IRQ CL. Like on real systems, updating the interrupt line register
+is left to the caller.
+****************************************************************************/
+static int setInterrupt(void)
+{
+	int pin = M.x86.R_CH - 0x0A;
+	int device = (M.x86.R_BL >> 3) & 0x1F;
+
+	if (pin < 0 || pin > 3 || M.x86.R_CL > 15 || !(PCI_IRQ_BITMAP & (1 << M.x86.R_CL)))
+		return SET_FAILED;
+	if (vendorAt(M.x86.R_BX) == 0xFFFF)
+		return SET_FAILED;
+	linkIrq[(pin + device) & 3] = M.x86.R_CL;
+	return SUCCESSFUL;
+}
+
 /****************************************************************************
 PARAMETERS:
 intno   - Interrupt number being serviced
 
 REMARKS:
 This function handles the default Int 1Ah interrupt handler for the real
-mode code, which provides support for the PCI BIOS functions. Since we only
-want to allow the real mode BIOS code *only* see the PCI config space for
-its own device, we only return information for the specific PCI config
-space that we have passed in to the init function. This solves problems
-when using the BIOS to warm boot a secondary adapter when there is an
-identical adapter before it on the bus (some BIOS'es get confused in this
-case).
+mode code, which provides support for the PCI BIOS 2.1 functions. The find
+functions search every function of the topology described in the JSON
+config, in bus order, and config accesses go to whichever slot BX names.
+DI may address the PCIe extended configuration space. The 32-bit entry
+point handed out by the BIOS32 directory ends up here as well.
 ****************************************************************************/
 static void X86API int1A(int unused)
 {
-	u16 pciSlot;
-
-	/* Fail if no PCI device information has been registered */
-	if (!_BE_env.vgaInfo.pciInfo)
-		return;
+	PCIslot foundSlot;
+	int status = SUCCESSFUL;
 
-	pciSlot = (u16) (_BE_env.vgaInfo.pciInfo->slot.i >> 8);
 	switch (M.x86.R_AX) {
 	case 0xB101:		/* PCI bios present? */
-		M.x86.R_AL = 0x00;	/* no config space/special cycle generation support */
+		M.x86.R_AL = 0x01;	/* config mechanism #1, no special cycles */
 		M.x86.R_EDX = 0x20494350;	/* " ICP" */
 		M.x86.R_BX = 0x0210;	/* Version 2.10 */
-		M.x86.R_CL = 0;	/* Max bus number in system */
-		CLEAR_FLAG(F_CF);
+		M.x86.R_CL = (u8) PCI_maxBus();	/* Max bus number in system */
+		M.x86.R_EDI = 0xF0000 + PCI_BIOS_ENTRY;	/* Protected mode entry point */
 		break;
 	case 0xB102:		/* Find PCI device */
-		M.x86.R_AH = DEVICE_NOT_FOUND;
-		if (M.x86.R_DX == _BE_env.vgaInfo.pciInfo->VendorID &&
-		    M.x86.R_CX == _BE_env.vgaInfo.pciInfo->DeviceID &&
-		    M.x86.R_SI == 0) {
-			M.x86.R_AH = SUCCESSFUL;
-			M.x86.R_BX = pciSlot;
+		status = DEVICE_NOT_FOUND;
+		if (M.x86.R_DX == 0xFFFF)
+			status = BAD_VENDOR_ID;
+		else if (PCI_findDevice(M.x86.R_DX, M.x86.R_CX, M.x86.R_SI, &foundSlot)) {
+			status = SUCCESSFUL;
+			M.x86.R_BX = (u16) (foundSlot.i >> 8);
 		}
-		CONDITIONAL_SET_FLAG((M.x86.R_AH != SUCCESSFUL), F_CF);
 		break;
 	case 0xB103:		/* Find PCI class code */
-		M.x86.R_AH = DEVICE_NOT_FOUND;
-		if (M.x86.R_CL == _BE_env.vgaInfo.pciInfo->Interface &&
-		    M.x86.R_CH == _BE_env.vgaInfo.pciInfo->SubClass &&
-		    (u8) (M.x86.R_ECX >> 16) ==
-		    _BE_env.vgaInfo.pciInfo->BaseClass) {
-			M.x86.R_AH = SUCCESSFUL;
-			M.x86.R_BX = pciSlot;
+		status = DEVICE_NOT_FOUND;
+		if (PCI_findClass(M.x86.R_ECX, M.x86.R_SI, &foundSlot)) {
+			status = SUCCESSFUL;
+			M.x86.R_BX = (u16) (foundSlot.i >> 8);
 		}
-		CONDITIONAL_SET_FLAG((M.x86.R_AH != SUCCESSFUL), F_CF);
+		break;
+	case 0xB106:		/* Generate special cycle */
+		status = FUNC_NOT_SUPPORT;
 		break;
 	case 0xB108:		/* Read configuration byte */
-		M.x86.R_AH = BAD_REGISTER_NUMBER;
-		if (M.x86.R_BX == pciSlot) {
-			M.x86.R_AH = SUCCESSFUL;
-			M.x86.R_CL =
-			    (u8) PCI_accessReg(M.x86.R_DI, 0, PCI_READ_BYTE,
-					       _BE_env.vgaInfo.pciInfo);
-		}
-		CONDITIONAL_SET_FLAG((M.x86.R_AH != SUCCESSFUL), F_CF);
+		status = configAccess(PCI_READ_BYTE);
 		break;
 	case 0xB109:		/* Read configuration word */
-		M.x86.R_AH = BAD_REGISTER_NUMBER;
-		if (M.x86.R_BX == pciSlot) {
-			M.x86.R_AH = SUCCESSFUL;
-#ifdef __KERNEL__
-# ifdef CONFIG_DM_PCI
-			dm_pci_read_config16(_BE_env.vgaInfo.pcidev, M.x86.R_DI,
-					     &M.x86.R_CX);
-# else
-			pci_read_config_word(_BE_env.vgaInfo.pcidev, M.x86.R_DI,
-					     &M.x86.R_CX);
-# endif
-#else
-			M.x86.R_CX =
-			    (u16) PCI_accessReg(M.x86.R_DI, 0, PCI_READ_WORD,
-						_BE_env.vgaInfo.pciInfo);
-#endif
-		}
-		CONDITIONAL_SET_FLAG((M.x86.R_AH != SUCCESSFUL), F_CF);
+		status = configAccess(PCI_READ_WORD);
 		break;
 	case 0xB10A:		/* Read configuration dword */
-		M.x86.R_AH = BAD_REGISTER_NUMBER;
-		if (M.x86.R_BX == pciSlot) {
-			M.x86.R_AH = SUCCESSFUL;
-#ifdef __KERNEL__
-# ifdef CONFIG_DM_PCI
-			dm_pci_read_config32(_BE_env.vgaInfo.pcidev,
-					     M.x86.R_DI, &M.x86.R_ECX);
-# else
-			pci_read_config_dword(_BE_env.vgaInfo.pcidev,
-					      M.x86.R_DI, &M.x86.R_ECX);
-# endif
-#else
-			M.x86.R_ECX =
-			    (u32) PCI_accessReg(M.x86.R_DI, 0, PCI_READ_DWORD,
-						_BE_env.vgaInfo.pciInfo);
-#endif
-		}
-		CONDITIONAL_SET_FLAG((M.x86.R_AH != SUCCESSFUL), F_CF);
+		status = configAccess(PCI_READ_DWORD);
 		break;
 	case 0xB10B:		/* Write configuration byte */
-		M.x86.R_AH = BAD_REGISTER_NUMBER;
-		if (M.x86.R_BX == pciSlot) {
-			M.x86.R_AH = SUCCESSFUL;
-#ifdef __KERNEL__
-# ifdef CONFIG_DM_PCI
-			dm_pci_write_config8(_BE_env.vgaInfo.pcidev,
-					     M.x86.R_DI, M.x86.R_CL);
-# else
-			pci_write_config_byte(_BE_env.vgaInfo.pcidev,
-					      M.x86.R_DI, M.x86.R_CL);
-# endif
-#else
-			PCI_accessReg(M.x86.R_DI, M.x86.R_CL, PCI_WRITE_BYTE,
-				      _BE_env.vgaInfo.pciInfo);
-#endif
-		}
-		CONDITIONAL_SET_FLAG((M.x86.R_AH != SUCCESSFUL), F_CF);
+		status = configAccess(PCI_WRITE_BYTE);
 		break;
 	case 0xB10C:		/* Write configuration word */
-		M.x86.R_AH = BAD_REGISTER_NUMBER;
-		if (M.x86.R_BX == pciSlot) {
-			M.x86.R_AH = SUCCESSFUL;
-			// pci_write_config_word(_BE_env.vgaInfo.pcidev,
-			// 		      M.x86.R_DI, M.x86.R_CX);
-			PCI_accessReg(M.x86.R_DI, M.x86.R_CX, PCI_WRITE_WORD,
-				      _BE_env.vgaInfo.pciInfo);
-		}
-		CONDITIONAL_SET_FLAG((M.x86.R_AH != SUCCESSFUL), F_CF);
+		status = configAccess(PCI_WRITE_WORD);
 		break;
 	case 0xB10D:		/* Write configuration dword */
-		M.x86.R_AH = BAD_REGISTER_NUMBER;
-		if (M.x86.R_BX == pciSlot) {
-			M.x86.R_AH = SUCCESSFUL;
-#ifdef __KERNEL__
-# ifdef CONFIG_DM_PCI
-			dm_pci_write_config32(_BE_env.vgaInfo.pcidev,
-					      M.x86.R_DI, M.x86.R_ECX);
-# else
-			pci_write_config_dword(_BE_env.vgaInfo.pcidev,
-					       M.x86.R_DI, M.x86.R_ECX);
-# endif
-#else
-			PCI_accessReg(M.x86.R_DI, M.x86.R_ECX, PCI_WRITE_DWORD,
-				      _BE_env.vgaInfo.pciInfo);
-#endif
-		}
-		CONDITIONAL_SET_FLAG((M.x86.R_AH != SUCCESSFUL), F_CF);
+		status = configAccess(PCI_WRITE_DWORD);
+		break;
+	case 0xB10E:		/* Get IRQ routing options */
+		status = getRoutingOptions();
+		break;
+	case 0xB10F:		/* Set PCI IRQ */
+		status = setInterrupt();
 		break;
 	default:
 		printf("biosEmu/bios.int1a: unknown function AX=%#04x\n",
 		       M.x86.R_AX);
+		status = FUNC_NOT_SUPPORT;
+	}
+	M.x86.R_AH = (u8) status;
+	CONDITIONAL_SET_FLAG((status != SUCCESSFUL), F_CF);
+}
+
+/****************************************************************************
+PARAMETERS:
+intno   - Interrupt number being serviced
+
+REMARKS:
+Entry point of the BIOS32 service directory, reached through the stub in
+the F segment. EAX names the service, BL has to be 0. Only the PCI BIOS
+("$PCI") is provided; its base, length and entry offset are returned in
+EBX, ECX and EDX.
+****************************************************************************/
+static void X86API bios32(int intno)
+{
+	if (M.x86.R_BL != 0) {
+		M.x86.R_AL = 0x81;	/* unimplemented function */
+		return;
+	}
+	if (M.x86.R_EAX != BIOS32_PCI_SERVICE) {
+		M.x86.R_AL = 0x80;	/* service not present */
+		return;
+	}
+	M.x86.R_AL = 0x00;
+	M.x86.R_EBX = 0xF0000;
+	M.x86.R_ECX = 0x10000;
+	M.x86.R_EDX = PCI_BIOS_ENTRY;
+}
+
+/****************************************************************************
+PARAMETERS:
+fseg	- Host address of the F segment
+
+REMARKS:
+Lays out the structures option ROMs look for in the system BIOS: the
+BIOS32 service directory ("_32_") and the POST Memory Manager ("$PMM"),
+both one paragraph long on a paragraph boundary, and the stubs behind
+their entry points.
+****************************************************************************/
+static void checksum(u8 * header, int checksumOffset)
+{
+	u8 sum = 0;
+
+	for (int i = 0; i < 16; ++i)
+		sum += header[i];
+	header[checksumOffset] = (u8) - sum;
+}
+
+void _BE_bios_fseg(u8 * fseg)
+{
+	static const u8 bios32Stub[] = { 0xCD, BIOS32_TRAP, 0xCB };	/* int BIOS32_TRAP; retf */
+	static const u8 pciStub[] = { 0xCD, 0x1A, 0xCB };	/* int 1Ah; retf */
+	static const u8 pmmStub[] = { 0xCD, PMM_TRAP, 0xCB };	/* int PMM_TRAP; retf */
+	u8 *directory = fseg + BIOS32_DIRECTORY;
+	u8 *pmm = fseg + PMM_HEADER;
+
+	memset(directory, 0, 16);
+	memcpy(directory, "_32_", 4);
+	writel_le(directory + 4, 0xF0000 + BIOS32_ENTRY);
+	directory[8] = 0;	/* revision */
+	directory[9] = 1;	/* length in paragraphs */
+	checksum(directory, 10);
+
+	memset(pmm, 0, 16);
+	memcpy(pmm, "$PMM", 4);
+	pmm[4] = 0x01;		/* revision */
+	pmm[5] = 1;		/* length in paragraphs */
+	writew_le(pmm + 7, PMM_ENTRY);	/* entry point, offset then segment */
+	writew_le(pmm + 9, 0xF000);
+	checksum(pmm, 6);
+
+	memcpy(fseg + BIOS32_ENTRY, bios32Stub, sizeof(bios32Stub));
+	memcpy(fseg + PCI_BIOS_ENTRY, pciStub, sizeof(pciStub));
+	memcpy(fseg + PMM_ENTRY, pmmStub, sizeof(pmmStub));
+}
+
+/* BIOS data area fields */
+
+#define BDA_EQUIPMENT       0x410
+#define BDA_MEMORY_SIZE     0x413
+#define BDA_KEYBOARD_FLAGS  0x417
+
+#define SMAP                0x534D4150	/* "SMAP" */
+#define E820_RAM            1
+#define E820_RESERVED       2
+
+typedef struct {
+	u64 base;
+	u64 length;
+	u32 type;
+} e820Entry;
+
+/****************************************************************************
+PARAMETERS:
+intno   - Interrupt number being serviced
+
+REMARKS:
+Int 11h, returns the equipment word from the BIOS data area.
+****************************************************************************/
+static void X86API int11(int intno)
+{
+	M.x86.R_AX = BE_rdw(BDA_EQUIPMENT);
+}
+
+/****************************************************************************
+PARAMETERS:
+intno   - Interrupt number being serviced
+
+REMARKS:
+Int 12h, returns the conventional memory size in KB from the BIOS data
+area, which option ROMs lower when they carve out memory for themselves.
+****************************************************************************/
+static void X86API int12(int intno)
+{
+	M.x86.R_AX = BE_rdw(BDA_MEMORY_SIZE);
+}
+
+/* One entry per run of pages below 1MB, plus guest RAM above 1MB and ECAM */
+#define E820_MAX_ENTRIES    (BE_MEM_PAGES + 2)
+
+/* E820 type of a page below 1MB as the compiled memory map has it, 0 for a
+ * hole. RAM in the VGA window or under the VGA BIOS image is not usable. */
+static u32 pageType(u32 page)
+{
+	u32 addr = page << BE_MEM_PAGE_SHIFT;
+
+	switch (_BE_memPages[page].type) {
+	case BE_MEM_UNMAPPED:
+		return 0;
+	case BE_MEM_RAM:
+		if (addr < BE_UPPER_MEM_BASE || addr > _BE_env.biosmem_limit)
+			return E820_RAM;
+		return E820_RESERVED;
+	default:
+		return E820_RESERVED;
+	}
+}
+
+/****************************************************************************
+PARAMETERS:
+map	- Place to store the memory map, E820_MAX_ENTRIES entries at most
+
+REMARKS:
+Builds the system memory map from the compiled layout of the real mode
+megabyte, so regions a memory_map declared show up as they are mapped, and
+from the guest memory size above 1MB.
+****************************************************************************/
+static int memoryMap(e820Entry * map)
+{
+	int count = 0;
+	u32 page = 0;
+
+	while (page < BE_MEM_PAGES) {
+		u32 type = pageType(page);
+		u32 first = page;
+
+		while (page < BE_MEM_PAGES && pageType(page) == type)
+			page++;
+		if (type != 0)
+			map[count++] = (e820Entry) { (u64) first << BE_MEM_PAGE_SHIFT,
+						     (u64) (page - first) << BE_MEM_PAGE_SHIFT, type };
+	}
+	if (M.mem_size > 0x100000)
+		map[count++] = (e820Entry) { 0x100000, M.mem_size - 0x100000, E820_RAM };
+	map[count++] = (e820Entry) { PCI_ECAM_BASE, PCI_ECAM_SIZE, E820_RESERVED };
+	return count;
+}
+
+/* Guest memory above 1MB in KB */
+static u32 extendedMemory(void)
+{
+	return M.mem_size > 0x100000 ? (M.mem_size - 0x100000) >> 10 : 0;
+}
+
+/****************************************************************************
+PARAMETERS:
+intno   - Interrupt number being serviced
+
+REMARKS:
+Int 15h AX=E820h, returns one entry of the system memory map per call at
+ES:DI, with EBX as the continuation value.
+****************************************************************************/
+static void X86API int15_E820(int intno)
+{
+	e820Entry map[E820_MAX_ENTRIES];
+	int count = memoryMap(map);
+	u32 index = M.x86.R_EBX;
+	u32 addr = ((u32) M.x86.R_ES << 4) + M.x86.R_DI;
+
+	if (M.x86.R_EDX != SMAP || M.x86.R_ECX < 20 || index >= count) {
+		M.x86.R_AH = 0x86;
+		SET_FLAG(F_CF);
+		return;
+	}
+	BE_wrl(addr, (u32) map[index].base);
+	BE_wrl(addr + 4, (u32) (map[index].base >> 32));
+	BE_wrl(addr + 8, (u32) map[index].length);
+	BE_wrl(addr + 12, (u32) (map[index].length >> 32));
+	BE_wrl(addr + 16, map[index].type);
+	M.x86.R_EAX = SMAP;
+	M.x86.R_ECX = 20;
+	M.x86.R_EBX = index + 1 < count ? index + 1 : 0;
+	CLEAR_FLAG(F_CF);
+}
+
+/****************************************************************************
+PARAMETERS:
+intno   - Interrupt number being serviced
+
+REMARKS:
+Int 15h AX=E801h, returns the KB of memory between 1MB and 16MB in AX/CX
+and the 64KB blocks above 16MB in BX/DX.
+****************************************************************************/
+static void X86API int15_E801(int intno)
+{
+	u32 extended = extendedMemory();
+	u32 below16 = extended < 0x3C00 ? extended : 0x3C00;
+
+	M.x86.R_AX = M.x86.R_CX = (u16) below16;
+	M.x86.R_BX = M.x86.R_DX = (u16) ((extended - below16) >> 6);
+	CLEAR_FLAG(F_CF);
+}
+
+/****************************************************************************
+PARAMETERS:
+intno   - Interrupt number being serviced
+
+REMARKS:
+Int 15h AH=88h, returns the KB of memory above 1MB, up to 64MB.
+****************************************************************************/
+static void X86API int15_88(int intno)
+{
+	u32 extended = extendedMemory();
+
+	M.x86.R_AX = (u16) (extended < 0xFFFF ? extended : 0xFFFF);
+	CLEAR_FLAG(F_CF);
+}
+
+/****************************************************************************
+PARAMETERS:
+intno   - Interrupt number being serviced
+
+REMARKS:
+Int 16h keyboard status functions. There is no keyboard, so the check
+functions (AH=01h/11h) always report an empty buffer and the shift status
+functions (AH=02h/12h) return the flags from the BIOS data area.
+****************************************************************************/
+static void X86API int16_status(int intno)
+{
+	switch (M.x86.R_AH) {
+	case 0x01:
+	case 0x11:
+		SET_FLAG(F_ZF);
+		break;
+	case 0x02:
+		M.x86.R_AL = BE_rdb(BDA_KEYBOARD_FLAGS);
+		break;
+	case 0x12:
+		M.x86.R_AX = BE_rdw(BDA_KEYBOARD_FLAGS);
+		break;
 	}
 }
 
@@ -295,20 +606,39 @@ on the bus, so that it will work correctly thinking that it is the only
 device present on the bus (ie: avoiding any adapters present in from of
 the device we are trying to control).
 ****************************************************************************/
-#define BE_constLE_32(v)    ((((((v)&0xff00)>>8)|(((v)&0xff)<<8))<<16)|(((((v)&0xff000000)>>8)|(((v)&0x00ff0000)<<8))>>16))
-
 void _BE_bios_init(u32 * intrTab)
 {
 	int i;
 	X86EMU_intrFuncs bios_intr_tab[256];
+	u32 conventional = M.mem_size < BE_UPPER_MEM_BASE ? M.mem_size : BE_UPPER_MEM_BASE;
 
 	for (i = 0; i < 256; ++i) {
-		intrTab[i] = BE_constLE_32(BIOS_SEG << 16);
-		bios_intr_tab[i] = undefined_intr;
+		writel_le((u8 *) &intrTab[i], BIOS_SEG << 16);
+		bios_intr_tab[i] = _BE_serviceDispatch;
 	}
-	bios_intr_tab[0x10] = int10;
-	bios_intr_tab[0x1A] = int1A;
-	bios_intr_tab[0x42] = int42;
-	bios_intr_tab[0x6D] = int10;
 	X86EMU_setupIntrFuncs(bios_intr_tab);
+
+	/* Int 10h and Int 1Ah do their own checks for hooked vectors */
+	BE_serviceRegister(0x10, BE_MATCH_ANY, 0, BE_SERVICE_ALWAYS, int10, "video");
+	BE_serviceRegister(0x11, BE_MATCH_ANY, 0, 0, int11, "equipment");
+	BE_serviceRegister(0x12, BE_MATCH_ANY, 0, 0, int12, "memory size");
+	BE_serviceRegister(0x15, BE_MATCH_AX, 0xE820, 0, int15_E820, "memory map");
+	BE_serviceRegister(0x15, BE_MATCH_AX, 0xE801, 0, int15_E801, "memory size E801");
+	BE_serviceRegister(0x15, BE_MATCH_AH, 0x8800, 0, int15_88, "extended memory");
+	BE_serviceRegister(0x16, BE_MATCH_AH, 0x0100, 0, int16_status, "keystroke check");
+	BE_serviceRegister(0x16, BE_MATCH_AH, 0x0200, 0, int16_status, "shift flags");
+	BE_serviceRegister(0x16, BE_MATCH_AH, 0x1100, 0, int16_status, "extended keystroke check");
+	BE_serviceRegister(0x16, BE_MATCH_AH, 0x1200, 0, int16_status, "extended shift flags");
+	BE_serviceRegister(0x1A, BE_MATCH_AH, 0xB100, BE_SERVICE_ALWAYS, int1A, "pci bios");
+	BE_serviceRegister(0x42, BE_MATCH_ANY, 0, 0, int42, "video default");
+	BE_serviceRegister(0x6D, BE_MATCH_ANY, 0, BE_SERVICE_ALWAYS, int10, "video");
+	BE_serviceRegister(BIOS32_TRAP, BE_MATCH_ANY, 0, BE_SERVICE_ALWAYS, bios32, "bios32 directory");
+	BE_serviceRegister(PMM_TRAP, BE_MATCH_ANY, 0, BE_SERVICE_ALWAYS, _BE_pmmService, "pmm");
+	BE_pmmReset();
+	memset(linkIrq, 0, sizeof(linkIrq));
+
+	/* BIOS data area: FPU and 80x25 color display, conventional memory */
+	writew_le((u8 *) intrTab + BDA_EQUIPMENT, 0x0022);
+	writew_le((u8 *) intrTab + BDA_MEMORY_SIZE, conventional >> 10);
+	BE_vbeReset();
 }
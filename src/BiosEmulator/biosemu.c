@@ -51,6 +51,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "biosemui.h"
+#include "include/dirty.h"
+#include "include/shadow.h"
+#include "include/memmap.h"
+#include "../MemAllocator.h"
 
 BE_sysEnv _BE_env = {{0}};
 static X86EMU_memFuncs _BE_mem /*__attribute__((section(GOT2_TYPE)))*/ = {
@@ -92,7 +96,9 @@ int X86API BE_init(u32 debugFlags, int memSize, BE_VGAInfo * info, int shared)
 		return 0;
 	}
 
-	M.mem_base = malloc(memSize);
+	/* Guest RAM and bus memory sit on the memory access fast path, so they
+	 * come from the large allocator and get huge pages when enabled */
+	M.mem_base = allocateLargeHostMemory(memSize);
 
 	if (M.mem_base == NULL){
 		printf("Biosemu:Out of memory!");
@@ -101,7 +107,7 @@ int X86API BE_init(u32 debugFlags, int memSize, BE_VGAInfo * info, int shared)
 	M.mem_size = memSize;
 
 	_BE_env.emulateVGA = 0;
-	_BE_env.busmem_base = (unsigned long)malloc(128 * 1024);
+	_BE_env.busmem_base = (unsigned long)allocateLargeHostMemory(BE_UPPER_MEM_SIZE);
 	if (_BE_env.busmem_base == 0){
 		printf("Biosemu:Out of memory!");
 		return 0;
@@ -110,7 +116,14 @@ int X86API BE_init(u32 debugFlags, int memSize, BE_VGAInfo * info, int shared)
 	_BE_bios_init((u32*)info->LowMem);
 	X86EMU_setupMemFuncs(&_BE_mem);
 	X86EMU_setupPioFuncs(&_BE_pio);
-	BE_setVGA(info);
+	if (!BE_setVGA(info)) {
+		BE_exit();
+		return 0;
+	}
+
+	/* Whatever the loader put in memory so far is the baseline */
+	BE_dirtyReset();
+	X86EMU_codeReset();
 	return 1;
 }
 
@@ -118,14 +131,23 @@ int X86API BE_init(u32 debugFlags, int memSize, BE_VGAInfo * info, int shared)
 PARAMETERS:
 info	    - Pointer to VGA device information to make current
 
+RETURNS:
+1 on success, 0 if the BIOS image does not fit between 0xC0000 and 1MB or
+the memory map can not be compiled.
+
 REMARKS:
 This function sets the VGA BIOS functions in the emulator to point to the
 specific VGA BIOS in use. This includes swapping the BIOS interrupt
 vectors, BIOS image and BIOS data area to the new BIOS. This allows the
 real mode BIOS to be swapped without resetting the entire emulator.
 ****************************************************************************/
-void X86API BE_setVGA(BE_VGAInfo * info)
+int X86API BE_setVGA(BE_VGAInfo * info)
 {
+	if (info->BIOSImage && info->BIOSImageLen > 0x40000) {
+		printf("BE_setVGA: BIOS image of %#lx bytes does not fit below 1MB\n",
+		       (ulong)info->BIOSImageLen);
+		return 0;
+	}
 
 #ifdef __KERNEL__
 	_BE_env.vgaInfo.function = info->function;
@@ -136,17 +158,20 @@ void X86API BE_setVGA(BE_VGAInfo * info)
 	_BE_env.vgaInfo.pciInfo = info->pciInfo;
 #endif
 	_BE_env.vgaInfo.BIOSImage = info->BIOSImage;
+	/* The BIOS image is copied into upper memory at 0xC0000, so the memory
+	 * map only ever deals with whole pages of one buffer */
+	_BE_env.biosmem_base = _BE_env.busmem_base + 0x20000;
 	if (info->BIOSImage) {
-		_BE_env.biosmem_base = (ulong) info->BIOSImage;
+		memcpy((u8 *) _BE_env.biosmem_base, info->BIOSImage, info->BIOSImageLen);
 		_BE_env.biosmem_limit = 0xC0000 + info->BIOSImageLen - 1;
 	} else {
-		_BE_env.biosmem_base = _BE_env.busmem_base + 0x20000;
 		_BE_env.biosmem_limit = 0xC7FFF;
 	}
 	if ((info->LowMem[0] == 0) && (info->LowMem[1] == 0) &&
 	    (info->LowMem[2] == 0) && (info->LowMem[3] == 0))
 		_BE_bios_init((u32 *) info->LowMem);
 	memcpy((u8 *) M.mem_base, info->LowMem, sizeof(info->LowMem));
+	return BE_memmapCompile();
 }
 
 /****************************************************************************
@@ -178,7 +203,8 @@ r_off	- Offset for pointer to convert
 
 REMARKS:
 This function maps a real mode pointer in the emulator memory to a protected
-mode pointer that can be used to directly access the memory.
+mode pointer that can be used to directly access the memory. Pages the
+memory map does not back with host memory (MMIO, unmapped) return NULL.
 
 NOTE:	The memory is *always* in little endian format, son on non-x86
 	systems you will need to do endian translations to access this
@@ -188,10 +214,9 @@ void *X86API BE_mapRealPointer(uint r_seg, uint r_off)
 {
 	u32 addr = ((u32) r_seg << 4) + r_off;
 
-	if (addr >= 0xC0000 && addr <= _BE_env.biosmem_limit) {
-		return (void *)(_BE_env.biosmem_base + addr - 0xC0000);
-	} else if (addr >= 0xA0000 && addr <= 0xFFFFF) {
-		return (void *)(_BE_env.busmem_base + addr - 0xA0000);
+	if (addr <= 0xFFFFF) {
+		u8 *host = _BE_memPages[addr >> BE_MEM_PAGE_SHIFT].read;
+		return host ? host + (addr & (BE_MEM_PAGE_SIZE - 1)) : NULL;
 	}
 	return (void *)(M.mem_base + addr);
 }
@@ -226,8 +251,10 @@ Cleans up and exits the emulator.
 ****************************************************************************/
 void X86API BE_exit(void)
 {
-	free(M.mem_base);
-	free((void *)_BE_env.busmem_base);
+	freeLargeHostMemory(M.mem_base, M.mem_size);
+	freeLargeHostMemory((void *)_BE_env.busmem_base, BE_UPPER_MEM_SIZE);
+	M.mem_base = NULL;
+	_BE_env.busmem_base = 0;
 }
 
 /****************************************************************************
@@ -262,11 +289,12 @@ void X86API BE_callRealMode(uint seg, uint off, RMREGS * regs, RMSREGS * sregs)
 	((u8 *) M.mem_base)[0x4003] = (u8) seg;
 	((u8 *) M.mem_base)[0x4004] = (u8) (seg >> 8);
 	((u8 *) M.mem_base)[0x4005] = 0xF1;	/* Illegal op-code */
+	BE_SHADOW_WRITE(0x4000, 6);
 	M.x86.R_CS = SEG(0x04000);
 	M.x86.R_IP = OFF(0x04000);
 
-	M.x86.R_SS = SEG(M.mem_size - 2);
-	M.x86.R_SP = OFF(M.mem_size - 2) + 2;
+	M.x86.R_SS = SEG(BE_STACK_TOP - 2);
+	M.x86.R_SP = OFF(BE_STACK_TOP - 2) + 2;
 
 	X86EMU_exec();
 
@@ -305,11 +333,12 @@ int X86API BE_int86(int intno, RMREGS * in, RMREGS * out)
 	((u8 *) M.mem_base)[0x4000] = 0xCD;
 	((u8 *) M.mem_base)[0x4001] = (u8) intno;
 	((u8 *) M.mem_base)[0x4002] = 0xF1;
+	BE_SHADOW_WRITE(0x4000, 3);
 	M.x86.R_CS = SEG(0x04000);
 	M.x86.R_IP = OFF(0x04000);
 
-	M.x86.R_SS = SEG(M.mem_size - 1);
-	M.x86.R_SP = OFF(M.mem_size - 1) - 1;
+	M.x86.R_SS = SEG(BE_STACK_TOP - 1);
+	M.x86.R_SP = OFF(BE_STACK_TOP - 1) - 1;
 
 	X86EMU_exec();
 	out->e.cflag = M.x86.R_EFLG & F_CF;
@@ -349,11 +378,12 @@ int X86API BE_int86x(int intno, RMREGS * in, RMREGS * out, RMSREGS * sregs)
 	((u8 *) M.mem_base)[0x4000] = 0xCD;
 	((u8 *) M.mem_base)[0x4001] = (u8) intno;
 	((u8 *) M.mem_base)[0x4002] = 0xF1;
+	BE_SHADOW_WRITE(0x4000, 3);
 	M.x86.R_CS = SEG(0x04000);
 	M.x86.R_IP = OFF(0x04000);
 
-	M.x86.R_SS = SEG(M.mem_size - 1);
-	M.x86.R_SP = OFF(M.mem_size - 1) - 1;
+	M.x86.R_SS = SEG(BE_STACK_TOP - 1);
+	M.x86.R_SP = OFF(BE_STACK_TOP - 1) - 1;
 
 	X86EMU_exec();
 	out->e.cflag = M.x86.R_EFLG & F_CF;
@@ -57,6 +57,19 @@
 extern X86EMU_sysEnv _X86EMU_env;
 #define M		_X86EMU_env
 
+/* Top of the real mode stack BE_callRealMode and BE_int86 set up: the end of
+ * conventional memory, never above the VGA window whatever M.mem_size is.
+ */
+#define BE_STACK_TOP	(M.mem_size < 0xA0000 ? M.mem_size : 0xA0000)
+
+/* Bits of the per page flags (see X86EMU_PAGE_FLAGS) the BE_rd and BE_wr
+ * functions act on next to X86EMU_PAGE_CODE. A page with none of them set
+ * takes the fast path.
+ */
+#define BE_PAGE_WATCH	0x02	/* a memory watchpoint covers part of the page */
+#define BE_PAGE_CLEAN	0x04	/* not written since the last dirty checkpoint */
+#define BE_PAGE_SHADOW	0x08	/* shadow memory tracks the page */
+
 /* Macros to read and write values to x86 emulator memory. Memory is always
  * considered to be little endian, so we use macros to do endian swapping
  * where necessary.
@@ -133,6 +146,19 @@ typedef struct {
 
 void _BE_bios_init(u32 * intrTab);
 void _BE_setup_funcs(void);
+void _BE_bios_fseg(u8 * fseg);
+
+/* pmm.c */
+
+void X86API _BE_pmmService(int intno);
+
+/* services.c */
+
+void X86API _BE_serviceDispatch(int intno);
+
+/* vbe.c */
+
+int _BE_vbeInt10(void);
 
 /* besys.c */
 #define DEBUG_IO()	(M.x86.debug & DEBUG_IO_TRACE_F)
@@ -0,0 +1,158 @@
+#include "include/dirty.h"
+#include "include/mmio.h"
+#include "biosemui.h"
+
+#include <string.h>
+#include <stdio.h>
+
+static u64 dirtyPages[BE_DIRTY_PAGES / 64];
+static u64 dirtySummary[BE_DIRTY_PAGES / 64 / 64];
+
+#define SUMMARY_WORDS (sizeof(dirtySummary) / sizeof(dirtySummary[0]))
+
+static void markPage(u32 page)
+{
+	dirtyPages[page >> 6] |= 1ull << (page & 63);
+	dirtySummary[page >> 12] |= 1ull << ((page >> 6) & 63);
+	_X86EMU_pageFlags[page] &= ~BE_PAGE_CLEAN;
+}
+
+// Called by the write paths for pages that still carry BE_PAGE_CLEAN
+void BE_dirtyMark(u32 addr, int size)
+{
+	markPage(addr >> BE_DIRTY_PAGE_SHIFT);
+	markPage((addr + size - 1) >> BE_DIRTY_PAGE_SHIFT);
+}
+
+// Forgets every write and flags all pages clean. Only pages marked dirty ever lose
+// BE_PAGE_CLEAN, so after the first call this is a checkpoint
+void BE_dirtyReset(void)
+{
+	static int flagged = 0;
+
+	BE_dirtyCheckpoint();
+	if (flagged)
+		return;
+	for (u32 page = 0; page < BE_DIRTY_PAGES; ++page)
+		_X86EMU_pageFlags[page] |= BE_PAGE_CLEAN;
+	flagged = 1;
+}
+
+void BE_dirtyCheckpoint(void)
+{
+	// Only the bitmap words flagged in the summary can be non zero, and only
+	// their pages lost BE_PAGE_CLEAN
+	for (u32 s = 0; s < SUMMARY_WORDS; ++s)
+	{
+		u64 bits = dirtySummary[s];
+		while (bits != 0)
+		{
+			int bit = __builtin_ctzll(bits);
+			bits &= bits - 1;
+			u32 word = s * 64 + bit;
+			for (u64 pages = dirtyPages[word]; pages != 0; pages &= pages - 1)
+				_X86EMU_pageFlags[word * 64 + __builtin_ctzll(pages)] |= BE_PAGE_CLEAN;
+			dirtyPages[word] = 0;
+		}
+		dirtySummary[s] = 0;
+	}
+}
+
+int BE_dirtyTest(u32 addr)
+{
+	u32 page = addr >> BE_DIRTY_PAGE_SHIFT;
+	return (dirtyPages[page >> 6] >> (page & 63)) & 1;
+}
+
+u32 BE_dirtyCount(void)
+{
+	u32 count = 0;
+	for (u32 s = 0; s < SUMMARY_WORDS; ++s)
+	{
+		u64 bits = dirtySummary[s];
+		while (bits != 0)
+		{
+			int bit = __builtin_ctzll(bits);
+			bits &= bits - 1;
+			count += __builtin_popcountll(dirtyPages[s * 64 + bit]);
+		}
+	}
+	return count;
+}
+
+// Finds the first dirty page at or after page, returns 0 when there is none
+int BE_dirtyNext(u32 page, u32* dirtyPage)
+{
+	if (page >= BE_DIRTY_PAGES)
+		return 0;
+
+	u32 word = page >> 6;
+	u64 bits = dirtyPages[word] & (~0ull << (page & 63));
+	if (bits != 0)
+	{
+		*dirtyPage = word * 64 + __builtin_ctzll(bits);
+		return 1;
+	}
+
+	// Skip to the next non-empty bitmap word through the summary
+	++word;
+	for (u32 s = word >> 6; s < SUMMARY_WORDS; ++s)
+	{
+		u64 summary = dirtySummary[s];
+		if (s == word >> 6)
+			summary &= ~0ull << (word & 63);
+
+		while (summary != 0)
+		{
+			u32 w = s * 64 + __builtin_ctzll(summary);
+			summary &= summary - 1;
+			if (dirtyPages[w] != 0)
+			{
+				*dirtyPage = w * 64 + __builtin_ctzll(dirtyPages[w]);
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+static const char* regionName(u32 addr)
+{
+	if (addr >= 0xA0000 && addr <= 0xBFFFF)
+		return "VGA";
+	if (addr >= 0xC0000 && addr <= _BE_env.biosmem_limit)
+		return "BIOS";
+	if (addr < M.mem_size)
+		return "RAM";
+	if (BE_mmioFind(addr) != NULL)
+		return "MMIO";
+	return "unmapped";
+}
+
+// Finds the first run of dirty pages at or after page, returns 0 when there is none
+int BE_dirtyNextRange(u32 page, u32* firstPage, u32* lastPage)
+{
+	if (!BE_dirtyNext(page, firstPage))
+		return 0;
+
+	u32 last = *firstPage;
+	while (last + 1 < BE_DIRTY_PAGES && BE_dirtyTest((last + 1) << BE_DIRTY_PAGE_SHIFT))
+		++last;
+	*lastPage = last;
+	return 1;
+}
+
+// Prints the pages written since the last checkpoint as ranges
+void BE_dirtyReport(void)
+{
+	u32 first;
+	u32 last;
+
+	printf("Pages written since checkpoint: %u\n", BE_dirtyCount());
+	for (u32 page = 0; BE_dirtyNextRange(page, &first, &last); page = last + 1)
+	{
+		u32 start = first << BE_DIRTY_PAGE_SHIFT;
+		printf("  %08x-%08x %s\n", start, (last << BE_DIRTY_PAGE_SHIFT) | ((1 << BE_DIRTY_PAGE_SHIFT) - 1),
+			   regionName(start));
+	}
+}
@@ -283,7 +283,7 @@ extern "C" {			/* Use "C" linkage when in C++ mode */
 /* BIOS emulator library entry points */
 	int X86API BE_init(u32 debugFlags, int memSize, BE_VGAInfo * info,
 			   int shared);
-	void X86API BE_setVGA(BE_VGAInfo * info);
+	int X86API BE_setVGA(BE_VGAInfo * info);
 	void X86API BE_getVGA(BE_VGAInfo * info);
 	void X86API BE_setDebugFlags(u32 debugFlags);
 	void *X86API BE_mapRealPointer(uint r_seg, uint r_off);
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "x86emu/types.h"
+
+/* Dirty page tracking for guest memory.
+ *
+ * One bit per 4KB guest-physical page, set by the BE_wr* paths once a write
+ * has been stored; writes dropped for ROM or unmapped memory leave no mark. Because the
+ * guest address decides which host buffer is hit (low memory, VGA window,
+ * BIOS shadow, BAR backings), a single bitmap covers all of them. A second
+ * level summary bit per 64 pages keeps checkpoints and iteration
+ * proportional to what was actually written. Pages not yet written since the
+ * last checkpoint carry BE_PAGE_CLEAN in the page flags, so only the first
+ * write to a page leaves the write fast path.
+ */
+
+#define BE_DIRTY_PAGE_SHIFT 12
+#define BE_DIRTY_PAGES (1u << (32 - BE_DIRTY_PAGE_SHIFT))
+
+void BE_dirtyMark(u32 addr, int size);
+void BE_dirtyReset(void);
+void BE_dirtyCheckpoint(void);
+int BE_dirtyTest(u32 addr);
+u32 BE_dirtyCount(void);
+int BE_dirtyNext(u32 page, u32* dirtyPage);
+int BE_dirtyNextRange(u32 page, u32* firstPage, u32* lastPage);
+void BE_dirtyReport(void);
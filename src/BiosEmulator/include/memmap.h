@@ -0,0 +1,59 @@
+#pragma once
+
+#include "x86emu/types.h"
+
+/* Layout of the real mode megabyte.
+ *
+ * The map is a list of regions (RAM, ROM, MMIO or unmapped) compiled into a
+ * table with one entry per 4KB page, so the access path resolves an address
+ * below 1MB with a single table load. Regions declared with BE_memmapAdd are
+ * laid over the default PC layout:
+ *
+ *   00000-9FFFF  RAM from guest memory, as far as M.mem_size reaches
+ *   A0000-BFFFF  VGA bus memory
+ *   C0000-       VGA BIOS image (BE_setVGA), rest of the C segment unmapped
+ *   D0000-EFFFF  RAM from guest memory, as far as M.mem_size reaches
+ *   F0000-FFFFF  System BIOS ROM holding the BIOS date and model bytes
+ *
+ * Everything from A0000 up lives in one upper memory buffer at busmem_base.
+ */
+
+#define BE_MEM_PAGE_SHIFT 12
+#define BE_MEM_PAGE_SIZE (1 << BE_MEM_PAGE_SHIFT)
+#define BE_MEM_PAGES (0x100000 >> BE_MEM_PAGE_SHIFT)
+#define BE_MEM_MAX_REGIONS 32
+
+#define BE_UPPER_MEM_BASE 0xA0000
+#define BE_UPPER_MEM_SIZE 0x60000
+
+typedef enum
+{
+	BE_MEM_UNMAPPED = 0,		// reads return all ones, writes are dropped
+	BE_MEM_RAM,
+	BE_MEM_ROM,					// writes are dropped
+	BE_MEM_MMIO,				// serviced by the MMIO region registry
+} BE_memType;
+
+typedef struct BE_memRegion
+{
+	u32 start;
+	u32 size;
+	BE_memType type;
+	u8* backing;				// NULL: guest RAM or upper memory at the same address
+} BE_memRegion;
+
+typedef struct BE_memPage
+{
+	u8* read;					// host address of the page, NULL takes the slow path
+	u8* write;
+	BE_memType type;
+} BE_memPage;
+
+extern BE_memPage _BE_memPages[BE_MEM_PAGES];
+
+int BE_memmapCheck(u32 start, u32 size);
+int BE_memmapAdd(u32 start, u32 size, BE_memType type, u8* backing);
+void BE_memmapClear(void);
+int BE_memmapCompile(void);
+const char* BE_memTypeName(BE_memType type);
+int BE_memTypeFromName(const char* name, BE_memType* type);
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "x86emu/types.h"
+
+/* Guest-physical address space above the real mode megabyte.
+ *
+ * Regions (BAR apertures, the expansion rom and friends) map a range of
+ * guest addresses either onto a host buffer or onto read/write callbacks.
+ * Guest addresses are handed out by a guest-side allocator and have no
+ * relation to where the host buffer lives, so backing memory can come from
+ * anywhere in the host address space. Lookups go through a two-level page
+ * table of 4KB pages, so resolving an address costs two array loads plus a
+ * bounds check.
+ */
+
+#define BE_MMIO_MAX_REGIONS 64
+
+/* Window the guest allocator places apertures in, below the usual IOAPIC/LAPIC area */
+#define BE_GUEST_MMIO_BASE 0xC0000000
+#define BE_GUEST_MMIO_LIMIT 0xFEC00000
+
+typedef u32 (*BE_mmioReadFunc)(void* context, u32 offset, int size);
+typedef void (*BE_mmioWriteFunc)(void* context, u32 offset, u32 value, int size);
+
+typedef struct BE_mmioRegion
+{
+	u32 base;
+	u32 size;
+	u8* backing;				// used when no callback is given for the access direction
+	BE_mmioReadFunc read;
+	BE_mmioWriteFunc write;
+	void* context;
+	int inUse;
+} BE_mmioRegion;
+
+// Told when BE_mmioMove moves a region (region->base is the new base) or BE_mmioUnregister
+// drops one (region->inUse is 0)
+typedef void (*BE_mmioMoveFunc)(const BE_mmioRegion* region, u32 oldBase);
+
+int BE_mmioRegister(u32 base, u32 size, void* backing, BE_mmioReadFunc read, BE_mmioWriteFunc write, void* context);
+void BE_mmioUnregister(int handle);
+int BE_mmioMove(int handle, u32 newBase);
+void BE_mmioReset(void);
+void BE_mmioSetMoveHandler(BE_mmioMoveFunc handler);
+
+u32 BE_mmioAllocGuest(u32 size);
+
+BE_mmioRegion* BE_mmioGet(int handle);
+BE_mmioRegion* BE_mmioFind(u32 addr);
+u32 BE_mmioRead(u32 addr, int size);
+int BE_mmioWrite(u32 addr, u32 value, int size);
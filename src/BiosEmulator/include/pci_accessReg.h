@@ -8,12 +8,36 @@
 #define PCI_WRITE_WORD              4
 #define PCI_WRITE_DWORD             5
 
+/* Size of the PCIe extended configuration space of a function */
+
+#define PCI_CONFIG_SIZE             4096
+
+/* Memory mapped (ECAM) configuration window, 1MB per bus */
+
+#define PCI_ECAM_BASE               0xB0000000
+#define PCI_ECAM_SIZE               0x10000000
+
+/* Functions the JSON config can describe, the analyzed device included */
+
+#define PCI_MAX_DEVICES             64
+
 /* Function to access PCI configuration registers */
 
 #include "x86emu/types.h"
 #include "pciinfo.h"
 
 struct cJSON;
+struct PciDump;
 
-unsigned char* buildConfigFromJsonAndRom(const struct cJSON* json, uintptr_t rom);
+int buildProfileFromJson(const struct cJSON* json, struct PciDump* profile);
+unsigned char* buildConfigFromJsonAndRom(const struct cJSON* json, const void* rom, uint32_t romSize);
 ulong PCI_accessReg(int index, ulong value, int func, PCIDeviceInfo *info);
+
+/* Enumeration of the emulated topology for the PCI BIOS */
+
+PCIslot PCI_primarySlot(void);
+int PCI_maxBus(void);
+int PCI_findDevice(u16 vendorID, u16 deviceID, int index, PCIslot* slot);
+int PCI_findClass(u32 classCode, int index, PCIslot* slot);
+int PCI_enumerate(int index, PCIslot* slot);
+const unsigned char* PCI_deviceConfig(int index, const unsigned char** writable);
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "x86emu/types.h"
+
+/* PCI capability lists.
+ *
+ * Capabilities are declared symbolically in the device description and laid
+ * out as a linked list from 0x40 (pointed to by 0x34) and, for PCIe extended
+ * capabilities, from 0x100. Lists that come from a captured config space are
+ * walked the same way to give their registers the right write masks.
+ */
+
+#define PCI_CAPABILITY_POINTER 0x34
+#define PCI_CAPABILITY_START 0x40
+#define PCI_EXT_CAPABILITY_START 0x100
+
+#define PCI_CAP_ID_PM 0x01
+#define PCI_CAP_ID_VPD 0x03
+#define PCI_CAP_ID_MSI 0x05
+#define PCI_CAP_ID_VENDOR 0x09
+#define PCI_CAP_ID_PCIE 0x10
+#define PCI_CAP_ID_MSIX 0x11
+
+#define PCI_EXT_CAP_ID_AER 0x0001
+#define PCI_EXT_CAP_ID_DSN 0x0003
+#define PCI_EXT_CAP_ID_VENDOR 0x000b
+#define PCI_EXT_CAP_ID_REBAR 0x0015
+#define PCI_EXT_CAP_ID_LTR 0x0018
+
+struct cJSON;
+
+/* Lays out the capabilities of a "capabilities" json array in a 4KB config space */
+int PCI_buildCapabilities(const struct cJSON* list, u8* config);
+
+/* Offset of a capability, 0 when the list does not have it */
+int PCI_findCapability(const u8* config, int id);
+int PCI_findExtCapability(const u8* config, int id);
+
+/* Makes capability headers and the read-only registers of known capabilities read-only */
+void PCI_capabilityMasks(const u8* config, u8* writable, u8* clearOnWrite);
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "x86emu/types.h"
+
+/* POST Memory Manager.
+ *
+ * Option ROMs find the "$PMM" structure in the F segment and far call its
+ * entry point to allocate buffers. The entry point traps to this host-side
+ * allocator, which hands out guest memory from two arenas: conventional
+ * RAM from 0x5000, above the BIOS data area and the far call trampoline at
+ * 0x4000, up to 8KB below BE_STACK_TOP (where the emulator keeps its
+ * stack), and the guest memory above 1MB. Allocations are kept in a short
+ * list sorted by address and placed first fit.
+ */
+
+#define BE_PMM_MAX_BLOCKS 64
+
+typedef struct BE_pmmBlock
+{
+	u32 address;
+	u32 size;
+	u32 handle;
+} BE_pmmBlock;
+
+/* Allocation flags */
+#define BE_PMM_CONVENTIONAL 0x1
+#define BE_PMM_EXTENDED 0x2
+#define BE_PMM_ALIGN 0x4			// align on the size rounded up to a power of two
+
+/* Handle of allocations that cannot be found again */
+#define BE_PMM_ANONYMOUS 0xFFFFFFFF
+
+/* Returns the linear address of the block, 0 when it does not fit. With a
+ * size of 0, returns the size of the largest free block in paragraphs. */
+u32 BE_pmmAllocate(u32 paragraphs, u32 handle, u16 flags);
+u32 BE_pmmFind(u32 handle);
+
+/* Returns 0 when address was the start of an allocated block */
+u32 BE_pmmDeallocate(u32 address);
+
+/* Frees every block and recomputes the arenas from the memory map on next use */
+void BE_pmmReset(void);
+
+/* The blocks still allocated in address order, NULL past the last one */
+const BE_pmmBlock* BE_pmmGetBlock(int index);
+u32 BE_pmmAllocated(void);
+u32 BE_pmmPeak(void);
+
+/* Prints the blocks still allocated and the peak usage */
+void BE_pmmReport(void);
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "x86emu.h"
+
+/* Registry of host-implemented interrupt services.
+ *
+ * Every vector goes through one dispatcher that looks the call up by
+ * (vector, AX): an entry matches when (AX & mask) == value, and the most
+ * specific mask wins, so an AX entry overrides an AH entry which overrides
+ * a catch-all. Services only run while the vector still points at the
+ * emulated system BIOS, unless registered with BE_SERVICE_ALWAYS; once a
+ * ROM hooks a vector its own handler runs instead.
+ *
+ * Each entry counts its calls and the host time spent in it.
+ */
+
+#define BE_SERVICE_MAX 64
+
+/* Masks applied to AX */
+#define BE_MATCH_ANY 0x0000
+#define BE_MATCH_AH 0xFF00
+#define BE_MATCH_AX 0xFFFF
+
+/* Flags */
+#define BE_SERVICE_ALWAYS 0x1		// runs even when a ROM has hooked the vector
+
+typedef struct BE_service
+{
+	int intno;
+	u16 mask;
+	u16 value;
+	int flags;
+	X86EMU_intrFuncs func;
+	const char* name;
+	u64 calls;
+	u64 nanoseconds;
+	struct BE_service* next;		// next entry of the same vector, less specific masks last
+	int inUse;
+} BE_service;
+
+/* Registers func for the calls to intno with (AX & mask) == value and
+ * returns a handle. An entry with the same key is replaced. */
+int BE_serviceRegister(int intno, u16 mask, u16 value, int flags, X86EMU_intrFuncs func, const char* name);
+void BE_serviceRemove(int handle);
+const BE_service* BE_serviceGet(int handle);
+
+/* Calls to vectors still at the system BIOS that no service matched */
+u64 BE_serviceUnhandled(int intno);
+
+void BE_serviceResetStats(void);
+
+/* Prints the services that were called, most expensive first */
+void BE_serviceReport(void);
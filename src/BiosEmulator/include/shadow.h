@@ -0,0 +1,43 @@
+#pragma once
+
+#include "x86emu/types.h"
+
+/* Shadow memory for finding reads of uninitialized guest memory.
+ *
+ * One bit per guest byte of RAM and BAR memory, set once the guest or the
+ * loader has written the byte. The bitmap is only allocated when tracking is
+ * enabled, in 64KB chunks of guest address space; addresses without a chunk
+ * are not tracked. Tracked pages carry BE_PAGE_SHADOW in the page flags,
+ * which is all the BE_rd and BE_wr functions test. Reads that touch a clear
+ * bit are aggregated per CS:IP.
+ */
+
+#define BE_SHADOW_CHUNK_SHIFT 16
+#define BE_SHADOW_CHUNKS (1u << (32 - BE_SHADOW_CHUNK_SHIFT))
+#define BE_SHADOW_SITE_BITS 10
+#define BE_SHADOW_MAX_SITES (1 << BE_SHADOW_SITE_BITS)
+
+extern int _BE_shadowEnabled;
+
+// For stores the loader makes behind the emulator's back
+#define BE_SHADOW_WRITE(addr, size) \
+	do { if (_BE_shadowEnabled) BE_shadowMarkRange(addr, size); } while (0)
+
+typedef struct BE_shadowSite
+{
+	u16 cs;
+	u16 ip;
+	u32 firstAddr;			// first uninitialized byte read from this site
+	u32 count;
+	int inUse;
+} BE_shadowSite;
+
+int BE_shadowEnable(void);
+void BE_shadowDisable(void);
+int BE_shadowTrack(u32 base, u32 size);
+void BE_shadowMarkRange(u32 addr, u32 size);
+int BE_shadowFindUninit(u32 addr, u32 size, u32* first);
+void BE_shadowRead(u32 addr, int size);
+const BE_shadowSite* BE_shadowGetSite(int index);
+u32 BE_shadowDroppedReads(void);
+void BE_shadowReport(void);
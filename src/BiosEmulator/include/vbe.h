@@ -0,0 +1,49 @@
+#pragma once
+
+#include "biosemu.h"
+
+/* High-level VBE (int 10h AX=4Fxx) services.
+ *
+ * Queries are answered either by the video ROM (emulated), by a host-side
+ * provider (fast) or by both with the results compared (checked). The host
+ * provider answers from the ROM's own info and mode blocks once they have
+ * been harvested with BE_vbeHarvest, and from a table of standard VESA
+ * modes before that or when the ROM has no VBE support.
+ */
+
+typedef enum
+{
+	BE_VBE_ROM = 0,		// int 10h always runs the ROM
+	BE_VBE_FAST,		// 4F00-4F15 are answered on the host
+	BE_VBE_CHECKED,		// int 10h and BE_vbeCall run both and report differences
+} BE_vbePath;
+
+/* VBE status returned in AX */
+#define BE_VBE_SUCCESS 0x004F
+#define BE_VBE_FAILED 0x014F
+#define BE_VBE_NOT_SUPPORTED 0x024F
+#define BE_VBE_INVALID_IN_MODE 0x034F
+
+#define BE_VBE_MAX_MODES 64
+#define BE_VBE_INFO_SIZE 512
+#define BE_VBE_MODE_INFO_SIZE 256
+#define BE_VBE_EDID_SIZE 128
+
+void BE_vbeSetPath(BE_vbePath path);
+BE_vbePath BE_vbeGetPath(void);
+int BE_vbeParsePath(const char* name, BE_vbePath* path);
+
+/* Video memory reported by the host fallback and the linear framebuffer address */
+void BE_vbeSetMemory(u32 totalMemory, u32 framebufferBase);
+
+/* Drops harvested ROM data and resets mode, windows and palette */
+void BE_vbeReset(void);
+
+/* Asks the ROM for its info block, mode blocks and EDID, returns the number of modes cached */
+int BE_vbeHarvest(void);
+
+/* Issues a VBE call through the selected path, returns AX */
+int BE_vbeCall(RMREGS* regs, RMSREGS* sregs);
+
+/* Differences found by checked calls so far */
+u32 BE_vbeMismatches(void);
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "x86emu/types.h"
+
+/* Conditional memory and I/O watchpoints.
+ *
+ * Every watched 4KB page carries BE_PAGE_WATCH in the page flags and every
+ * watched port has a bit set in a bitmap, so the access paths in besys.c
+ * only pay one test on a miss. A hit walks the (short) watchpoint list and
+ * evaluates each predicate.
+ *
+ * Byte 0 of mask and compareValue is the byte at start, whatever the address
+ * and size of the access. A value predicate only compares the bytes covered by
+ * both the access and the first 4 bytes of the range, and does not match an
+ * access that covers none of the masked ones.
+ */
+
+#define BE_WATCH_MAX 32
+
+/* Address spaces */
+#define BE_WATCH_MEM 0
+#define BE_WATCH_IO 1
+
+/* Access types, may be combined */
+#define BE_WATCH_READ 0x1
+#define BE_WATCH_WRITE 0x2
+
+/* Actions taken when a watchpoint fires, may be combined */
+#define BE_WATCH_LOG 0x1
+#define BE_WATCH_SNAPSHOT 0x2
+#define BE_WATCH_HALT 0x4
+
+typedef enum
+{
+	BE_WATCH_ANY = 0,		// every access in range matches
+	BE_WATCH_EQ,			// (value & mask) == compareValue
+	BE_WATCH_NE,			// (value & mask) != compareValue
+	BE_WATCH_ALL_SET,		// all bits in mask are set
+	BE_WATCH_ANY_SET,		// at least one bit in mask is set
+} BE_watchCompare;
+
+typedef struct BE_watchpoint
+{
+	int space;
+	int access;
+	u32 start;
+	u32 end;				// inclusive
+	BE_watchCompare compare;
+	u32 mask;
+	u32 compareValue;
+	u32 count;				// fire on the count-th matching access, 0 fires on every match
+	int actions;
+	u32 hits;				// matching accesses seen so far
+	int inUse;
+} BE_watchpoint;
+
+typedef void (*BE_watchSnapshotFunc)(int handle, const BE_watchpoint* watchpoint, u32 addr, u32 value);
+
+extern u8 _BE_watchPorts[];
+
+#define BE_WATCH_PORT_HIT(port)		(_BE_watchPorts[(u16)(port) >> 3] & (1 << ((port) & 7)))
+
+int BE_watchAdd(const BE_watchpoint* watchpoint);
+void BE_watchRemove(int handle);
+void BE_watchReset(void);
+const BE_watchpoint* BE_watchGet(int handle);
+void BE_watchSetSnapshotHandler(BE_watchSnapshotFunc handler);
+
+void BE_watchCheck(int space, int access, u32 addr, int size, u32 value);
@@ -151,6 +151,29 @@ extern void X86API wrl(u32 addr, u32 val);
 typedef void (X86APIP X86EMU_intrFuncs) (int num);
 extern X86EMU_intrFuncs _X86EMU_intrTab[256];
 
+/* Per page flags for the memory functions, one byte for every 4KB page of the
+ * 32 bit address space. The memory functions load the byte of the page (or
+ * both pages) an access touches once and only leave their fast path when it
+ * is non zero. X86EMU_PAGE_CODE belongs to the emulator, the other bits are
+ * free for the memory functions.
+ *
+ * Self modifying code detection: instruction fetch sets X86EMU_PAGE_CODE on
+ * the pages code runs from, and the memory write functions report stores to
+ * such a page with X86EMU_codeWritten. That clears the flag and drops the
+ * cached fetch window, the only state derived from the code. Real mode code
+ * can only live below 0x10FFF0.
+ */
+#define X86EMU_PAGE_SHIFT	12
+#define X86EMU_CODE_PAGES	0x110
+
+#define X86EMU_PAGE_CODE	0x01
+
+extern u8 _X86EMU_pageFlags[];
+
+#define X86EMU_PAGE_FLAGS(addr, size) \
+	(_X86EMU_pageFlags[(u32)(addr) >> X86EMU_PAGE_SHIFT] | \
+	 _X86EMU_pageFlags[(u32)((addr) + (size) - 1) >> X86EMU_PAGE_SHIFT])
+
 /*-------------------------- Function Prototypes --------------------------*/
 
 #ifdef  __cplusplus
@@ -163,10 +186,16 @@ extern "C" {			/* Use "C" linkage when in C++ mode */
 	void X86EMU_setupIntrFunc(int intnum, X86EMU_intrFuncs func);
 	void X86EMU_prepareForInt(int num);
 
+	void X86EMU_codeWritten(u32 addr, int size);
+	void X86EMU_codeReset(void);
+
 /* decode.c */
 
 	void X86EMU_exec(void);
 	void X86EMU_halt_sys(void);
+	void X86EMU_setInstructionBudget(u64 budget);
+	u64 X86EMU_instructionCount(void);
+	int X86EMU_budgetExhausted(void);
 
 #ifdef CONFIG_X86EMU_DEBUG
 #define HALT_SYS()  \
@@ -120,19 +120,17 @@
     if (DEBUG_DECODE())				    \
 	x86emu_inc_decoded_inst_len(x)
 
-#define SAVE_IP_CS(x,y)						\
-    if (DEBUG_DECODE() | DEBUG_TRACECALL() | DEBUG_BREAK() \
-	      | DEBUG_IO_TRACE() | DEBUG_SAVE_IP_CS()) { \
-	M.x86.saved_cs = x;					\
-	M.x86.saved_ip = y;					\
-    }
 #else
 # define INC_DECODED_INST_LEN(x)
 # define DECODE_PRINTF(x)
 # define DECODE_PRINTF2(x,y)
-# define SAVE_IP_CS(x,y)
 #endif
 
+/* CS:IP of the current instruction is always kept, memory analyses such as
+ * the uninitialized read tracking report the code location from it. */
+#define SAVE_IP_CS(x,y)						\
+    (M.x86.saved_cs = (x), M.x86.saved_ip = (y))
+
 #ifdef CONFIG_X86EMU_DEBUG
 #define TRACE_REGS()					    \
     if (DEBUG_DISASSEMBLE()) {				    \
@@ -282,10 +282,10 @@ typedef struct {
 	u8 intno;
 	volatile int intr;	/* mask of pending interrupts */
 	int debug;
+	u16 saved_ip;		/* start of the current instruction */
+	u16 saved_cs;
 #ifdef CONFIG_X86EMU_DEBUG
 	int check;
-	u16 saved_ip;
-	u16 saved_cs;
 	int enc_pos;
 	int enc_str_pos;
 	char decode_buf[32];	/* encoded byte stream	*/
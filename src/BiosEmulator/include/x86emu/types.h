@@ -40,6 +40,7 @@
 #define __X86EMU_TYPES_H
 
 #include <sys/types.h>
+#include <stdint.h>
 
 typedef int pci_dev_t;
 
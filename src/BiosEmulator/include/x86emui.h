@@ -92,6 +92,9 @@ extern "C" {			/* Use "C" linkage when in C++ mode */
 	extern void (X86APIP sys_outw) (X86EMU_pioAddr addr, u16 val);
 	extern void (X86APIP sys_outl) (X86EMU_pioAddr addr, u32 val);
 
+	extern u32 _X86EMU_codeFetchPage;
+	void x86emu_mark_code(u32 pc);
+
 #ifdef  __cplusplus
 }				/* End of "C" linkage for C++       */
 #endif
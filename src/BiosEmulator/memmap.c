@@ -0,0 +1,152 @@
+#include "include/memmap.h"
+#include "biosemui.h"
+
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+
+BE_memPage _BE_memPages[BE_MEM_PAGES];
+
+static BE_memRegion regions[BE_MEM_MAX_REGIONS];
+static int regionCount = 0;
+
+#ifndef CONFIG_X86EMU_RAW_IO
+static const char* BE_biosDate = "08/14/99";
+#define BE_MODEL 0xFC
+#define BE_SUBMODEL 0x00
+#endif
+
+// Host address for guest memory at addr when a region brings no backing of its own
+static u8* defaultBacking(u32 addr, u32 size)
+{
+	if (addr >= BE_UPPER_MEM_BASE && addr + size <= BE_UPPER_MEM_BASE + BE_UPPER_MEM_SIZE)
+		return (u8*)_BE_env.busmem_base + (addr - BE_UPPER_MEM_BASE);
+	if (addr + size <= M.mem_size && (addr + size <= BE_UPPER_MEM_BASE || addr >= 0x100000))
+		return M.mem_base + addr;
+	return NULL;
+}
+
+static void mapPages(u32 start, u32 size, BE_memType type, u8* backing)
+{
+	for (u32 page = start >> BE_MEM_PAGE_SHIFT; page < (start + size) >> BE_MEM_PAGE_SHIFT; ++page)
+	{
+		u8* host = backing ? backing + ((page << BE_MEM_PAGE_SHIFT) - start) : NULL;
+		_BE_memPages[page].type = type;
+		_BE_memPages[page].read = (type == BE_MEM_RAM || type == BE_MEM_ROM) ? host : NULL;
+		_BE_memPages[page].write = type == BE_MEM_RAM ? host : NULL;
+	}
+}
+
+// Maps [start, end) as RAM from guest memory where M.mem_size reaches, unmapped beyond
+static void mapGuestRam(u32 start, u32 end)
+{
+	u32 ramEnd = M.mem_size & ~(BE_MEM_PAGE_SIZE - 1);
+	if (ramEnd > end)
+		ramEnd = end;
+	if (ramEnd > start)
+		mapPages(start, ramEnd - start, BE_MEM_RAM, M.mem_base + start);
+}
+
+static void mapDefault(void)
+{
+	u8* upper = (u8*)_BE_env.busmem_base;
+	u32 biosEnd = (_BE_env.biosmem_limit + BE_MEM_PAGE_SIZE) & ~(BE_MEM_PAGE_SIZE - 1);
+
+	memset(_BE_memPages, 0, sizeof(_BE_memPages));
+	mapGuestRam(0, 0xA0000);
+	mapPages(0xA0000, 0x20000, BE_MEM_RAM, upper);
+	mapPages(0xC0000, biosEnd - 0xC0000, BE_MEM_RAM, (u8*)_BE_env.biosmem_base);
+#ifdef CONFIG_X86EMU_RAW_IO
+	// The real system BIOS is mapped into upper memory on real PCs
+	mapPages(0xD0000, 0x30000, BE_MEM_RAM, upper + (0xD0000 - BE_UPPER_MEM_BASE));
+#else
+	mapGuestRam(0xD0000, 0xF0000);
+
+	// A stand-in system BIOS: date and model bytes plus the service structures from bios.c
+	u8* fseg = upper + (0xF0000 - BE_UPPER_MEM_BASE);
+	memcpy(fseg + 0xFFF5, BE_biosDate, 8);
+	fseg[0xFFFE] = BE_MODEL;
+	fseg[0xFFFF] = BE_SUBMODEL;
+	_BE_bios_fseg(fseg);
+	mapPages(0xF0000, 0x10000, BE_MEM_ROM, fseg);
+#endif
+}
+
+// Declares a region laid over the default layout. Later regions win where they overlap.
+// Regions must be page aligned and end at or below 1MB
+int BE_memmapCheck(u32 start, u32 size)
+{
+	if (size == 0 || ((start | size) & (BE_MEM_PAGE_SIZE - 1)) != 0 || start > 0x100000 || size > 0x100000 - start)
+	{
+		printf("BE_memmap: region %#x size %#x must be page aligned and below 1MB\n", start, size);
+		return 0;
+	}
+	return 1;
+}
+
+int BE_memmapAdd(u32 start, u32 size, BE_memType type, u8* backing)
+{
+	if (!BE_memmapCheck(start, size))
+		return 0;
+	if (regionCount == BE_MEM_MAX_REGIONS)
+	{
+		printf("BE_memmapAdd: too many regions\n");
+		return 0;
+	}
+
+	BE_memRegion* region = &regions[regionCount++];
+	region->start = start;
+	region->size = size;
+	region->type = type;
+	region->backing = backing;
+	return 1;
+}
+
+void BE_memmapClear(void)
+{
+	regionCount = 0;
+}
+
+// Rebuilds the page table from the default layout and the declared regions
+int BE_memmapCompile(void)
+{
+	mapDefault();
+
+	for (int i = 0; i < regionCount; ++i)
+	{
+		BE_memRegion* region = &regions[i];
+		u8* backing = region->backing;
+		if (backing == NULL && (region->type == BE_MEM_RAM || region->type == BE_MEM_ROM))
+		{
+			backing = defaultBacking(region->start, region->size);
+			if (backing == NULL)
+			{
+				printf("BE_memmapCompile: no memory behind %s region %#x-%#x\n", BE_memTypeName(region->type),
+					   region->start, region->start + region->size - 1);
+				return 0;
+			}
+		}
+		mapPages(region->start, region->size, region->type, backing);
+	}
+	return 1;
+}
+
+static const char* typeNames[] = { "unmapped", "ram", "rom", "mmio" };
+
+const char* BE_memTypeName(BE_memType type)
+{
+	return (unsigned)type < sizeof(typeNames) / sizeof(typeNames[0]) ? typeNames[type] : "?";
+}
+
+int BE_memTypeFromName(const char* name, BE_memType* type)
+{
+	for (unsigned int i = 0; i < sizeof(typeNames) / sizeof(typeNames[0]); ++i)
+	{
+		if (strcasecmp(name, typeNames[i]) == 0)
+		{
+			*type = (BE_memType)i;
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,355 @@
+#include "include/mmio.h"
+#include "biosemui.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// The 32 bit guest physical address space is split into 1024 directory
+// entries of 4MB, each pointing to a leaf of 1024 4KB page slots. A slot
+// holds the region index + 1, 0 when nothing is mapped, or MMIO_PAGE_SHARED
+// when more than one region touches the page (regions smaller than 4KB).
+#define MMIO_PAGE_SHIFT 12
+#define MMIO_DIR_SHIFT 22
+#define MMIO_LEAF_ENTRIES 1024
+#define MMIO_PAGE_SHARED 0xff
+
+static BE_mmioRegion regions[BE_MMIO_MAX_REGIONS];
+static u8* mmioDirectory[1 << (32 - MMIO_DIR_SHIFT)];
+
+// Last region hit, BIOS code tends to hammer the same aperture
+static BE_mmioRegion* lastRegion;
+
+// Next free guest address for BE_mmioAllocGuest
+static u32 nextGuestAddress = BE_GUEST_MMIO_BASE;
+
+static BE_mmioMoveFunc moveHandler;
+
+static int regionContains(const BE_mmioRegion* region, u32 addr)
+{
+	return region->inUse && (addr - region->base) < region->size;
+}
+
+static u8* getLeaf(u32 page, int create)
+{
+	u32 dir = page >> (MMIO_DIR_SHIFT - MMIO_PAGE_SHIFT);
+	if (mmioDirectory[dir] == NULL && create)
+		mmioDirectory[dir] = calloc(MMIO_LEAF_ENTRIES, 1);
+	return mmioDirectory[dir];
+}
+
+// Writes slot to every page in [firstPage, lastPage], a leaf at a time
+static int fillPages(u32 firstPage, u32 lastPage, u8 slot)
+{
+	for (u32 page = firstPage;;)
+	{
+		u32 leafLast = page | (MMIO_LEAF_ENTRIES - 1);
+		if (leafLast > lastPage)
+			leafLast = lastPage;
+
+		u8* leaf = getLeaf(page, slot != 0);
+		if (leaf == NULL && slot != 0)
+		{
+			printf("BE_mmio: out of memory\n");
+			return 0;
+		}
+		if (leaf != NULL)
+			memset(leaf + (page & (MMIO_LEAF_ENTRIES - 1)), slot, leafLast - page + 1);
+
+		if (leafLast == lastPage)
+			break;
+		page = leafLast + 1;
+	}
+	return 1;
+}
+
+// Recomputes the slot of a page from the region table
+static void rescanPage(u32 page)
+{
+	u32 pageStart = page << MMIO_PAGE_SHIFT;
+	u32 pageLast = pageStart + ((1 << MMIO_PAGE_SHIFT) - 1);
+	u8 slot = 0;
+	for (int i = 0; i < BE_MMIO_MAX_REGIONS; ++i)
+	{
+		const BE_mmioRegion* region = &regions[i];
+		if (!region->inUse || region->base > pageLast || region->base + (region->size - 1) < pageStart)
+			continue;
+		slot = slot == 0 ? (u8)(i + 1) : MMIO_PAGE_SHARED;
+	}
+
+	// Every region on the page mapped its leaf already
+	u8* leaf = getLeaf(page, 0);
+	if (leaf != NULL)
+		leaf[page & (MMIO_LEAF_ENTRIES - 1)] = slot;
+}
+
+// Sets the slot of the region's pages, 0 to unmap them. Regions do not overlap, so only a
+// first or last page the region covers in part can hold another region and is rescanned.
+static int mapPages(const BE_mmioRegion* region, u8 slot)
+{
+	u32 firstPage = region->base >> MMIO_PAGE_SHIFT;
+	u32 lastPage = (region->base + (region->size - 1)) >> MMIO_PAGE_SHIFT;
+	if (!fillPages(firstPage, lastPage, slot))
+		return 0;
+
+	u32 pageMask = (1 << MMIO_PAGE_SHIFT) - 1;
+	if (region->base & pageMask)
+		rescanPage(firstPage);
+	if ((region->base + region->size) & pageMask)
+		rescanPage(lastPage);
+	return 1;
+}
+
+int BE_mmioRegister(u32 base, u32 size, void* backing, BE_mmioReadFunc read, BE_mmioWriteFunc write, void* context)
+{
+	if (size == 0 || base + (size - 1) < base)
+	{
+		printf("BE_mmioRegister: bad region %#x size %#x\n", base, size);
+		return -1;
+	}
+
+	int handle = -1;
+	for (int i = 0; i < BE_MMIO_MAX_REGIONS; ++i)
+	{
+		if (!regions[i].inUse)
+		{
+			if (handle < 0)
+				handle = i;
+			continue;
+		}
+
+		// Regions may share a page but must not overlap
+		u32 last = base + (size - 1);
+		u32 otherLast = regions[i].base + (regions[i].size - 1);
+		if (base <= otherLast && last >= regions[i].base)
+		{
+			printf("BE_mmioRegister: region %#x-%#x overlaps %#x-%#x\n", base, last, regions[i].base, otherLast);
+			return -1;
+		}
+	}
+
+	if (handle < 0)
+	{
+		printf("BE_mmioRegister: too many regions\n");
+		return -1;
+	}
+
+	BE_mmioRegion* region = &regions[handle];
+	region->base = base;
+	region->size = size;
+	region->backing = (u8*)backing;
+	region->read = read;
+	region->write = write;
+	region->context = context;
+	region->inUse = 1;
+
+	if (!mapPages(region, (u8)(handle + 1)))
+	{
+		BE_mmioUnregister(handle);
+		return -1;
+	}
+	return handle;
+}
+
+static void removeRegion(BE_mmioRegion* region)
+{
+	region->inUse = 0;
+	if (lastRegion == region)
+		lastRegion = NULL;
+	mapPages(region, 0);
+}
+
+void BE_mmioUnregister(int handle)
+{
+	if (handle < 0 || handle >= BE_MMIO_MAX_REGIONS || !regions[handle].inUse)
+		return;
+
+	removeRegion(&regions[handle]);
+	if (moveHandler != NULL)
+		moveHandler(&regions[handle], regions[handle].base);
+}
+
+int BE_mmioMove(int handle, u32 newBase)
+{
+	if (handle < 0 || handle >= BE_MMIO_MAX_REGIONS || !regions[handle].inUse)
+		return -1;
+
+	BE_mmioRegion old = regions[handle];
+	if (old.base == newBase)
+		return handle;
+
+	removeRegion(&regions[handle]);
+	int moved = BE_mmioRegister(newBase, old.size, old.backing, old.read, old.write, old.context);
+	if (moved < 0)
+	{
+		// Put it back where it was so the device does not silently vanish
+		return BE_mmioRegister(old.base, old.size, old.backing, old.read, old.write, old.context);
+	}
+	if (moveHandler != NULL)
+		moveHandler(&regions[moved], old.base);
+	return moved;
+}
+
+void BE_mmioSetMoveHandler(BE_mmioMoveFunc handler)
+{
+	moveHandler = handler;
+}
+
+void BE_mmioReset(void)
+{
+	for (unsigned int i = 0; i < sizeof(mmioDirectory) / sizeof(mmioDirectory[0]); ++i)
+	{
+		free(mmioDirectory[i]);
+		mmioDirectory[i] = NULL;
+	}
+	memset(regions, 0, sizeof(regions));
+	lastRegion = NULL;
+	nextGuestAddress = BE_GUEST_MMIO_BASE;
+}
+
+// Hands out a guest physical address for an aperture of the given size, naturally aligned
+// the way a PCI bus would place a BAR. Returns 0 when the MMIO window is exhausted.
+u32 BE_mmioAllocGuest(u32 size)
+{
+	u32 alignment = 1 << MMIO_PAGE_SHIFT;
+	while (alignment < size && alignment < 0x80000000)
+		alignment <<= 1;
+
+	u32 base = (nextGuestAddress + alignment - 1) & ~(alignment - 1);
+	if (base < nextGuestAddress || base >= BE_GUEST_MMIO_LIMIT || BE_GUEST_MMIO_LIMIT - base < alignment)
+	{
+		printf("BE_mmioAllocGuest: no room for %#x bytes\n", size);
+		return 0;
+	}
+
+	nextGuestAddress = base + alignment;
+	return base;
+}
+
+BE_mmioRegion* BE_mmioGet(int handle)
+{
+	if (handle < 0 || handle >= BE_MMIO_MAX_REGIONS || !regions[handle].inUse)
+		return NULL;
+	return &regions[handle];
+}
+
+BE_mmioRegion* BE_mmioFind(u32 addr)
+{
+	if (lastRegion != NULL && (addr - lastRegion->base) < lastRegion->size)
+		return lastRegion;
+
+	u8* leaf = mmioDirectory[addr >> MMIO_DIR_SHIFT];
+	if (leaf == NULL)
+		return NULL;
+
+	u8 slot = leaf[(addr >> MMIO_PAGE_SHIFT) & (MMIO_LEAF_ENTRIES - 1)];
+	if (slot == 0)
+		return NULL;
+
+	if (slot != MMIO_PAGE_SHARED)
+	{
+		BE_mmioRegion* region = &regions[slot - 1];
+		if (!regionContains(region, addr))
+			return NULL;
+		lastRegion = region;
+		return region;
+	}
+
+	for (int i = 0; i < BE_MMIO_MAX_REGIONS; ++i)
+	{
+		if (regionContains(&regions[i], addr))
+		{
+			lastRegion = &regions[i];
+			return lastRegion;
+		}
+	}
+	return NULL;
+}
+
+static u32 readRegion(BE_mmioRegion* region, u32 offset, int size)
+{
+	if (region->read != NULL)
+		return region->read(region->context, offset, size);
+	if (region->backing == NULL)
+		return 0xffffffff;
+
+	u8* base = region->backing + offset;
+	switch (size)
+	{
+	case 1:
+		return readb_le(base);
+	case 2:
+		return readw_le(base);
+	default:
+		return readl_le(base);
+	}
+}
+
+// Returns 1 when the value went to the region's backing memory
+static int writeRegion(BE_mmioRegion* region, u32 offset, u32 value, int size)
+{
+	if (region->write != NULL)
+	{
+		region->write(region->context, offset, value, size);
+		return 0;
+	}
+	if (region->backing == NULL)
+		return 0;
+
+	u8* base = region->backing + offset;
+	switch (size)
+	{
+	case 1:
+		writeb_le(base, value);
+		break;
+	case 2:
+		writew_le(base, value);
+		break;
+	default:
+		writel_le(base, value);
+		break;
+	}
+	return 1;
+}
+
+u32 BE_mmioRead(u32 addr, int size)
+{
+	BE_mmioRegion* region = BE_mmioFind(addr);
+	if (region == NULL)
+	{
+		DB(printf("BE_mmioRead: unmapped address %#x\n", addr);)
+		HALT_SYS();
+		return 0;
+	}
+
+	u32 offset = addr - region->base;
+	if ((u32)size <= region->size - offset)
+		return readRegion(region, offset, size);
+
+	// The access straddles the end of the region, split it into bytes
+	u32 value = 0;
+	for (int i = 0; i < size; ++i)
+		value |= (BE_mmioRead(addr + i, 1) & 0xff) << (i * 8);
+	return value;
+}
+
+// Returns 1 when any byte of the write was stored in backing memory
+int BE_mmioWrite(u32 addr, u32 value, int size)
+{
+	BE_mmioRegion* region = BE_mmioFind(addr);
+	if (region == NULL)
+	{
+		DB(printf("BE_mmioWrite: unmapped address %#x\n", addr);)
+		HALT_SYS();
+		return 0;
+	}
+
+	u32 offset = addr - region->base;
+	if ((u32)size <= region->size - offset)
+		return writeRegion(region, offset, value, size);
+
+	int stored = 0;
+	for (int i = 0; i < size; ++i)
+		stored |= BE_mmioWrite(addr + i, (value >> (i * 8)) & 0xff, 1);
+	return stored;
+}
@@ -1,21 +1,55 @@
 #include "include/pci_accessReg.h"
+#include "include/mmio.h"
+#include "include/pci_capability.h"
+#include "biosemui.h"
 
 #include "../cJSON.h"
 #include "../MemAllocator.h"
+#include "../PciImport.h"
+#include "../ProfileDb.h"
 
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 
-static unsigned char pci_config[256];
 typedef struct barInfo
 {
 	uint32_t size;
-	uintptr_t address;
-	unsigned char restoreAddress; // if true, then we need to restore the address from the cache after the user requested the size
+	uint32_t address; // guest physical address, see BE_mmioAllocGuest
+	unsigned char* backing; // host memory behind the bar
+	BE_mmioWriteFunc write; // NULL: guest writes go to the backing
+	int mmioHandle; // region in the MMIO registry that makes the bar memory reachable from the guest, -1 while off
 } barInfo;
 
-static barInfo barInfoCache[6];
+struct pciDevice;
+
+// Called after a guest write changed a register with side effects, index is the dword offset
+typedef void (*configWriteHook)(struct pciDevice* device, int index);
+
+// One function on the emulated bus, with its own PCIe extended configuration space.
+// The register file is data: per byte masks say which bits the guest can write
+// and which ones it clears by writing a 1, a per dword hook index names the
+// callback to run for registers with side effects.
+typedef struct pciDevice
+{
+	unsigned char config[PCI_CONFIG_SIZE];
+	unsigned char writable[PCI_CONFIG_SIZE];
+	unsigned char clearOnWrite[PCI_CONFIG_SIZE];
+	unsigned char hooks[PCI_CONFIG_SIZE / 4];
+	barInfo bars[6];
+	barInfo rom;
+	PCIslot slot;
+} pciDevice;
+
+// Devices sorted by bus/device/function, the device whose rom is analyzed is primaryDevice
+static pciDevice* devices[PCI_MAX_DEVICES];
+static int deviceCount;
+static pciDevice* primaryDevice;
+
+// Direct table from bus << 8 | device << 3 | function to the device index + 1, 0 when the slot is empty
+static unsigned char bdfTable[0x10000];
+
+#define BDF(bus, device, function) (((bus) << 8) | ((device) << 3) | (function))
 
 #define VENDOR_ID_OFFSET 0x00
 #define DEVICE_ID_OFFSET 0x02
@@ -34,6 +68,64 @@ static barInfo barInfoCache[6];
 #define BAR5_OFFSET 0x24
 #define EXPANSION_ROM_OFFSET 0x30
 
+// Type 1 (bridge) header fields
+#define PRIMARY_BUS_OFFSET 0x18
+#define SECONDARY_BUS_OFFSET 0x19
+#define SUBORDINATE_BUS_OFFSET 0x1a
+#define BRIDGE_ROM_OFFSET 0x38
+
+#define CACHE_LINE_SIZE_OFFSET 0x0c
+#define LATENCY_TIMER_OFFSET 0x0d
+#define INTERRUPT_LINE_OFFSET 0x3c
+#define BRIDGE_IO_BASE_OFFSET 0x1c
+#define BRIDGE_MEMORY_BASE_OFFSET 0x20
+#define BRIDGE_PREFETCH_BASE_OFFSET 0x24
+#define BRIDGE_CONTROL_OFFSET 0x3e
+
+#define HEADER_TYPE_BRIDGE 0x01
+#define HEADER_TYPE_MULTIFUNCTION 0x80
+
+// Everything past the standard header (capabilities, vendor specific and extended registers)
+// reads back what was written unless the profile says otherwise
+#define DEVICE_SPECIFIC_OFFSET 0x40
+
+typedef struct registerMask
+{
+	unsigned short offset;
+	unsigned char size;
+	uint32_t writable;
+	uint32_t clearOnWrite;
+} registerMask;
+
+// Writable bits of the standard headers, everything not listed is read-only
+static const registerMask type0Masks[] = {
+	{ COMMAND_OFFSET, 2, 0x0547, 0 },				// io/memory/bus master enable, parity, SERR, INTx disable
+	{ STATUS_OFFSET, 2, 0, 0xf900 },				// error bits are write-1-to-clear
+	{ CACHE_LINE_SIZE_OFFSET, 1, 0xff, 0 },
+	{ LATENCY_TIMER_OFFSET, 1, 0xff, 0 },
+	{ INTERRUPT_LINE_OFFSET, 1, 0xff, 0 },
+};
+
+static const registerMask type1Masks[] = {
+	{ COMMAND_OFFSET, 2, 0x0547, 0 },
+	{ STATUS_OFFSET, 2, 0, 0xf900 },
+	{ CACHE_LINE_SIZE_OFFSET, 1, 0xff, 0 },
+	{ LATENCY_TIMER_OFFSET, 1, 0xff, 0 },
+	{ PRIMARY_BUS_OFFSET, 4, 0xffffffff, 0 },		// primary, secondary, subordinate bus and secondary latency
+	{ BRIDGE_IO_BASE_OFFSET, 4, 0xf900f0f0, 0xf9000000 },	// io base/limit and secondary status
+	{ BRIDGE_MEMORY_BASE_OFFSET, 4, 0xfff0fff0, 0 },
+	{ BRIDGE_PREFETCH_BASE_OFFSET, 4, 0xfff0fff0, 0 },
+	{ INTERRUPT_LINE_OFFSET, 1, 0xff, 0 },
+	{ BRIDGE_CONTROL_OFFSET, 2, 0x0fff, 0 },
+};
+
+enum
+{
+	HOOK_NONE,
+	HOOK_BAR,
+	HOOK_EXPANSION_ROM,
+};
+
 static unsigned char jsongStringItemToUnsignedByte(const cJSON* json)
 {
 	const char* value = cJSON_GetStringValue(json);
@@ -58,6 +150,21 @@ static unsigned int jsonStringItemToUnsignedInteger(const cJSON* json)
 	return (unsigned int)strtol(value, NULL, 16);
 }
 
+// The field setters only touch the config when the json has the field, so they can refine an imported config
+static void setByteFromJson(const cJSON* json, const char* name, unsigned char* config, int offset)
+{
+	const cJSON* item = cJSON_GetObjectItem(json, name);
+	if (item != NULL)
+		config[offset] = jsongStringItemToUnsignedByte(item);
+}
+
+static void setShortFromJson(const cJSON* json, const char* name, unsigned char* config, int offset)
+{
+	const cJSON* item = cJSON_GetObjectItem(json, name);
+	if (item != NULL)
+		writew_le(config + offset, jsonStringItemToShort(item));
+}
+
 void setUnsignedShortInConfig(unsigned char* config, int offset, unsigned short value)
 {
 	uint16_t* address = (uint16_t*)(config + offset);
@@ -70,17 +177,168 @@ void setUnsignedIntInConfig(unsigned char* config, int offset, unsigned int valu
 	*address = value;
 }
 
-unsigned char* buildConfigFromJsonAndRom(const cJSON* json, uintptr_t rom)
+// The rom is mapped read-only, so guest writes to the expansion rom aperture are dropped
+static void romWrite(void* context, u32 offset, u32 value, int size)
+{
+}
+
+// Apertures of a huge page or more go through the large allocator so they can get huge pages
+static unsigned char* allocateBarMemory(uint32_t size)
+{
+	if (size >= HUGE_PAGE_SIZE)
+		return allocateLargeHostMemory(size);
+	return allocateHostMemory(size);
+}
+
+static void freeBarMemory(unsigned char* backing, uint32_t size)
 {
-	uint32_t romAddress = (uint32_t)rom;
-	if (romAddress != rom)
+	if (size >= HUGE_PAGE_SIZE)
+		freeLargeHostMemory(backing, size);
+	else
+		freeHostMemory(backing, size);
+}
+
+static u32 loadRegister(const unsigned char* file, int index, int size)
+{
+	switch (size)
 	{
-		printf("Bad rom allocation\nIt has be within the first 4GB of memory\n");
-		return NULL;
+	case 1:
+		return readb_le(file + index);
+	case 2:
+		return readw_le(file + index);
+	default:
+		return readl_le(file + index);
+	}
+}
+
+static void storeRegister(unsigned char* file, int index, u32 value, int size)
+{
+	switch (size)
+	{
+	case 1:
+		writeb_le(file + index, value);
+		break;
+	case 2:
+		writew_le(file + index, value);
+		break;
+	default:
+		writel_le(file + index, value);
+		break;
 	}
+}
 
-	memset(pci_config, 0, 256);
-	memset(barInfoCache, 0, sizeof(barInfoCache));
+static void setMasks(pciDevice* device, const registerMask* masks, unsigned int count)
+{
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		storeRegister(device->writable, masks[i].offset, masks[i].writable, masks[i].size);
+		storeRegister(device->clearOnWrite, masks[i].offset, masks[i].clearOnWrite, masks[i].size);
+	}
+}
+
+// Address bits of a bar or rom decoder: the size rounded up to a power of two, at least minimum
+static uint32_t decoderMask(uint32_t size, uint32_t minimum)
+{
+	uint32_t decoded = minimum;
+	while (decoded < size && decoded < 0x80000000)
+		decoded <<= 1;
+	return ~(decoded - 1);
+}
+
+// ECAM: bus in address bits 27:20, device/function in 19:12, register in 11:0
+static u32 ecamRead(void* context, u32 offset, int size)
+{
+	PCIDeviceInfo info;
+	info.slot.i = 0;
+	info.slot.p.Bus = (offset >> 20) & 0xff;
+	info.slot.p.Device = (offset >> 15) & 0x1f;
+	info.slot.p.Function = (offset >> 12) & 0x7;
+	return PCI_accessReg(offset & (PCI_CONFIG_SIZE - 1), 0, size == 1 ? PCI_READ_BYTE : size == 2 ? PCI_READ_WORD : PCI_READ_DWORD, &info);
+}
+
+static void ecamWrite(void* context, u32 offset, u32 value, int size)
+{
+	PCIDeviceInfo info;
+	info.slot.i = 0;
+	info.slot.p.Bus = (offset >> 20) & 0xff;
+	info.slot.p.Device = (offset >> 15) & 0x1f;
+	info.slot.p.Function = (offset >> 12) & 0x7;
+	PCI_accessReg(offset & (PCI_CONFIG_SIZE - 1), value, size == 1 ? PCI_WRITE_BYTE : size == 2 ? PCI_WRITE_WORD : PCI_WRITE_DWORD, &info);
+}
+
+static int slotKey(PCIslot slot)
+{
+	return BDF(slot.p.Bus, slot.p.Device, slot.p.Function);
+}
+
+static void releaseDevices(void)
+{
+	for (int d = 0; d < deviceCount; ++d)
+	{
+		for (unsigned int i = 0; i < 6; ++i)
+		{
+			if (devices[d]->bars[i].backing != NULL)
+				freeBarMemory(devices[d]->bars[i].backing, devices[d]->bars[i].size);
+		}
+		free(devices[d]);
+		devices[d] = NULL;
+	}
+	deviceCount = 0;
+	primaryDevice = NULL;
+	memset(bdfTable, 0, sizeof(bdfTable));
+}
+
+// "config_file" names a raw config blob like /sys/bus/pci/devices/*/config, "lspci_file" an
+// lspci -xxxx dump and "profile" an entry of the profile database, see ProfileDb.h.
+// The function is picked from an lspci dump by "bus", "device" and "function",
+// the first one is taken when none of them is given.
+// Returns 1 when a config was imported, 0 when the json has none, -1 on errors.
+static int importConfig(const cJSON* json, PciDump* dump)
+{
+	const char* configFile = cJSON_GetStringValue(cJSON_GetObjectItem(json, "config_file"));
+	if (configFile != NULL)
+		return readSysfsConfig(configFile, dump) ? 1 : -1;
+
+	const char* profile = cJSON_GetStringValue(cJSON_GetObjectItem(json, "profile"));
+	if (profile != NULL)
+		return loadProfile(profile, dump) ? 1 : -1;
+
+	const char* lspciFile = cJSON_GetStringValue(cJSON_GetObjectItem(json, "lspci_file"));
+	if (lspciFile == NULL)
+		return 0;
+
+	int slot = -1;
+	if (cJSON_GetObjectItem(json, "bus") != NULL || cJSON_GetObjectItem(json, "device") != NULL ||
+		cJSON_GetObjectItem(json, "function") != NULL)
+	{
+		slot = BDF(jsongStringItemToUnsignedByte(cJSON_GetObjectItem(json, "bus")),
+				   jsongStringItemToUnsignedByte(cJSON_GetObjectItem(json, "device")) & 0x1f,
+				   jsongStringItemToUnsignedByte(cJSON_GetObjectItem(json, "function")) & 0x7);
+	}
+	return findLspciDevice(lspciFile, slot, dump) ? 1 : -1;
+}
+
+// Describes one function from a json object, starting from a captured config space when the json
+// names one. Nothing is allocated in the emulator, so profiles can be built ahead of time.
+int buildProfileFromJson(const cJSON* json, PciDump* profile)
+{
+	int imported = importConfig(json, profile);
+	if (imported < 0)
+		return 0;
+	if (!imported)
+	{
+		memset(profile, 0, sizeof(PciDump));
+		profile->length = PCI_CONFIG_SIZE;
+	}
+	unsigned char* pci_config = profile->config;
+
+	// "bus", "device" and "function" place the device, 00:00.0 when not given
+	if (cJSON_GetObjectItem(json, "bus") != NULL)
+		profile->bus = jsongStringItemToUnsignedByte(cJSON_GetObjectItem(json, "bus"));
+	if (cJSON_GetObjectItem(json, "device") != NULL)
+		profile->device = jsongStringItemToUnsignedByte(cJSON_GetObjectItem(json, "device")) & 0x1f;
+	if (cJSON_GetObjectItem(json, "function") != NULL)
+		profile->function = jsongStringItemToUnsignedByte(cJSON_GetObjectItem(json, "function")) & 0x7;
 
 	// Read the various fields from the json file
 	// and write them to the pci_config array
@@ -103,102 +361,431 @@ unsigned char* buildConfigFromJsonAndRom(const cJSON* json, uintptr_t rom)
 	// "bar3size" (4 bytes)   // Then we will return the cached size and reset the bar to the allocated memory address
 	// "bar4size" (4 bytes)
 	// "bar5size" (4 bytes)
-	unsigned short vendor_id = jsonStringItemToShort(cJSON_GetObjectItem(json, "vendor_id"));
-	setUnsignedShortInConfig(pci_config, VENDOR_ID_OFFSET, vendor_id);
-
-	unsigned short device_id = jsonStringItemToShort(cJSON_GetObjectItem(json, "device_id"));
-	setUnsignedShortInConfig(pci_config, DEVICE_ID_OFFSET, device_id);
+	// Bridges give "secondary_bus" and "subordinate_bus" (1 byte each) and only have bar0 and bar1.
+	// With an imported config, fields that are not given keep their captured value and
+	// "resource_file" (a sysfs resource file) can give the bar sizes.
+	setShortFromJson(json, "vendor_id", pci_config, VENDOR_ID_OFFSET);
+	setShortFromJson(json, "device_id", pci_config, DEVICE_ID_OFFSET);
+	setByteFromJson(json, "class", pci_config, CLASS_OFFSET);
+	setByteFromJson(json, "subclass", pci_config, SUBCLASS_OFFSET);
+	setByteFromJson(json, "prog_if", pci_config, PROG_IF_OFFSET);
+	setByteFromJson(json, "revision_id", pci_config, REVISION_ID_OFFSET);
+	setByteFromJson(json, "header_type", pci_config, HEADER_TYPE_OFFSET);
 
-	// Clear command and status
-	setUnsignedIntInConfig(pci_config, COMMAND_OFFSET, 0x00000000);
+	const cJSON* secondaryItem = cJSON_GetObjectItem(json, "secondary_bus");
+	if (secondaryItem != NULL)
+	{
+		pci_config[HEADER_TYPE_OFFSET] = (pci_config[HEADER_TYPE_OFFSET] & HEADER_TYPE_MULTIFUNCTION) | HEADER_TYPE_BRIDGE;
+		unsigned char secondary = jsongStringItemToUnsignedByte(secondaryItem);
+		const cJSON* subordinateItem = cJSON_GetObjectItem(json, "subordinate_bus");
+		pci_config[PRIMARY_BUS_OFFSET] = profile->bus;
+		pci_config[SECONDARY_BUS_OFFSET] = secondary;
+		pci_config[SUBORDINATE_BUS_OFFSET] = subordinateItem != NULL ? jsongStringItemToUnsignedByte(subordinateItem) : secondary;
+	}
 
-	unsigned int pciClass = (unsigned int)jsongStringItemToUnsignedByte(cJSON_GetObjectItem(json, "class"));
-	unsigned int pciSubclass = (unsigned int)jsongStringItemToUnsignedByte(cJSON_GetObjectItem(json, "subclass"));
-	unsigned int pciProgIf = (unsigned int)jsongStringItemToUnsignedByte(cJSON_GetObjectItem(json, "prog_if"));
-	unsigned int pciRevisionId = (unsigned int)jsongStringItemToUnsignedByte(cJSON_GetObjectItem(json, "revision_id"));	
-	setUnsignedIntInConfig(pci_config, REVISION_ID_OFFSET, ((pciClass << 24) & 0xff000000) &
-													  	   ((pciSubclass << 16) & 0x00ff0000) &
-													  	   ((pciProgIf << 8) & 0x0000ff00) &
-													  	   (pciRevisionId & 0x000000ff));
+	// "capabilities" lays out the capability lists, see pci_capability.h:
+	// [{ "type": "pcie", "link_speed": "4", "link_width": "10" }, { "type": "msi", "vectors": "4" }]
+	const cJSON* capabilities = cJSON_GetObjectItem(json, "capabilities");
+	if (capabilities != NULL)
+	{
+		if (!PCI_buildCapabilities(capabilities, pci_config))
+			return 0;
+		profile->length = PCI_CONFIG_SIZE;
+	}
 
+	const char* resourceFile = cJSON_GetStringValue(cJSON_GetObjectItem(json, "resource_file"));
+	if (resourceFile != NULL && !readSysfsResource(resourceFile, profile->resourceSizes))
+		return 0;
 
 	char buf[9] = { 0 };
 	for (unsigned int i = 0; i < 6; ++i)
 	{
 		snprintf(buf, 9, "bar%1usize", i);
-		unsigned int barSize = jsonStringItemToUnsignedInteger(cJSON_GetObjectItem(json, buf));
-		if (barSize != 0)
+		const cJSON* sizeItem = cJSON_GetObjectItem(json, buf);
+		if (sizeItem != NULL)
+			profile->resourceSizes[i] = jsonStringItemToUnsignedInteger(sizeItem);
+	}
+	return 1;
+}
+
+// Creates the emulated function for a profile: the register file, the bars and their apertures.
+// "registers" in the json, when given, refine the result.
+static pciDevice* buildDevice(const cJSON* json, const PciDump* profile)
+{
+	if (deviceCount == PCI_MAX_DEVICES)
+	{
+		printf("Too many PCI devices, at most %d are supported\n", PCI_MAX_DEVICES);
+		return NULL;
+	}
+
+	pciDevice* device = calloc(1, sizeof(pciDevice));
+	if (device == NULL)
+	{
+		printf("Could not allocate memory\n");
+		return NULL;
+	}
+	devices[deviceCount++] = device;
+	unsigned char* pci_config = device->config;
+
+	memcpy(pci_config, profile->config, profile->length < PCI_CONFIG_SIZE ? profile->length : PCI_CONFIG_SIZE);
+	device->slot.p.Bus = profile->bus;
+	device->slot.p.Device = profile->device;
+	device->slot.p.Function = profile->function;
+
+	// Clear command and the error bits of status, the capability list bit stays
+	writew_le(pci_config + COMMAND_OFFSET, 0);
+	writew_le(pci_config + STATUS_OFFSET, readw_le(pci_config + STATUS_OFFSET) & ~0xf900);
+
+	int isBridge = (pci_config[HEADER_TYPE_OFFSET] & 0x7f) == HEADER_TYPE_BRIDGE;
+	if (isBridge)
+		setMasks(device, type1Masks, sizeof(type1Masks) / sizeof(type1Masks[0]));
+	else
+		setMasks(device, type0Masks, sizeof(type0Masks) / sizeof(type0Masks[0]));
+	memset(device->writable + DEVICE_SPECIFIC_OFFSET, 0xff, PCI_CONFIG_SIZE - DEVICE_SPECIFIC_OFFSET);
+	PCI_capabilityMasks(pci_config, device->writable, device->clearOnWrite);
+
+	// Only the analyzed device gets a rom aperture, see buildConfigFromJsonAndRom
+	setUnsignedIntInConfig(pci_config, isBridge ? BRIDGE_ROM_OFFSET : EXPANSION_ROM_OFFSET, 0);
+
+	unsigned int barCount = isBridge ? 2 : 6;
+	for (unsigned int i = 0; i < barCount; ++i)
+	{
+		int offset = BAR0_OFFSET + i * 4;
+		uint64_t barSize = profile->resourceSizes[i];
+		if (barSize == 0 || barSize > 0x80000000)
 		{
-			barInfoCache[i].size = barSize;
-			barInfoCache[i].address = allocateIn4GBRange(barSize);
-			barInfoCache[i].restoreAddress = 1;
-			setUnsignedIntInConfig(pci_config, BAR0_OFFSET + i * 4, barInfoCache[i].address);
+			if (barSize != 0)
+				printf("bar%u is too large to emulate (%#llx bytes)\n", i, (unsigned long long)barSize);
+			setUnsignedIntInConfig(pci_config, offset, 0);
+			continue;
 		}
-		else
-			setUnsignedIntInConfig(pci_config, BAR0_OFFSET + i * 4, 0);
-	}
 
-	setUnsignedIntInConfig(pci_config, EXPANSION_ROM_OFFSET, romAddress);
-	uint32_t* rom_address = (uint32_t*)(pci_config + EXPANSION_ROM_OFFSET);
-	*rom_address = rom;
+		// Type bits of a captured bar are kept, a bar described in json is 32 bit memory
+		uint32_t captured = readl_le(pci_config + offset);
+		if (captured & 1)
+		{
+			// I/O bars keep their captured port, there is no port space behind them
+			setUnsignedIntInConfig(device->writable, offset, decoderMask((uint32_t)barSize, 4) & ~3u);
+			continue;
+		}
+		uint32_t flags = captured & 0xf;
 
-	return pci_config;
+		barInfo* bar = &device->bars[i];
+		bar->size = (uint32_t)barSize;
+		// The guest address is naturally aligned to the bar size, just like on a real bus.
+		// The host memory behind it can live anywhere.
+		bar->address = BE_mmioAllocGuest(bar->size);
+		bar->backing = allocateBarMemory(bar->size);
+		if (bar->address == 0 || bar->backing == NULL)
+		{
+			printf("Could not allocate bar%u (%#x bytes)\n", i, bar->size);
+			return NULL;
+		}
+		bar->mmioHandle = BE_mmioRegister(bar->address, bar->size, bar->backing, NULL, NULL, NULL);
+		setUnsignedIntInConfig(pci_config, offset, bar->address | flags);
+
+		// Sizing works like on hardware: writing all ones reads back the decoder mask.
+		// The low four type bits are read-only.
+		setUnsignedIntInConfig(device->writable, offset, decoderMask(bar->size, 16));
+		device->hooks[offset / 4] = HOOK_BAR;
+
+		// A 64 bit bar is placed below 4GB, its upper half only has to survive sizing
+		if ((flags & 0x6) == 0x4 && i + 1 < barCount)
+		{
+			++i;
+			setUnsignedIntInConfig(pci_config, offset + 4, 0);
+			setUnsignedIntInConfig(device->writable, offset + 4, 0xffffffff);
+		}
+	}
+
+	// "registers" sets any dword of the config space, with optional "writable" and "clear" masks:
+	// [{ "offset": "40", "value": "00010005", "writable": "0000ff00", "clear": "0" }]
+	const cJSON* registers = cJSON_GetObjectItem(json, "registers");
+	const cJSON* reg = NULL;
+	cJSON_ArrayForEach(reg, registers)
+	{
+		unsigned int offset = jsonStringItemToUnsignedInteger(cJSON_GetObjectItem(reg, "offset"));
+		if (offset >= PCI_CONFIG_SIZE || (offset & 3) != 0)
+		{
+			printf("Bad config register offset %#x\n", offset);
+			return NULL;
+		}
+		setUnsignedIntInConfig(pci_config, offset, jsonStringItemToUnsignedInteger(cJSON_GetObjectItem(reg, "value")));
+		const cJSON* writableItem = cJSON_GetObjectItem(reg, "writable");
+		if (writableItem != NULL)
+			setUnsignedIntInConfig(device->writable, offset, jsonStringItemToUnsignedInteger(writableItem));
+		const cJSON* clearItem = cJSON_GetObjectItem(reg, "clear");
+		if (clearItem != NULL)
+			setUnsignedIntInConfig(device->clearOnWrite, offset, jsonStringItemToUnsignedInteger(clearItem));
+	}
+	return device;
 }
 
-ulong PCI_accessReg(int index, ulong value, int func, PCIDeviceInfo *info)
+static int importDevice(const PciDump* dump, void* context)
 {
-	switch (func)
+	int key = BDF(dump->bus, dump->device, dump->function);
+	for (int d = 0; d < deviceCount; ++d)
 	{
-	case PCI_READ_BYTE:
-		printf("Reading byte from config at index %d\n", index);
-		return (uchar)*(pci_config + index);
-	case PCI_READ_WORD:
-		printf("Reading word from config at index %d\n", index);
-		return (ushort)*(pci_config + index);
-	case PCI_READ_DWORD:
+		if (slotKey(devices[d]->slot) == key)
+			return 1;
+	}
+
+	if (buildDevice(NULL, dump) == NULL)
 	{
-		ulong result = (ulong)*(pci_config + index);
+		*(int*)context = 1;
+		return 0;
+	}
+	return 1;
+}
 
-		int readingSize = 0;
-		// If we are reading from a bar, we might have to reset the address to the cached address
-		if(index >= BAR0_OFFSET && index <= BAR5_OFFSET)
+static int compareDevices(const void* a, const void* b)
+{
+	return slotKey((*(pciDevice* const*)a)->slot) - slotKey((*(pciDevice* const*)b)->slot);
+}
+
+// Sorts the devices into enumeration order and fills the BDF table
+static int indexDevices(void)
+{
+	qsort(devices, deviceCount, sizeof(devices[0]), compareDevices);
+	for (int d = 0; d < deviceCount; ++d)
+	{
+		int key = slotKey(devices[d]->slot);
+		if (bdfTable[key] != 0)
 		{
-			int barIndex = (index - BAR0_OFFSET) / 4;
-			if (barInfoCache[barIndex].restoreAddress)
-			{
-				readingSize = 1;
-				barInfoCache[barIndex].restoreAddress = 0;
-				*(pci_config + index) = (ulong)barInfoCache[barIndex].address;
-			}
+			printf("Two PCI devices at %02x:%02x.%x\n", devices[d]->slot.p.Bus, devices[d]->slot.p.Device,
+				   devices[d]->slot.p.Function);
+			return 0;
 		}
+		bdfTable[key] = (unsigned char)(d + 1);
+	}
 
-		if (readingSize)
-			printf("Reading size from config at index %d\n", index);
-		else
-			printf("Reading dword from config at index %d\n", index);
+	// Function 0 of a device with more functions has to advertise it in its header type
+	for (int d = 0; d < deviceCount; ++d)
+	{
+		PCIslot slot = devices[d]->slot;
+		int function0 = bdfTable[BDF(slot.p.Bus, slot.p.Device, 0)];
+		if (slot.p.Function != 0 && function0 != 0)
+			devices[function0 - 1]->config[HEADER_TYPE_OFFSET] |= HEADER_TYPE_MULTIFUNCTION;
+	}
+	return 1;
+}
+
+// The top level json object describes the device whose rom is analyzed, the optional
+// "devices" array the other functions and bridges on the bus, with the same fields
+unsigned char* buildConfigFromJsonAndRom(const cJSON* json, const void* rom, uint32_t romSize)
+{
+	// Release the devices of a previous configuration
+	releaseDevices();
+	BE_mmioReset();
+
+	// Config space is also reachable through the memory mapped ECAM window
+	if (BE_mmioRegister(PCI_ECAM_BASE, PCI_ECAM_SIZE, NULL, ecamRead, ecamWrite, NULL) < 0)
+		return NULL;
 
-		return result;
+	// Big enough to not belong on the stack
+	static PciDump profile;
+	if (!buildProfileFromJson(json, &profile))
+		return NULL;
+	pciDevice* device = buildDevice(json, &profile);
+	if (device == NULL)
+		return NULL;
+
+	const cJSON* others = cJSON_GetObjectItem(json, "devices");
+	const cJSON* other = NULL;
+	cJSON_ArrayForEach(other, others)
+	{
+		if (!buildProfileFromJson(other, &profile) || buildDevice(other, &profile) == NULL)
+			return NULL;
 	}
-	case PCI_WRITE_BYTE:
-		printf("Writing byte to config at index %d, value: %#x\n", index, value);
-		*(pci_config + index) = (uchar)value;
-		break;
-	case PCI_WRITE_WORD:
-		printf("Writing word to config at index %d, value: %#x\n", index, value);
-		*(pci_config + index) = (ushort)value;
-		break;
-	case PCI_WRITE_DWORD:
-		printf("Writing word to config at index %d, value: %#x\n", index, value);
-		*(pci_config + index) = value;
 
-		// If writing 0xffffffff into a bar, we have to set the size of the bar in the register
-		if (value == 0xffffffff && (index >= BAR0_OFFSET && index <= BAR5_OFFSET))
+	// "lspci_devices" adds every function of an lspci -xxxx dump that is not described already
+	const char* lspciDevices = cJSON_GetStringValue(cJSON_GetObjectItem(json, "lspci_devices"));
+	if (lspciDevices != NULL)
+	{
+		int failed = 0;
+		if (readLspciFile(lspciDevices, importDevice, &failed) < 0 || failed)
+			return NULL;
+	}
+
+	if (!indexDevices())
+		return NULL;
+	primaryDevice = device;
+
+	uint32_t romAddress = BE_mmioAllocGuest(romSize);
+	if (romAddress == 0)
+		return NULL;
+	int romOffset = (device->config[HEADER_TYPE_OFFSET] & 0x7f) == HEADER_TYPE_BRIDGE ? BRIDGE_ROM_OFFSET : EXPANSION_ROM_OFFSET;
+	setUnsignedIntInConfig(device->config, romOffset, romAddress);
+	device->rom.size = romSize;
+	device->rom.address = romAddress;
+	device->rom.backing = (unsigned char*)rom;
+	device->rom.write = romWrite;
+	device->rom.mmioHandle = BE_mmioRegister(romAddress, romSize, device->rom.backing, NULL, romWrite, NULL);
+
+	// Address bits above the 2KB minimum decoder plus the enable bit
+	setUnsignedIntInConfig(device->writable, romOffset, decoderMask(romSize, 0x800) | 1);
+	device->hooks[romOffset / 4] = HOOK_EXPANSION_ROM;
+
+	return device->config;
+}
+
+PCIslot PCI_primarySlot(void)
+{
+	PCIslot slot;
+	slot.i = 0;
+	if (primaryDevice != NULL)
+		slot = primaryDevice->slot;
+	return slot;
+}
+
+int PCI_maxBus(void)
+{
+	int maxBus = 0;
+	for (int d = 0; d < deviceCount; ++d)
+	{
+		const pciDevice* device = devices[d];
+		if (device->slot.p.Bus > maxBus)
+			maxBus = device->slot.p.Bus;
+		if ((device->config[HEADER_TYPE_OFFSET] & 0x7f) == HEADER_TYPE_BRIDGE && device->config[SUBORDINATE_BUS_OFFSET] > maxBus)
+			maxBus = device->config[SUBORDINATE_BUS_OFFSET];
+	}
+	return maxBus;
+}
+
+// Returns the slot of the index'th function, in bus order, with the given ids
+int PCI_findDevice(u16 vendorID, u16 deviceID, int index, PCIslot* slot)
+{
+	for (int d = 0; d < deviceCount; ++d)
+	{
+		const unsigned char* config = devices[d]->config;
+		if (readw_le(config + VENDOR_ID_OFFSET) != vendorID || readw_le(config + DEVICE_ID_OFFSET) != deviceID)
+			continue;
+		if (index-- == 0)
 		{
-			int barIndex = (index - BAR0_OFFSET) / 4;
-			*(pci_config + index) = (ulong)barInfoCache[barIndex].size;
+			*slot = devices[d]->slot;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Same for a 24 bit class code, base class in bits 23:16
+int PCI_findClass(u32 classCode, int index, PCIslot* slot)
+{
+	for (int d = 0; d < deviceCount; ++d)
+	{
+		if ((readl_le(devices[d]->config + REVISION_ID_OFFSET) >> 8) != (classCode & 0xffffff))
+			continue;
+		if (index-- == 0)
+		{
+			*slot = devices[d]->slot;
+			return 1;
 		}
-		break;
 	}
+	return 0;
+}
+
+// Slot of the index'th function in bus order, 0 past the last one
+int PCI_enumerate(int index, PCIslot* slot)
+{
+	if (index < 0 || index >= deviceCount)
+		return 0;
+	*slot = devices[index]->slot;
+	return 1;
+}
+
+// Register file and writable masks of the index'th function in bus order, NULL past the last one
+const unsigned char* PCI_deviceConfig(int index, const unsigned char** writable)
+{
+	if (index < 0 || index >= deviceCount)
+		return NULL;
+	*writable = devices[index]->writable;
+	return devices[index]->config;
+}
+
+// Moves the guest aperture of a decoder after its address register changed. Writing all ones
+// to size the decoder parks it at the mask value on hardware, the aperture stays put meanwhile.
+// Address 0 is how firmware leaves a decoder unassigned, the aperture goes away until the next move.
+// When the registry refuses the new place the aperture stays where it was.
+static void moveDecoder(barInfo* decoder, uint32_t address, uint32_t mask)
+{
+	if (address == mask || address == decoder->address)
+		return;
+	if (address == 0)
+	{
+		BE_mmioUnregister(decoder->mmioHandle);
+		decoder->mmioHandle = -1;
+		decoder->address = 0;
+		return;
+	}
+
+	if (decoder->mmioHandle >= 0)
+		decoder->mmioHandle = BE_mmioMove(decoder->mmioHandle, address);
+	else
+		decoder->mmioHandle = BE_mmioRegister(address, decoder->size, decoder->backing, NULL, decoder->write, NULL);
+	const BE_mmioRegion* region = BE_mmioGet(decoder->mmioHandle);
+	decoder->address = region != NULL ? region->base : 0;
+}
+
+static void barWriteHook(pciDevice* device, int index)
+{
+	uint32_t mask = readl_le(device->writable + index);
+	moveDecoder(&device->bars[(index - BAR0_OFFSET) / 4], readl_le(device->config + index) & mask, mask);
+}
+
+static void expansionRomWriteHook(pciDevice* device, int index)
+{
+	uint32_t mask = readl_le(device->writable + index) & ~1u;
+	moveDecoder(&device->rom, readl_le(device->config + index) & mask, mask);
+}
+
+// Indexed by the hooks[] entries of a device
+static const configWriteHook writeHooks[] = {
+	NULL,
+	barWriteHook,
+	expansionRomWriteHook,
+};
+
+static u32 readRegister(pciDevice* device, int index, int size)
+{
+	return loadRegister(device->config, index, size);
+}
+
+// A masked store: read-only bits keep their value, writable bits take the new one
+// and write-1-to-clear bits are cleared where the value has a 1
+static void writeRegister(pciDevice* device, int index, u32 value, int size)
+{
+	u32 old = loadRegister(device->config, index, size);
+	u32 writable = loadRegister(device->writable, index, size);
+	u32 clear = loadRegister(device->clearOnWrite, index, size);
+	storeRegister(device->config, index, ((old & ~writable) | (value & writable)) & ~(value & clear), size);
+
+	unsigned char hook = device->hooks[index / 4];
+	if (hook != HOOK_NONE)
+		writeHooks[hook](device, index & ~3);
+}
+
+// Access width of the PCI_READ_* / PCI_WRITE_* function codes
+static const int accessSize[] = { 1, 2, 4, 1, 2, 4 };
+
+static const ulong absentDevice[] = { 0xff, 0xffff, 0xffffffff };
+
+// index is a register number in the 4KB extended configuration space
+ulong PCI_accessReg(int index, ulong value, int func, PCIDeviceInfo *info)
+{
+	if (func < PCI_READ_BYTE || func > PCI_WRITE_DWORD)
+		return 0;
+
+	// Nothing answers config cycles to empty slots
+	int slot = bdfTable[BDF(info->slot.p.Bus, info->slot.p.Device, info->slot.p.Function)];
+	if (slot == 0)
+		return func <= PCI_READ_DWORD ? absentDevice[func] : value;
 
+	// Accesses are naturally aligned, like the byte enables of a config cycle
+	int size = accessSize[func];
+	index &= (PCI_CONFIG_SIZE - 1) & ~(size - 1);
+	if (func <= PCI_READ_DWORD)
+		return readRegister(devices[slot - 1], index, size);
+	writeRegister(devices[slot - 1], index, (u32)value, size);
 	return value;
 }
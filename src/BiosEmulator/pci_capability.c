@@ -0,0 +1,455 @@
+#include "include/pci_capability.h"
+#include "biosemui.h"
+
+#include "../cJSON.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define STATUS_OFFSET 0x06
+#define STATUS_CAPABILITY_LIST 0x0010
+
+// The standard list lives below the extended space, the extended one fills the rest of the 4KB
+#define CAPABILITY_END 0x100
+#define EXT_CAPABILITY_END 0x1000
+
+// Bounds the list walks, so a looping list in a captured config cannot hang the loader
+#define MAX_CAPABILITIES ((EXT_CAPABILITY_END - PCI_CAPABILITY_START) / 4)
+
+// Fills the body of a capability at cap, returns its size or 0 when it does not fit in room
+typedef int (*capabilityFill)(const cJSON* json, u8* cap, int room);
+
+typedef struct capabilityType
+{
+	const char* name;
+	u16 id;
+	u8 extended;
+	u8 version;					// extended capabilities only
+	capabilityFill fill;
+} capabilityType;
+
+static u32 jsonHex(const cJSON* json, const char* name, u32 defaultValue)
+{
+	const char* value = cJSON_GetStringValue(cJSON_GetObjectItem(json, name));
+	if (value == NULL)
+		return defaultValue;
+	return (u32)strtoul(value, NULL, 16);
+}
+
+static int jsonFlag(const cJSON* json, const char* name, int defaultValue)
+{
+	const cJSON* item = cJSON_GetObjectItem(json, name);
+	if (!cJSON_IsBool(item))
+		return defaultValue;
+	return cJSON_IsTrue(item);
+}
+
+// "data" is a string of hex byte pairs, returns the number of bytes or -1
+static int jsonData(const cJSON* json, u8* out, int room)
+{
+	const char* data = cJSON_GetStringValue(cJSON_GetObjectItem(json, "data"));
+	if (data == NULL)
+		return 0;
+
+	int length = 0;
+	for (const char* p = data; *p != '\0'; p += 2)
+	{
+		char pair[3] = { p[0], p[1], '\0' };
+		char* end;
+		unsigned long value = strtoul(pair, &end, 16);
+		if (p[1] == '\0' || *end != '\0' || length == room)
+			return -1;
+		out[length++] = (u8)value;
+	}
+	return length;
+}
+
+static int log2Ceiling(u32 value)
+{
+	int log = 0;
+	while ((1u << log) < value && log < 31)
+		++log;
+	return log;
+}
+
+static int fillPowerManagement(const cJSON* json, u8* cap, int room)
+{
+	if (room < 8)
+		return 0;
+	// Version 3 (PCI PM 1.2), optional D1/D2 and the PME# support mask in bits 15:11
+	u16 pmc = 0x0003 | (jsonFlag(json, "d1", 0) << 9) | (jsonFlag(json, "d2", 0) << 10) |
+			  ((jsonHex(json, "pme", 0) & 0x1f) << 11);
+	writew_le(cap + 2, pmc);
+	writew_le(cap + 4, 0x0008);		// D0, no soft reset
+	return 8;
+}
+
+static int fillMsi(const cJSON* json, u8* cap, int room)
+{
+	int is64 = jsonFlag(json, "64bit", 1);
+	int masking = jsonFlag(json, "masking", 0);
+	int size = 10 + (is64 ? 4 : 0) + (masking ? 10 : 0);
+	if (size > room)
+		return 0;
+
+	int vectors = log2Ceiling(jsonHex(json, "vectors", 1));
+	writew_le(cap + 2, ((vectors > 5 ? 5 : vectors) << 1) | (is64 << 7) | (masking << 8));
+	return size;
+}
+
+static int fillMsix(const cJSON* json, u8* cap, int room)
+{
+	if (room < 12)
+		return 0;
+
+	u32 vectors = jsonHex(json, "vectors", 1);
+	if (vectors == 0 || vectors > 0x800)
+	{
+		printf("MSI-X supports 1 to 0x800 vectors, not %#x\n", vectors);
+		return 0;
+	}
+	u32 bir = jsonHex(json, "bir", 0) & 7;
+	u32 table = jsonHex(json, "table", 0) & ~7u;
+	// The pending bit array follows the table unless it is placed explicitly
+	u32 pba = jsonHex(json, "pba", (table + vectors * 16 + 7) & ~7u) & ~7u;
+
+	writew_le(cap + 2, vectors - 1);
+	writel_le(cap + 4, table | bir);
+	writel_le(cap + 8, pba | (jsonHex(json, "pba_bir", bir) & 7));
+	return 12;
+}
+
+static const struct
+{
+	const char* name;
+	u8 type;
+} portTypes[] = {
+	{ "endpoint", 0x0 },
+	{ "legacy_endpoint", 0x1 },
+	{ "root_port", 0x4 },
+	{ "upstream", 0x5 },
+	{ "downstream", 0x6 },
+	{ "pcie_to_pci", 0x7 },
+	{ "pci_to_pcie", 0x8 },
+	{ "integrated", 0x9 },
+	{ "root_event", 0xa },
+};
+
+static int fillPcie(const cJSON* json, u8* cap, int room)
+{
+	if (room < 0x3c)
+		return 0;
+
+	u8 portType = 0;
+	const char* portName = cJSON_GetStringValue(cJSON_GetObjectItem(json, "port_type"));
+	if (portName != NULL)
+	{
+		unsigned int i;
+		for (i = 0; i < sizeof(portTypes) / sizeof(portTypes[0]); ++i)
+		{
+			if (strcmp(portName, portTypes[i].name) == 0)
+				break;
+		}
+		if (i == sizeof(portTypes) / sizeof(portTypes[0]))
+		{
+			printf("Unknown PCIe port type %s\n", portName);
+			return 0;
+		}
+		portType = portTypes[i].type;
+	}
+
+	// "max_payload" in bytes (128 to 4096), "link_speed" as the generation, "link_width" in lanes
+	int payload = log2Ceiling(jsonHex(json, "max_payload", 0x100)) - 7;
+	u32 speed = jsonHex(json, "link_speed", 3);
+	u32 width = jsonHex(json, "link_width", 0x10);
+	if (payload < 0 || payload > 5 || speed < 1 || speed > 6 || width < 1 || width > 32)
+	{
+		printf("Bad PCIe payload, link speed or link width\n");
+		return 0;
+	}
+
+	writew_le(cap + 0x02, 0x0002 | (portType << 4));	// capability version 2
+	writel_le(cap + 0x04, payload | 0x8000);			// role based error reporting
+	writew_le(cap + 0x08, 0x2810);						// relaxed ordering, no snoop, 512 byte read requests
+	writel_le(cap + 0x0c, speed | (width << 4));
+	writew_le(cap + 0x12, speed | (width << 4));		// trained at full speed and width
+	writel_le(cap + 0x2c, ((1u << speed) - 1) << 1);	// supported link speeds vector
+	return 0x3c;
+}
+
+static int fillVendor(const cJSON* json, u8* cap, int room)
+{
+	int length = jsonData(json, cap + 3, room - 3);
+	if (length < 0 || 3 + length > 0xff)
+		return 0;
+	cap[2] = (u8)(3 + length);
+	return 3 + length;
+}
+
+static int fillAer(const cJSON* json, u8* cap, int room)
+{
+	if (room < 0x48)
+		return 0;
+	writel_le(cap + 0x0c, 0x00462030);		// default uncorrectable error severity
+	return 0x48;
+}
+
+static int fillSerialNumber(const cJSON* json, u8* cap, int room)
+{
+	if (room < 12)
+		return 0;
+	const char* serial = cJSON_GetStringValue(cJSON_GetObjectItem(json, "serial"));
+	unsigned long long value = serial != NULL ? strtoull(serial, NULL, 16) : 0;
+	writel_le(cap + 4, (u32)value);
+	writel_le(cap + 8, (u32)(value >> 32));
+	return 12;
+}
+
+static int fillLtr(const cJSON* json, u8* cap, int room)
+{
+	return room < 8 ? 0 : 8;
+}
+
+static int fillResizableBar(const cJSON* json, u8* cap, int room)
+{
+	if (room < 12)
+		return 0;
+	// "sizes" has bit n set when the bar supports 2^n MB, "current" is the programmed n
+	writel_le(cap + 4, (jsonHex(json, "sizes", 1) & 0xfffff) << 4);
+	writel_le(cap + 8, (jsonHex(json, "bar", 0) & 7) | (1 << 5) | ((jsonHex(json, "current", 0) & 0x1f) << 8));
+	return 12;
+}
+
+static int fillVendorExt(const cJSON* json, u8* cap, int room)
+{
+	if (room < 8)
+		return 0;
+	int length = jsonData(json, cap + 8, room - 8);
+	if (length < 0)
+		return 0;
+	writel_le(cap + 4, (jsonHex(json, "vsec_id", 0) & 0xffff) | ((jsonHex(json, "vsec_rev", 0) & 0xf) << 16) |
+						   ((u32)(8 + length) << 20));
+	return 8 + length;
+}
+
+// Capabilities without a type: "id" and the raw body in "data"
+static int fillRaw(const cJSON* json, u8* cap, int room)
+{
+	int header = jsonFlag(json, "extended", 0) ? 4 : 2;
+	if (room < header)
+		return 0;
+	int length = jsonData(json, cap + header, room - header);
+	return length < 0 ? 0 : header + length;
+}
+
+static const capabilityType capabilityTypes[] = {
+	{ "pm", PCI_CAP_ID_PM, 0, 0, fillPowerManagement },
+	{ "msi", PCI_CAP_ID_MSI, 0, 0, fillMsi },
+	{ "msix", PCI_CAP_ID_MSIX, 0, 0, fillMsix },
+	{ "pcie", PCI_CAP_ID_PCIE, 0, 0, fillPcie },
+	{ "vendor", PCI_CAP_ID_VENDOR, 0, 0, fillVendor },
+	{ "aer", PCI_EXT_CAP_ID_AER, 1, 2, fillAer },
+	{ "serial_number", PCI_EXT_CAP_ID_DSN, 1, 1, fillSerialNumber },
+	{ "ltr", PCI_EXT_CAP_ID_LTR, 1, 1, fillLtr },
+	{ "resizable_bar", PCI_EXT_CAP_ID_REBAR, 1, 1, fillResizableBar },
+	{ "vendor_extended", PCI_EXT_CAP_ID_VENDOR, 1, 1, fillVendorExt },
+};
+
+static int lookupType(const cJSON* entry, capabilityType* type)
+{
+	const char* name = cJSON_GetStringValue(cJSON_GetObjectItem(entry, "type"));
+	if (name == NULL)
+	{
+		if (cJSON_GetObjectItem(entry, "id") == NULL)
+		{
+			printf("Capability without a type or an id\n");
+			return 0;
+		}
+		type->name = "raw";
+		type->id = (u16)jsonHex(entry, "id", 0);
+		type->extended = (u8)jsonFlag(entry, "extended", 0);
+		type->version = (u8)jsonHex(entry, "version", 1);
+		type->fill = fillRaw;
+		return 1;
+	}
+
+	for (unsigned int i = 0; i < sizeof(capabilityTypes) / sizeof(capabilityTypes[0]); ++i)
+	{
+		if (strcmp(name, capabilityTypes[i].name) == 0)
+		{
+			*type = capabilityTypes[i];
+			return 1;
+		}
+	}
+	printf("Unknown capability type %s\n", name);
+	return 0;
+}
+
+// Declared capabilities replace any list already in the config, standard and extended separately
+int PCI_buildCapabilities(const cJSON* list, u8* config)
+{
+	const cJSON* entry = NULL;
+	capabilityType type;
+	int hasStandard = 0;
+	int hasExtended = 0;
+	cJSON_ArrayForEach(entry, list)
+	{
+		if (!lookupType(entry, &type))
+			return 0;
+		hasStandard |= !type.extended;
+		hasExtended |= type.extended;
+	}
+	if (hasStandard)
+	{
+		memset(config + PCI_CAPABILITY_START, 0, CAPABILITY_END - PCI_CAPABILITY_START);
+		config[PCI_CAPABILITY_POINTER] = 0;
+	}
+	if (hasExtended)
+		memset(config + PCI_EXT_CAPABILITY_START, 0, EXT_CAPABILITY_END - PCI_EXT_CAPABILITY_START);
+
+	int next = PCI_CAPABILITY_START;
+	int previous = 0;
+	int extNext = PCI_EXT_CAPABILITY_START;
+	int extPrevious = 0;
+	cJSON_ArrayForEach(entry, list)
+	{
+		lookupType(entry, &type);
+		int offset = type.extended ? extNext : next;
+		int room = (type.extended ? EXT_CAPABILITY_END : CAPABILITY_END) - offset;
+		int size = room > 0 ? type.fill(entry, config + offset, room) : 0;
+		if (size == 0)
+		{
+			printf("Capability %s does not fit in config space\n", type.name);
+			return 0;
+		}
+
+		if (type.extended)
+		{
+			// Header: id in 15:0, version in 19:16, next pointer in 31:20
+			writel_le(config + offset, type.id | ((u32)(type.version & 0xf) << 16));
+			if (extPrevious != 0)
+				writel_le(config + extPrevious, readl_le(config + extPrevious) | ((u32)offset << 20));
+			extPrevious = offset;
+			extNext = offset + ((size + 3) & ~3);
+		}
+		else
+		{
+			config[offset] = (u8)type.id;
+			config[offset + 1] = 0;
+			if (previous != 0)
+				config[previous + 1] = (u8)offset;
+			else
+				config[PCI_CAPABILITY_POINTER] = (u8)offset;
+			previous = offset;
+			next = offset + ((size + 3) & ~3);
+		}
+	}
+
+	if (hasStandard)
+		writew_le(config + STATUS_OFFSET, readw_le(config + STATUS_OFFSET) | STATUS_CAPABILITY_LIST);
+	return 1;
+}
+
+int PCI_findCapability(const u8* config, int id)
+{
+	if (!(readw_le(config + STATUS_OFFSET) & STATUS_CAPABILITY_LIST))
+		return 0;
+
+	int offset = config[PCI_CAPABILITY_POINTER] & ~3;
+	for (int count = 0; offset >= PCI_CAPABILITY_START && count < MAX_CAPABILITIES; ++count)
+	{
+		if (config[offset] == id)
+			return offset;
+		offset = config[offset + 1] & ~3;
+	}
+	return 0;
+}
+
+int PCI_findExtCapability(const u8* config, int id)
+{
+	int offset = PCI_EXT_CAPABILITY_START;
+	for (int count = 0; offset >= PCI_EXT_CAPABILITY_START && count < MAX_CAPABILITIES; ++count)
+	{
+		u32 header = readl_le(config + offset);
+		if (header == 0 || header == 0xffffffff)
+			return 0;
+		if ((header & 0xffff) == (u32)id)
+			return offset;
+		offset = (header >> 20) & ~3;
+	}
+	return 0;
+}
+
+static void setMask(u8* writable, u8* clearOnWrite, int offset, int size, u32 writableBits, u32 clearBits)
+{
+	for (int i = 0; i < size; ++i)
+	{
+		writable[offset + i] = (u8)(writableBits >> (i * 8));
+		clearOnWrite[offset + i] = (u8)(clearBits >> (i * 8));
+	}
+}
+
+void PCI_capabilityMasks(const u8* config, u8* writable, u8* clearOnWrite)
+{
+	int offset = config[PCI_CAPABILITY_POINTER] & ~3;
+	if (!(readw_le(config + STATUS_OFFSET) & STATUS_CAPABILITY_LIST))
+		offset = 0;
+	for (int count = 0; offset >= PCI_CAPABILITY_START && offset < CAPABILITY_END - 2 && count < MAX_CAPABILITIES; ++count)
+	{
+		setMask(writable, clearOnWrite, offset, 2, 0, 0);
+		switch (config[offset])
+		{
+		case PCI_CAP_ID_PM:
+			setMask(writable, clearOnWrite, offset + 2, 2, 0, 0);
+			setMask(writable, clearOnWrite, offset + 4, 2, 0x0103, 0x8000);	// power state, PME enable, PME status
+			break;
+		case PCI_CAP_ID_MSI:
+			setMask(writable, clearOnWrite, offset + 2, 2, 0x0071, 0);		// enable and multiple message enable
+			break;
+		case PCI_CAP_ID_MSIX:
+			setMask(writable, clearOnWrite, offset + 2, 2, 0xc000, 0);		// enable and function mask
+			setMask(writable, clearOnWrite, offset + 4, 8, 0, 0);
+			break;
+		case PCI_CAP_ID_PCIE:
+			setMask(writable, clearOnWrite, offset + 0x02, 6, 0, 0);			// capabilities and device capabilities
+			setMask(writable, clearOnWrite, offset + 0x0a, 2, 0, 0x000f);		// device status error bits
+			setMask(writable, clearOnWrite, offset + 0x0c, 4, 0, 0);			// link capabilities
+			setMask(writable, clearOnWrite, offset + 0x12, 2, 0, 0);			// link status
+			setMask(writable, clearOnWrite, offset + 0x24, 4, 0, 0);			// device capabilities 2
+			setMask(writable, clearOnWrite, offset + 0x2c, 4, 0, 0);			// link capabilities 2
+			break;
+		case PCI_CAP_ID_VENDOR:
+			writable[offset + 2] = 0;
+			break;
+		}
+		offset = config[offset + 1] & ~3;
+	}
+
+	offset = PCI_EXT_CAPABILITY_START;
+	for (int count = 0; offset >= PCI_EXT_CAPABILITY_START && offset < EXT_CAPABILITY_END - 4 && count < MAX_CAPABILITIES; ++count)
+	{
+		u32 header = readl_le(config + offset);
+		if (header == 0 || header == 0xffffffff)
+			break;
+		setMask(writable, clearOnWrite, offset, 4, 0, 0);
+		switch (header & 0xffff)
+		{
+		case PCI_EXT_CAP_ID_DSN:
+			setMask(writable, clearOnWrite, offset + 4, 8, 0, 0);
+			break;
+		case PCI_EXT_CAP_ID_AER:
+			setMask(writable, clearOnWrite, offset + 0x04, 4, 0, 0xffffffff);	// uncorrectable status
+			setMask(writable, clearOnWrite, offset + 0x10, 4, 0, 0xffffffff);	// correctable status
+			break;
+		case PCI_EXT_CAP_ID_REBAR:
+			setMask(writable, clearOnWrite, offset + 4, 4, 0, 0);
+			setMask(writable, clearOnWrite, offset + 8, 4, 0x1f00, 0);			// only the bar size is programmable
+			break;
+		case PCI_EXT_CAP_ID_VENDOR:
+			setMask(writable, clearOnWrite, offset + 4, 4, 0, 0);
+			break;
+		}
+		offset = (header >> 20) & ~3;
+	}
+}
@@ -0,0 +1,262 @@
+#include "include/pmm.h"
+#include "include/memmap.h"
+#include "biosemui.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PARAGRAPH 16
+
+// Room left below BE_STACK_TOP for the stack BE_int86 and BE_callRealMode set up
+#define STACK_RESERVE 0x2000
+// Above the interrupt table, the BIOS data area and the far call BE_callRealMode writes at 0x4000
+#define CONVENTIONAL_START 0x5000
+
+typedef struct pmmArena
+{
+	u32 start;
+	u32 end;
+} pmmArena;
+
+enum
+{
+	ARENA_CONVENTIONAL = 0,
+	ARENA_EXTENDED,
+	ARENAS
+};
+
+static BE_pmmBlock blocks[BE_PMM_MAX_BLOCKS];	// sorted by address
+static int blockCount;
+static pmmArena arenas[ARENAS];
+static int arenasValid;
+static u32 allocated;
+static u32 peak;
+
+void BE_pmmReset(void)
+{
+	blockCount = 0;
+	arenasValid = 0;
+	allocated = 0;
+	peak = 0;
+}
+
+// The arenas depend on the memory map, which is compiled after the BIOS is set up
+static void computeArenas(void)
+{
+	u32 top = BE_STACK_TOP;
+	u32 end = CONVENTIONAL_START;
+
+	top = top > CONVENTIONAL_START + STACK_RESERVE ? top - STACK_RESERVE : CONVENTIONAL_START;
+	while (end + BE_MEM_PAGE_SIZE <= top && _BE_memPages[end >> BE_MEM_PAGE_SHIFT].type == BE_MEM_RAM)
+		end += BE_MEM_PAGE_SIZE;
+	arenas[ARENA_CONVENTIONAL].start = CONVENTIONAL_START;
+	arenas[ARENA_CONVENTIONAL].end = end;
+
+	arenas[ARENA_EXTENDED].start = 0x100000;
+	arenas[ARENA_EXTENDED].end = M.mem_size > 0x100000 ? M.mem_size : 0x100000;
+	arenasValid = 1;
+}
+
+static u32 alignUp(u32 value, u32 alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static u32 powerOfTwo(u32 value)
+{
+	u32 power = PARAGRAPH;
+	while (power < value && power != 0x80000000)
+		power <<= 1;
+	return power;
+}
+
+/* First fit in one arena. Returns the block index to insert at, -1 when nothing fits */
+static int place(const pmmArena* arena, u32 size, u32 alignment, u32* address)
+{
+	u32 candidate = alignUp(arena->start, alignment);
+	int i = 0;
+
+	while (i < blockCount && blocks[i].address + blocks[i].size <= arena->start)
+		++i;
+	for (; i < blockCount && blocks[i].address < arena->end; ++i)
+	{
+		if (candidate + size <= blocks[i].address)
+			break;
+		if (blocks[i].address + blocks[i].size > candidate)
+			candidate = alignUp(blocks[i].address + blocks[i].size, alignment);
+	}
+	if (candidate < arena->start || candidate + size > arena->end || candidate + size < candidate)
+		return -1;
+	*address = candidate;
+	return i;
+}
+
+static u32 largestFree(const pmmArena* arena)
+{
+	u32 largest = 0;
+	u32 start = arena->start;
+
+	for (int i = 0; i <= blockCount; ++i)
+	{
+		u32 end = i < blockCount ? blocks[i].address : arena->end;
+		if (i < blockCount && (blocks[i].address < arena->start || blocks[i].address >= arena->end))
+			continue;
+		if (end > start && end - start > largest)
+			largest = end - start;
+		if (i < blockCount)
+			start = blocks[i].address + blocks[i].size;
+	}
+	return largest / PARAGRAPH;
+}
+
+u32 BE_pmmAllocate(u32 paragraphs, u32 handle, u16 flags)
+{
+	// Extended memory first, conventional memory is scarce
+	static const int order[] = { ARENA_EXTENDED, ARENA_CONVENTIONAL };
+	static const u16 arenaFlags[] = { BE_PMM_CONVENTIONAL, BE_PMM_EXTENDED };
+	u32 size = paragraphs * PARAGRAPH;
+	u32 alignment = PARAGRAPH;
+	u32 largest = 0;
+
+	if (!arenasValid)
+		computeArenas();
+	if (flags & BE_PMM_ALIGN)
+		alignment = powerOfTwo(size);
+
+	for (int o = 0; o < ARENAS; ++o)
+	{
+		int a = order[o];
+		u32 address;
+		int index;
+
+		if (!(flags & arenaFlags[a]))
+			continue;
+		if (paragraphs == 0)
+		{
+			u32 available = largestFree(&arenas[a]);
+			largest = available > largest ? available : largest;
+			continue;
+		}
+		if (paragraphs > 0x0FFFFFFF || blockCount == BE_PMM_MAX_BLOCKS)
+			return 0;
+		if ((index = place(&arenas[a], size, alignment, &address)) < 0)
+			continue;
+
+		memmove(&blocks[index + 1], &blocks[index], (blockCount - index) * sizeof(blocks[0]));
+		blocks[index].address = address;
+		blocks[index].size = size;
+		blocks[index].handle = handle;
+		++blockCount;
+		allocated += size;
+		if (allocated > peak)
+			peak = allocated;
+		return address;
+	}
+	return largest;
+}
+
+u32 BE_pmmFind(u32 handle)
+{
+	if (handle == BE_PMM_ANONYMOUS)
+		return 0;
+	for (int i = 0; i < blockCount; ++i)
+	{
+		if (blocks[i].handle == handle)
+			return blocks[i].address;
+	}
+	return 0;
+}
+
+u32 BE_pmmDeallocate(u32 address)
+{
+	for (int i = 0; i < blockCount; ++i)
+	{
+		if (blocks[i].address != address)
+			continue;
+		allocated -= blocks[i].size;
+		memmove(&blocks[i], &blocks[i + 1], (blockCount - i - 1) * sizeof(blocks[0]));
+		--blockCount;
+		return 0;
+	}
+	return 0xFFFFFFFF;
+}
+
+static void handleName(u32 handle, char* name)
+{
+	for (int i = 0; i < 4; ++i)
+	{
+		char c = (char)(handle >> (i * 8));
+		if (!isprint((unsigned char)c))
+		{
+			sprintf(name, "%08x", handle);
+			return;
+		}
+		name[i] = c;
+	}
+	name[4] = 0;
+}
+
+const BE_pmmBlock* BE_pmmGetBlock(int index)
+{
+	return index >= 0 && index < blockCount ? &blocks[index] : NULL;
+}
+
+u32 BE_pmmAllocated(void)
+{
+	return allocated;
+}
+
+u32 BE_pmmPeak(void)
+{
+	return peak;
+}
+
+void BE_pmmReport(void)
+{
+	char name[16];
+
+	printf("pmm: %u bytes allocated, %u peak, %d blocks\n", allocated, peak, blockCount);
+	for (int i = 0; i < blockCount; ++i)
+	{
+		if (blocks[i].handle == BE_PMM_ANONYMOUS)
+			strcpy(name, "-");
+		else
+			handleName(blocks[i].handle, name);
+		printf("  %08x %8u bytes  %s\n", blocks[i].address, blocks[i].size, name);
+	}
+}
+
+/****************************************************************************
+PARAMETERS:
+intno   - Interrupt number being serviced
+
+REMARKS:
+Reached through the stub behind the $PMM entry point. The caller far called
+the entry point with C calling convention, so SS:SP points at the return
+address, followed by the function number and its parameters. The result is
+returned in DX:AX.
+****************************************************************************/
+void X86API _BE_pmmService(int intno)
+{
+	u32 args = ((u32)M.x86.R_SS << 4) + M.x86.R_SP + 4;
+	u32 result;
+
+	switch (BE_rdw(args))
+	{
+	case 0:		/* pmmAllocate(length, handle, flags) */
+		result = BE_pmmAllocate(BE_rdl(args + 2), BE_rdl(args + 6), BE_rdw(args + 10));
+		break;
+	case 1:		/* pmmFind(handle) */
+		result = BE_pmmFind(BE_rdl(args + 2));
+		break;
+	case 2:		/* pmmDeallocate(buffer) */
+		result = BE_pmmDeallocate(BE_rdl(args + 2));
+		break;
+	default:
+		result = 0xFFFFFFFF;
+		break;
+	}
+	M.x86.R_AX = (u16)result;
+	M.x86.R_DX = (u16)(result >> 16);
+}
@@ -0,0 +1,180 @@
+#include "include/services.h"
+#include "biosemui.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static BE_service services[BE_SERVICE_MAX];
+static BE_service* vectors[256];
+static u64 unhandled[256];
+
+static void unlinkService(BE_service* service)
+{
+	BE_service** link = &vectors[service->intno];
+	while (*link != service)
+		link = &(*link)->next;
+	*link = service->next;
+}
+
+/* Keeps each vector's list ordered from the most to the least specific mask */
+static void linkService(BE_service* service)
+{
+	BE_service** link = &vectors[service->intno];
+	while (*link != NULL && (*link)->mask >= service->mask)
+		link = &(*link)->next;
+	service->next = *link;
+	*link = service;
+}
+
+int BE_serviceRegister(int intno, u16 mask, u16 value, int flags, X86EMU_intrFuncs func, const char* name)
+{
+	BE_service* slot = NULL;
+
+	if (intno < 0 || intno > 255 || func == NULL || (value & ~mask) != 0)
+	{
+		printf("BE_serviceRegister: bad service %02x/%04x:%04x\n", intno, mask, value);
+		return -1;
+	}
+
+	for (int i = 0; i < BE_SERVICE_MAX; ++i)
+	{
+		BE_service* service = &services[i];
+		if (service->inUse && service->intno == intno && service->mask == mask && service->value == value)
+		{
+			service->flags = flags;
+			service->func = func;
+			service->name = name;
+			return i;
+		}
+		if (!service->inUse && slot == NULL)
+			slot = service;
+	}
+
+	if (slot == NULL)
+	{
+		printf("BE_serviceRegister: more than %d services\n", BE_SERVICE_MAX);
+		return -1;
+	}
+
+	slot->intno = intno;
+	slot->mask = mask;
+	slot->value = value;
+	slot->flags = flags;
+	slot->func = func;
+	slot->name = name;
+	slot->calls = 0;
+	slot->nanoseconds = 0;
+	slot->inUse = 1;
+	linkService(slot);
+	return (int)(slot - services);
+}
+
+void BE_serviceRemove(int handle)
+{
+	if (handle < 0 || handle >= BE_SERVICE_MAX || !services[handle].inUse)
+		return;
+	unlinkService(&services[handle]);
+	services[handle].inUse = 0;
+}
+
+const BE_service* BE_serviceGet(int handle)
+{
+	if (handle < 0 || handle >= BE_SERVICE_MAX || !services[handle].inUse)
+		return NULL;
+	return &services[handle];
+}
+
+u64 BE_serviceUnhandled(int intno)
+{
+	return unhandled[intno & 0xFF];
+}
+
+void BE_serviceResetStats(void)
+{
+	for (int i = 0; i < BE_SERVICE_MAX; ++i)
+	{
+		services[i].calls = 0;
+		services[i].nanoseconds = 0;
+	}
+	memset(unhandled, 0, sizeof(unhandled));
+}
+
+static u64 now(void)
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (u64)time.tv_sec * 1000000000ull + time.tv_nsec;
+}
+
+/****************************************************************************
+PARAMETERS:
+intno   - Interrupt number being serviced
+
+REMARKS:
+Installed for every vector by _BE_bios_init. Runs the matching service, or
+lets the real mode handler run when a ROM has hooked the vector.
+****************************************************************************/
+void X86API _BE_serviceDispatch(int intno)
+{
+	int hooked = BE_rdw(intno * 4 + 2) != BIOS_SEG;
+
+	for (BE_service* service = vectors[intno]; service != NULL; service = service->next)
+	{
+		if ((M.x86.R_AX & service->mask) != service->value)
+			continue;
+		if (hooked && !(service->flags & BE_SERVICE_ALWAYS))
+			break;
+
+		u64 start = now();
+		service->func(intno);
+		service->nanoseconds += now() - start;
+		++service->calls;
+		return;
+	}
+
+	if (hooked)
+	{
+		X86EMU_prepareForInt(intno);
+		return;
+	}
+
+	++unhandled[intno];
+	DB(printf("biosEmu: undefined interrupt %xh called!\n", intno);)
+}
+
+static int byTime(const void* a, const void* b)
+{
+	const BE_service* left = *(const BE_service* const*)a;
+	const BE_service* right = *(const BE_service* const*)b;
+	if (left->nanoseconds != right->nanoseconds)
+		return left->nanoseconds < right->nanoseconds ? 1 : -1;
+	return left->calls < right->calls ? 1 : left->calls > right->calls ? -1 : 0;
+}
+
+void BE_serviceReport(void)
+{
+	const BE_service* called[BE_SERVICE_MAX];
+	int count = 0;
+
+	for (int i = 0; i < BE_SERVICE_MAX; ++i)
+	{
+		if (services[i].inUse && services[i].calls != 0)
+			called[count++] = &services[i];
+	}
+	qsort(called, count, sizeof(called[0]), byTime);
+
+	printf("interrupt services:\n");
+	for (int i = 0; i < count; ++i)
+	{
+		const BE_service* service = called[i];
+		printf("  int %02Xh %04X/%04X %-24s %10llu calls %12llu ns\n", service->intno, service->value, service->mask,
+			   service->name ? service->name : "", service->calls, service->nanoseconds);
+	}
+	for (int i = 0; i < 256; ++i)
+	{
+		if (unhandled[i] != 0)
+			printf("  int %02Xh unhandled %22s %10llu calls\n", i, "", unhandled[i]);
+	}
+}
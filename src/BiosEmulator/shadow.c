@@ -0,0 +1,298 @@
+#include "include/shadow.h"
+#include "include/mmio.h"
+#include "biosemui.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CHUNK_SIZE (1u << BE_SHADOW_CHUNK_SHIFT)
+#define CHUNK_WORDS (CHUNK_SIZE / 64)
+
+// The interrupt vector table and BIOS data area are filled in by _BE_bios_init
+#define LOADER_INIT_END 0x600
+
+int _BE_shadowEnabled = 0;
+
+static u64* shadowChunks[BE_SHADOW_CHUNKS];
+static BE_shadowSite sites[BE_SHADOW_MAX_SITES];
+static u32 droppedReads;
+
+static u64 wordMask(u32 shift, u32 bits)
+{
+	return (bits == 64 ? ~0ull : ((1ull << bits) - 1)) << shift;
+}
+
+// Finds the first clear bit in [bit, bit + count) of a chunk, a 64 bit word at a time
+static int chunkFindClear(const u64* chunk, u32 bit, u32 count, u32* firstBit)
+{
+	while (count != 0)
+	{
+		u32 shift = bit & 63;
+		u32 bits = 64 - shift < count ? 64 - shift : count;
+		u64 missing = ~chunk[bit >> 6] & wordMask(shift, bits);
+		if (missing != 0)
+		{
+			*firstBit = (bit & ~63u) + __builtin_ctzll(missing);
+			return 1;
+		}
+		bit += bits;
+		count -= bits;
+	}
+	return 0;
+}
+
+static void chunkSet(u64* chunk, u32 bit, u32 count, int value)
+{
+	while (count != 0)
+	{
+		u32 shift = bit & 63;
+		u32 bits = 64 - shift < count ? 64 - shift : count;
+		if (value)
+			chunk[bit >> 6] |= wordMask(shift, bits);
+		else
+			chunk[bit >> 6] &= ~wordMask(shift, bits);
+		bit += bits;
+		count -= bits;
+	}
+}
+
+// Starts tracking [base, base + size) as uninitialized. Untracked bytes sharing
+// a chunk with it count as initialized so they never report.
+int BE_shadowTrack(u32 base, u32 size)
+{
+	u32 addr = base;
+	u32 left = size;
+	while (left != 0)
+	{
+		u32 index = addr >> BE_SHADOW_CHUNK_SHIFT;
+		u32 offset = addr & (CHUNK_SIZE - 1);
+		u32 bits = CHUNK_SIZE - offset < left ? CHUNK_SIZE - offset : left;
+
+		if (shadowChunks[index] == NULL)
+		{
+			shadowChunks[index] = malloc(CHUNK_WORDS * sizeof(u64));
+			if (shadowChunks[index] == NULL)
+			{
+				printf("BE_shadowTrack: out of memory\n");
+				return 0;
+			}
+			memset(shadowChunks[index], 0xff, CHUNK_WORDS * sizeof(u64));
+		}
+		chunkSet(shadowChunks[index], offset, bits, 0);
+		for (u32 page = addr >> 12; page <= (addr + bits - 1) >> 12; ++page)
+			_X86EMU_pageFlags[page] |= BE_PAGE_SHADOW;
+
+		addr += bits;
+		left -= bits;
+	}
+	return 1;
+}
+
+static int testBit(u32 addr)
+{
+	const u64* chunk = shadowChunks[addr >> BE_SHADOW_CHUNK_SHIFT];
+	u32 offset = addr & (CHUNK_SIZE - 1);
+	return chunk == NULL || ((chunk[offset >> 6] >> (offset & 63)) & 1);
+}
+
+static int trackedRegion(const BE_mmioRegion* region)
+{
+	return region->backing != NULL && region->read == NULL && region->write == NULL;
+}
+
+// The bits of a tracked BAR follow its backing memory when the guest moves it, and
+// its old range counts as initialized once nothing is mapped there anymore
+static void regionMoved(const BE_mmioRegion* region, u32 oldBase)
+{
+	if (!_BE_shadowEnabled || !trackedRegion(region))
+		return;
+
+	u64* saved = NULL;
+	if (region->inUse)
+	{
+		saved = calloc((region->size + 63) / 64, sizeof(u64));
+		if (saved == NULL)
+		{
+			printf("BE_shadow: out of memory\n");
+			return;
+		}
+		for (u32 i = 0; i < region->size; ++i)
+			saved[i >> 6] |= (u64)testBit(oldBase + i) << (i & 63);
+	}
+
+	BE_shadowMarkRange(oldBase, region->size);
+	if (saved != NULL && BE_shadowTrack(region->base, region->size))
+	{
+		for (u32 i = 0; i < region->size; ++i)
+		{
+			if ((saved[i >> 6] >> (i & 63)) & 1)
+				BE_shadowMarkRange(region->base + i, 1);
+		}
+	}
+	free(saved);
+}
+
+// Tracks guest RAM and every writable host backed MMIO region (the BARs)
+int BE_shadowEnable(void)
+{
+	BE_shadowDisable();
+
+	u32 lowEnd = M.mem_size < 0xA0000 ? M.mem_size : 0xA0000;
+	int ok = BE_shadowTrack(0, lowEnd);
+	if (ok && M.mem_size > 0x100000)
+		ok = BE_shadowTrack(0x100000, M.mem_size - 0x100000);
+
+	for (int i = 0; ok && i < BE_MMIO_MAX_REGIONS; ++i)
+	{
+		BE_mmioRegion* region = BE_mmioGet(i);
+		if (region != NULL && trackedRegion(region))
+			ok = BE_shadowTrack(region->base, region->size);
+	}
+
+	if (!ok)
+	{
+		BE_shadowDisable();
+		return 0;
+	}
+
+	BE_shadowMarkRange(0, LOADER_INIT_END);
+	BE_mmioSetMoveHandler(regionMoved);
+	_BE_shadowEnabled = 1;
+	return 1;
+}
+
+void BE_shadowDisable(void)
+{
+	_BE_shadowEnabled = 0;
+	for (u32 i = 0; i < BE_SHADOW_CHUNKS; ++i)
+	{
+		if (shadowChunks[i] == NULL)
+			continue;
+		for (u32 page = 0; page < CHUNK_SIZE >> 12; ++page)
+			_X86EMU_pageFlags[(i << (BE_SHADOW_CHUNK_SHIFT - 12)) + page] &= ~BE_PAGE_SHADOW;
+		free(shadowChunks[i]);
+		shadowChunks[i] = NULL;
+	}
+	memset(sites, 0, sizeof(sites));
+	droppedReads = 0;
+}
+
+void BE_shadowMarkRange(u32 addr, u32 size)
+{
+	while (size != 0)
+	{
+		u32 offset = addr & (CHUNK_SIZE - 1);
+		u32 bits = CHUNK_SIZE - offset < size ? CHUNK_SIZE - offset : size;
+		u64* chunk = shadowChunks[addr >> BE_SHADOW_CHUNK_SHIFT];
+		if (chunk != NULL)
+			chunkSet(chunk, offset, bits, 1);
+		addr += bits;
+		size -= bits;
+	}
+}
+
+// Finds the first tracked byte in [addr, addr + size) that was never written
+int BE_shadowFindUninit(u32 addr, u32 size, u32* first)
+{
+	while (size != 0)
+	{
+		u32 offset = addr & (CHUNK_SIZE - 1);
+		u32 bits = CHUNK_SIZE - offset < size ? CHUNK_SIZE - offset : size;
+		const u64* chunk = shadowChunks[addr >> BE_SHADOW_CHUNK_SHIFT];
+		u32 firstBit;
+		if (chunk != NULL && chunkFindClear(chunk, offset, bits, &firstBit))
+		{
+			*first = (addr & ~(CHUNK_SIZE - 1)) + firstBit;
+			return 1;
+		}
+		addr += bits;
+		size -= bits;
+	}
+	return 0;
+}
+
+static void recordSite(u32 addr)
+{
+	u32 key = ((u32)M.x86.saved_cs << 16) | M.x86.saved_ip;
+	u32 slot = (key * 0x9E3779B1u) >> (32 - BE_SHADOW_SITE_BITS);
+
+	for (int probe = 0; probe < BE_SHADOW_MAX_SITES; ++probe)
+	{
+		BE_shadowSite* site = &sites[(slot + probe) & (BE_SHADOW_MAX_SITES - 1)];
+		if (!site->inUse)
+		{
+			site->cs = M.x86.saved_cs;
+			site->ip = M.x86.saved_ip;
+			site->firstAddr = addr;
+			site->inUse = 1;
+		}
+		else if (site->cs != M.x86.saved_cs || site->ip != M.x86.saved_ip)
+			continue;
+		++site->count;
+		return;
+	}
+	++droppedReads;
+}
+
+void BE_shadowRead(u32 addr, int size)
+{
+	const u64* chunk = shadowChunks[addr >> BE_SHADOW_CHUNK_SHIFT];
+	u32 offset = addr & (CHUNK_SIZE - 1);
+	u32 first;
+
+	// Common case: the access sits in one bitmap word, so it is a single masked test
+	if (chunk != NULL && (offset & 63) + size <= 64)
+	{
+		if ((~chunk[offset >> 6] & wordMask(offset & 63, size)) == 0)
+			return;
+	}
+	else if (chunk == NULL && (offset + size) <= CHUNK_SIZE)
+		return;
+
+	if (BE_shadowFindUninit(addr, size, &first))
+		recordSite(first);
+}
+
+// Sites in hash order, NULL for a free slot
+const BE_shadowSite* BE_shadowGetSite(int index)
+{
+	if (index < 0 || index >= BE_SHADOW_MAX_SITES || !sites[index].inUse)
+		return NULL;
+	return &sites[index];
+}
+
+u32 BE_shadowDroppedReads(void)
+{
+	return droppedReads;
+}
+
+static int compareSites(const void* a, const void* b)
+{
+	const BE_shadowSite* left = a;
+	const BE_shadowSite* right = b;
+	if (left->count != right->count)
+		return left->count < right->count ? 1 : -1;
+	return 0;
+}
+
+// Prints every code location that read uninitialized memory, busiest first
+void BE_shadowReport(void)
+{
+	BE_shadowSite sorted[BE_SHADOW_MAX_SITES];
+	int count = 0;
+
+	for (int i = 0; i < BE_SHADOW_MAX_SITES; ++i)
+	{
+		if (sites[i].inUse)
+			sorted[count++] = sites[i];
+	}
+	qsort(sorted, count, sizeof(sorted[0]), compareSites);
+
+	printf("Uninitialized reads: %d sites\n", count);
+	for (int i = 0; i < count; ++i)
+		printf("  %04x:%04x %8u reads, first at %08x\n", sorted[i].cs, sorted[i].ip, sorted[i].count,
+			   sorted[i].firstAddr);
+	if (droppedReads != 0)
+		printf("  %u reads from further sites not recorded\n", droppedReads);
+}
@@ -0,0 +1,809 @@
+#include "include/vbe.h"
+#include "biosemui.h"
+
+#include <string.h>
+#include <stdio.h>
+
+// Offsets in the VbeInfoBlock
+#define INFO_VERSION 0x04
+#define INFO_OEM_STRING 0x06
+#define INFO_CAPABILITIES 0x0A
+#define INFO_MODE_LIST 0x0E
+#define INFO_TOTAL_MEMORY 0x12
+#define INFO_OEM_REVISION 0x14
+#define INFO_VENDOR_NAME 0x16
+#define INFO_PRODUCT_NAME 0x1A
+#define INFO_PRODUCT_REVISION 0x1E
+#define INFO_RESERVED 0x22
+#define INFO_OEM_DATA 0x100
+
+// Offsets in the ModeInfoBlock
+#define MODE_ATTRIBUTES 0x00
+#define MODE_BYTES_PER_LINE 0x10
+#define MODE_WIDTH 0x12
+#define MODE_HEIGHT 0x14
+#define MODE_BITS_PER_PIXEL 0x19
+#define MODE_MEMORY_MODEL 0x1B
+#define MODE_FRAMEBUFFER 0x28
+
+#define MODE_NUMBER_MASK 0x3FFF
+#define MODE_LINEAR 0x4000
+#define MODE_DONT_CLEAR 0x8000
+
+#define WINDOW_GRANULARITY (64 * 1024)
+
+// Halt the ROM handler returns to when a checked int 10h runs it, past the far call at 0x4000
+#define NESTED_RETURN 0x4008
+#define STRING_SIZE 64
+
+typedef struct vbeMode
+{
+	u16 mode;
+	u8 info[BE_VBE_MODE_INFO_SIZE];
+} vbeMode;
+
+// What the ROM reported for 4F00, 4F01 and 4F15
+static struct
+{
+	int valid;
+	u16 version;
+	u32 capabilities;
+	u16 totalMemory;		// in 64KB blocks
+	u16 oemRevision;
+	char oem[STRING_SIZE];
+	char vendor[STRING_SIZE];
+	char product[STRING_SIZE];
+	char revision[STRING_SIZE];
+	vbeMode modes[BE_VBE_MAX_MODES];
+	int modeCount;
+	int edidValid;
+	u8 edid[BE_VBE_EDID_SIZE];
+} rom;
+
+// Host fallback when the ROM has not been harvested
+static const struct
+{
+	u16 mode;
+	u16 width;
+	u16 height;
+	u8 bitsPerPixel;
+} standardModes[] = {
+	{ 0x100, 640, 400, 8 }, { 0x101, 640, 480, 8 }, { 0x103, 800, 600, 8 },
+	{ 0x105, 1024, 768, 8 }, { 0x107, 1280, 1024, 8 },
+	{ 0x110, 640, 480, 15 }, { 0x111, 640, 480, 16 }, { 0x112, 640, 480, 24 },
+	{ 0x113, 800, 600, 15 }, { 0x114, 800, 600, 16 }, { 0x115, 800, 600, 24 },
+	{ 0x116, 1024, 768, 15 }, { 0x117, 1024, 768, 16 }, { 0x118, 1024, 768, 24 },
+	{ 0x119, 1280, 1024, 15 }, { 0x11A, 1280, 1024, 16 }, { 0x11B, 1280, 1024, 24 },
+};
+
+#define STANDARD_MODES (int)(sizeof(standardModes) / sizeof(standardModes[0]))
+
+static BE_vbePath vbePath = BE_VBE_ROM;
+static u32 hostMemory = 16 * 1024 * 1024;
+static u32 framebufferBase = 0xE0000000;
+static u8 hostEdid[BE_VBE_EDID_SIZE];
+
+static u16 currentMode = 0x03;
+static u16 windows[2];
+static u8 palette[256][4];
+static u32 mismatches;
+
+static const char* const pathNames[] = { "rom", "fast", "checked" };
+
+void BE_vbeSetPath(BE_vbePath path)
+{
+	vbePath = path;
+}
+
+BE_vbePath BE_vbeGetPath(void)
+{
+	return vbePath;
+}
+
+int BE_vbeParsePath(const char* name, BE_vbePath* path)
+{
+	for (int i = 0; i < 3; ++i)
+	{
+		if (name != NULL && strcmp(name, pathNames[i]) == 0)
+		{
+			*path = (BE_vbePath)i;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void BE_vbeSetMemory(u32 totalMemory, u32 framebuffer)
+{
+	hostMemory = totalMemory;
+	framebufferBase = framebuffer;
+}
+
+u32 BE_vbeMismatches(void)
+{
+	return mismatches;
+}
+
+static u32 totalMemory(void)
+{
+	return rom.valid ? (u32)rom.totalMemory * 64 * 1024 : hostMemory;
+}
+
+static void put16(u8* p, u16 v)
+{
+	p[0] = (u8)v;
+	p[1] = (u8)(v >> 8);
+}
+
+static void put32(u8* p, u32 v)
+{
+	put16(p, (u16)v);
+	put16(p + 2, (u16)(v >> 16));
+}
+
+static u16 get16(const u8* p)
+{
+	return (u16)(p[0] | (p[1] << 8));
+}
+
+static u32 get32(const u8* p)
+{
+	return get16(p) | ((u32)get16(p + 2) << 16);
+}
+
+static u32 guestAddress(const RMREGS* regs, const RMSREGS* sregs)
+{
+	return ((u32)sregs->es << 4) + regs->x.di;
+}
+
+static void copyToGuest(u32 addr, const u8* data, int length)
+{
+	for (int i = 0; i < length; ++i)
+		BE_wrb(addr + i, data[i]);
+}
+
+static void copyFromGuest(u32 addr, u8* data, int length)
+{
+	for (int i = 0; i < length; ++i)
+		data[i] = BE_rdb(addr + i);
+}
+
+static u32 farToLinear(u32 pointer)
+{
+	return ((pointer >> 16) << 4) + (pointer & 0xFFFF);
+}
+
+static void readGuestString(u32 pointer, char* string)
+{
+	int i = 0;
+	if (pointer != 0)
+	{
+		u32 addr = farToLinear(pointer);
+		for (; i < STRING_SIZE - 1; ++i)
+		{
+			string[i] = (char)BE_rdb(addr + i);
+			if (string[i] == 0)
+				break;
+		}
+	}
+	string[i] = 0;
+}
+
+/* EDID 1.3 of a 1024x768 flat panel, the host answer to 4F15 */
+static void buildEdid(u8* edid)
+{
+	static const u8 header[8] = { 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00 };
+	static const u8 chromaticity[10] = { 0xEE, 0x91, 0xA3, 0x54, 0x4C, 0x99, 0x26, 0x0F, 0x50, 0x54 };
+	// 1024x768@60: 65MHz, 320 pixels horizontal blanking, 38 lines vertical blanking, 340x270mm
+	static const u8 timing[18] = { 0x64, 0x19, 0x00, 0x40, 0x41, 0x00, 0x26, 0x30, 0x18, 0x88, 0x36, 0x00,
+								   0x54, 0x0E, 0x11, 0x00, 0x00, 0x18 };
+	static const u8 name[18] = { 0x00, 0x00, 0x00, 0xFC, 0x00, 'B', 'i', 'o', 's', 'A', 'n', 'a', 'l', 'y', 'z', 'e', 'r', '\n' };
+	// 50-75Hz vertical, 30-81kHz horizontal, 80MHz maximum pixel clock
+	static const u8 limits[18] = { 0x00, 0x00, 0x00, 0xFD, 0x00, 0x32, 0x4B, 0x1E, 0x51, 0x08, 0x00, 0x0A,
+								   0x20, 0x20, 0x20, 0x20, 0x20, 0x20 };
+	u16 manufacturer = (('B' - '@') << 10) | (('A' - '@') << 5) | ('E' - '@');
+	u8 sum = 0;
+
+	memset(edid, 0, BE_VBE_EDID_SIZE);
+	memcpy(edid, header, sizeof(header));
+	edid[8] = (u8)(manufacturer >> 8);		// big endian, unlike the rest
+	edid[9] = (u8)manufacturer;
+	put16(edid + 10, 0x0001);
+	edid[16] = 1;			// week
+	edid[17] = 30;			// 2020
+	edid[18] = 1;
+	edid[19] = 3;
+	edid[20] = 0x80;		// digital input
+	edid[21] = 34;
+	edid[22] = 27;
+	edid[23] = 120;			// gamma 2.2
+	edid[24] = 0x0A;		// RGB, preferred timing in the first descriptor
+	memcpy(edid + 25, chromaticity, sizeof(chromaticity));
+	edid[35] = 0x21;		// 640x480@60, 800x600@60
+	edid[36] = 0x08;		// 1024x768@60
+	for (int i = 38; i < 54; ++i)
+		edid[i] = 0x01;		// unused standard timings
+	memcpy(edid + 54, timing, sizeof(timing));
+	memcpy(edid + 72, name, sizeof(name));
+	memcpy(edid + 90, limits, sizeof(limits));
+	edid[111] = 0x10;		// dummy descriptor
+
+	for (int i = 0; i < BE_VBE_EDID_SIZE - 1; ++i)
+		sum += edid[i];
+	edid[BE_VBE_EDID_SIZE - 1] = (u8)-sum;
+}
+
+void BE_vbeReset(void)
+{
+	memset(&rom, 0, sizeof(rom));
+	memset(palette, 0, sizeof(palette));
+	memset(windows, 0, sizeof(windows));
+	currentMode = 0x03;
+	mismatches = 0;
+	buildEdid(hostEdid);
+}
+
+static int standardModeFits(int i)
+{
+	int bytesPerPixel = (standardModes[i].bitsPerPixel + 7) / 8;
+	return (u32)standardModes[i].width * bytesPerPixel * standardModes[i].height <= hostMemory;
+}
+
+static void buildModeInfo(int i, u8* info)
+{
+	static const u8 masks[3][8] = {
+		{ 5, 10, 5, 5, 5, 0, 1, 15 },	// 15 bit
+		{ 5, 11, 6, 5, 5, 0, 0, 0 },	// 16 bit
+		{ 8, 16, 8, 8, 8, 0, 0, 0 },	// 24 bit
+	};
+	int bitsPerPixel = standardModes[i].bitsPerPixel;
+	u16 pitch = (u16)(standardModes[i].width * ((bitsPerPixel + 7) / 8));
+	u32 pageSize = (u32)pitch * standardModes[i].height;
+
+	memset(info, 0, BE_VBE_MODE_INFO_SIZE);
+	put16(info + MODE_ATTRIBUTES, 0x009B);	// supported, color, graphics, linear framebuffer
+	info[0x02] = 0x07;						// window A relocatable, readable, writable
+	put16(info + 0x04, WINDOW_GRANULARITY / 1024);
+	put16(info + 0x06, WINDOW_GRANULARITY / 1024);
+	put16(info + 0x08, 0xA000);
+	put16(info + MODE_BYTES_PER_LINE, pitch);
+	put16(info + MODE_WIDTH, standardModes[i].width);
+	put16(info + MODE_HEIGHT, standardModes[i].height);
+	info[0x16] = 8;
+	info[0x17] = 16;
+	info[0x18] = 1;
+	info[MODE_BITS_PER_PIXEL] = (u8)bitsPerPixel;
+	info[0x1A] = 1;
+	info[MODE_MEMORY_MODEL] = bitsPerPixel == 8 ? 4 : 6;	// packed pixel or direct color
+	info[0x1D] = (u8)(hostMemory / pageSize - 1);
+	info[0x1E] = 1;
+	if (bitsPerPixel > 8)
+		memcpy(info + 0x1F, masks[bitsPerPixel == 15 ? 0 : bitsPerPixel == 16 ? 1 : 2], 8);
+	put32(info + MODE_FRAMEBUFFER, framebufferBase);
+	put16(info + 0x32, pitch);
+}
+
+/* Mode block of mode, from the ROM when harvested. Returns 0 for unknown modes */
+static int findModeInfo(u16 mode, u8* info)
+{
+	if (rom.valid)
+	{
+		for (int i = 0; i < rom.modeCount; ++i)
+		{
+			if (rom.modes[i].mode == mode)
+			{
+				memcpy(info, rom.modes[i].info, BE_VBE_MODE_INFO_SIZE);
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	for (int i = 0; i < STANDARD_MODES; ++i)
+	{
+		if (standardModes[i].mode == mode && standardModeFits(i))
+		{
+			buildModeInfo(i, info);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int modeList(u16* modes)
+{
+	int count = 0;
+	if (rom.valid)
+	{
+		for (; count < rom.modeCount; ++count)
+			modes[count] = rom.modes[count].mode;
+		return count;
+	}
+
+	for (int i = 0; i < STANDARD_MODES; ++i)
+	{
+		if (standardModeFits(i))
+			modes[count++] = standardModes[i].mode;
+	}
+	return count;
+}
+
+static int putString(u8* block, int offset, int end, const char* string, u32 base, u32* pointer)
+{
+	int length = (int)strlen(string) + 1;
+	if (offset + length > end)
+	{
+		*pointer = 0;
+		return offset;
+	}
+	memcpy(block + offset, string, length);
+	*pointer = base + offset;
+	return offset + length;
+}
+
+static int getControllerInfo(RMREGS* regs, RMSREGS* sregs)
+{
+	u8 block[BE_VBE_INFO_SIZE];
+	u16 modes[BE_VBE_MAX_MODES];
+	u32 addr = guestAddress(regs, sregs);
+	u32 base = ((u32)sregs->es << 16) + regs->x.di;
+	u32 pointer;
+	int vbe2 = BE_rdl(addr) == 0x32454256;	// "VBE2"
+	int length = vbe2 ? BE_VBE_INFO_SIZE : BE_VBE_INFO_SIZE / 2;
+	int count = modeList(modes);
+	int offset;
+
+	// The mode list and the strings go in the reserved and OEM areas of the block itself
+	memset(block, 0, sizeof(block));
+	memcpy(block, "VESA", 4);
+	put16(block + INFO_VERSION, rom.valid ? rom.version : 0x0300);
+	put32(block + INFO_CAPABILITIES, rom.valid ? rom.capabilities : 0);
+	put16(block + INFO_TOTAL_MEMORY, (u16)(totalMemory() / (64 * 1024)));
+	put16(block + INFO_OEM_REVISION, rom.valid ? rom.oemRevision : 0x0100);
+	for (int i = 0; i < count; ++i)
+		put16(block + INFO_RESERVED + i * 2, modes[i]);
+	put16(block + INFO_RESERVED + count * 2, 0xFFFF);
+	put32(block + INFO_MODE_LIST, base + INFO_RESERVED);
+
+	offset = vbe2 ? INFO_OEM_DATA : INFO_RESERVED + (count + 1) * 2;
+	offset = putString(block, offset, length, rom.valid ? rom.oem : "BiosAnalyzer VBE", base, &pointer);
+	put32(block + INFO_OEM_STRING, pointer);
+	if (vbe2)
+	{
+		offset = putString(block, offset, length, rom.valid ? rom.vendor : "BiosAnalyzer", base, &pointer);
+		put32(block + INFO_VENDOR_NAME, pointer);
+		offset = putString(block, offset, length, rom.valid ? rom.product : "Emulated display", base, &pointer);
+		put32(block + INFO_PRODUCT_NAME, pointer);
+		offset = putString(block, offset, length, rom.valid ? rom.revision : "1.0", base, &pointer);
+		put32(block + INFO_PRODUCT_REVISION, pointer);
+	}
+
+	copyToGuest(addr, block, length);
+	return BE_VBE_SUCCESS;
+}
+
+static int getModeInfo(RMREGS* regs, RMSREGS* sregs)
+{
+	u8 info[BE_VBE_MODE_INFO_SIZE];
+
+	if (!findModeInfo(regs->x.cx & MODE_NUMBER_MASK, info))
+		return BE_VBE_FAILED;
+
+	copyToGuest(guestAddress(regs, sregs), info, sizeof(info));
+	return BE_VBE_SUCCESS;
+}
+
+static int setMode(RMREGS* regs)
+{
+	u8 info[BE_VBE_MODE_INFO_SIZE];
+	u16 mode = regs->x.bx & MODE_NUMBER_MASK;
+
+	// VGA modes are accepted as is, VESA modes have to be in the mode list
+	if (mode >= 0x100 && !findModeInfo(mode, info))
+		return BE_VBE_FAILED;
+	if ((regs->x.bx & MODE_LINEAR) && (mode < 0x100 || !(get16(info + MODE_ATTRIBUTES) & 0x80)))
+		return BE_VBE_FAILED;
+
+	currentMode = regs->x.bx & ~MODE_DONT_CLEAR;
+	windows[0] = windows[1] = 0;
+	return BE_VBE_SUCCESS;
+}
+
+static int windowControl(RMREGS* regs)
+{
+	int window = regs->h.bl;
+
+	if (window > 1)
+		return BE_VBE_FAILED;
+	if (currentMode & MODE_LINEAR)
+		return BE_VBE_INVALID_IN_MODE;
+
+	switch (regs->h.bh)
+	{
+	case 0:
+		if ((u32)regs->x.dx * WINDOW_GRANULARITY >= totalMemory())
+			return BE_VBE_FAILED;
+		windows[window] = regs->x.dx;
+		return BE_VBE_SUCCESS;
+	case 1:
+		regs->x.dx = windows[window];
+		return BE_VBE_SUCCESS;
+	default:
+		return BE_VBE_FAILED;
+	}
+}
+
+static int paletteData(RMREGS* regs, RMSREGS* sregs)
+{
+	u32 addr = guestAddress(regs, sregs);
+	int first = regs->x.dx;
+	int count = regs->x.cx;
+
+	if (regs->h.bl == 2 || regs->h.bl == 3)
+		return BE_VBE_NOT_SUPPORTED;	// secondary palette
+	if (first + count > 256)
+		return BE_VBE_FAILED;
+
+	switch (regs->h.bl)
+	{
+	case 0x00:
+	case 0x80:
+		copyFromGuest(addr, palette[first], count * 4);
+		return BE_VBE_SUCCESS;
+	case 0x01:
+		copyToGuest(addr, palette[first], count * 4);
+		return BE_VBE_SUCCESS;
+	default:
+		return BE_VBE_FAILED;
+	}
+}
+
+static int displayData(RMREGS* regs, RMSREGS* sregs)
+{
+	switch (regs->h.bl)
+	{
+	case 0:
+		regs->x.bx = 0x0102;		// one second per block, DDC2
+		return BE_VBE_SUCCESS;
+	case 1:
+		if (regs->x.cx != 0 || regs->x.dx != 0)
+			return BE_VBE_FAILED;	// one controller, no extension blocks
+		copyToGuest(guestAddress(regs, sregs), rom.edidValid ? rom.edid : hostEdid, BE_VBE_EDID_SIZE);
+		return BE_VBE_SUCCESS;
+	default:
+		return BE_VBE_FAILED;
+	}
+}
+
+/* Host provider, returns 0 when it does not implement the function in AX */
+static int vbeService(RMREGS* regs, RMSREGS* sregs)
+{
+	int status;
+
+	switch (regs->x.ax)
+	{
+	case 0x4F00:
+		status = getControllerInfo(regs, sregs);
+		break;
+	case 0x4F01:
+		status = getModeInfo(regs, sregs);
+		break;
+	case 0x4F02:
+		status = setMode(regs);
+		break;
+	case 0x4F03:
+		regs->x.bx = currentMode;
+		status = BE_VBE_SUCCESS;
+		break;
+	case 0x4F05:
+		status = windowControl(regs);
+		break;
+	case 0x4F09:
+		status = paletteData(regs, sregs);
+		break;
+	case 0x4F15:
+		status = displayData(regs, sregs);
+		break;
+	default:
+		return 0;
+	}
+	regs->x.ax = (u16)status;
+	return 1;
+}
+
+static int romCall(RMREGS* regs, RMSREGS* sregs)
+{
+	BE_vbePath path = vbePath;
+	RMREGS out;
+
+	vbePath = BE_VBE_ROM;
+	BE_int86x(0x10, regs, &out, sregs);
+	vbePath = path;
+	*regs = out;
+	return regs->x.ax;
+}
+
+int BE_vbeHarvest(void)
+{
+	RMREGS regs;
+	RMSREGS sregs;
+	uint length, segment, offset;
+	u16 modes[BE_VBE_MAX_MODES];
+	int count = 0;
+
+	// Only the ROM data is replaced, the current mode and the mismatches found so far stay
+	memset(&rom, 0, sizeof(rom));
+	if (BE_rdw(0x10 * 4 + 2) == BIOS_SEG)
+	{
+		printf("BE_vbeHarvest: the ROM has not hooked int 10h\n");
+		return 0;
+	}
+	BE_getVESABuf(&length, &segment, &offset);
+	u32 info = (segment << 4) + offset;
+	u32 modeInfo = info + BE_VBE_INFO_SIZE;
+
+	memset(&regs, 0, sizeof(regs));
+	memset(&sregs, 0, sizeof(sregs));
+	BE_wrl(info, 0x32454256);	// "VBE2"
+	regs.x.ax = 0x4F00;
+	regs.x.di = (u16)offset;
+	sregs.es = (u16)segment;
+	if (romCall(&regs, &sregs) != BE_VBE_SUCCESS || BE_rdl(info) != 0x41534556)
+	{
+		printf("BE_vbeHarvest: the ROM does not support VBE (AX=%04x)\n", regs.x.ax);
+		return 0;
+	}
+
+	rom.version = BE_rdw(info + INFO_VERSION);
+	rom.capabilities = BE_rdl(info + INFO_CAPABILITIES);
+	rom.totalMemory = BE_rdw(info + INFO_TOTAL_MEMORY);
+	rom.oemRevision = BE_rdw(info + INFO_OEM_REVISION);
+	readGuestString(BE_rdl(info + INFO_OEM_STRING), rom.oem);
+	readGuestString(BE_rdl(info + INFO_VENDOR_NAME), rom.vendor);
+	readGuestString(BE_rdl(info + INFO_PRODUCT_NAME), rom.product);
+	readGuestString(BE_rdl(info + INFO_PRODUCT_REVISION), rom.revision);
+
+	// The list may live in the buffer that the mode queries reuse, copy it first
+	u32 list = farToLinear(BE_rdl(info + INFO_MODE_LIST));
+	for (u16 mode; count < BE_VBE_MAX_MODES && (mode = BE_rdw(list + count * 2)) != 0xFFFF; ++count)
+		modes[count] = mode;
+
+	for (int i = 0; i < count; ++i)
+	{
+		memset(&regs, 0, sizeof(regs));
+		regs.x.ax = 0x4F01;
+		regs.x.cx = modes[i];
+		regs.x.di = (u16)(offset + BE_VBE_INFO_SIZE);
+		if (romCall(&regs, &sregs) != BE_VBE_SUCCESS)
+			continue;
+
+		rom.modes[rom.modeCount].mode = modes[i];
+		copyFromGuest(modeInfo, rom.modes[rom.modeCount].info, BE_VBE_MODE_INFO_SIZE);
+		++rom.modeCount;
+	}
+
+	memset(&regs, 0, sizeof(regs));
+	regs.x.ax = 0x4F15;
+	regs.h.bl = 1;
+	regs.x.di = (u16)(offset + BE_VBE_INFO_SIZE);
+	if (romCall(&regs, &sregs) == BE_VBE_SUCCESS)
+	{
+		copyFromGuest(modeInfo, rom.edid, BE_VBE_EDID_SIZE);
+		rom.edidValid = 1;
+	}
+
+	rom.valid = 1;
+	return rom.modeCount;
+}
+
+/* Bytes a function returns at ES:DI, 0 when it returns only registers */
+static int resultLength(const RMREGS* regs, u32 addr)
+{
+	switch (regs->x.ax)
+	{
+	case 0x4F00:
+		return BE_rdl(addr) == 0x32454256 ? BE_VBE_INFO_SIZE : BE_VBE_INFO_SIZE / 2;
+	case 0x4F01:
+		return BE_VBE_MODE_INFO_SIZE;
+	case 0x4F09:
+		return regs->h.bl == 1 && regs->x.cx <= 256 ? regs->x.cx * 4 : 0;
+	case 0x4F15:
+		return regs->h.bl == 1 ? BE_VBE_EDID_SIZE : 0;
+	default:
+		return 0;
+	}
+}
+
+static void check(u16 function, const char* what, u32 romValue, u32 hostValue)
+{
+	if (romValue == hostValue)
+		return;
+	printf("vbe: %04x %s differs, rom %#x host %#x\n", function, what, romValue, hostValue);
+	++mismatches;
+}
+
+static void checkBlock(u16 function, const char* what, u32 addr, const u8* host, int length)
+{
+	for (int i = 0; i < length; ++i)
+	{
+		if (BE_rdb(addr + i) != host[i])
+		{
+			printf("vbe: %04x %s differs at byte %d, rom %#x host %#x\n", function, what, i, BE_rdb(addr + i), host[i]);
+			++mismatches;
+			return;
+		}
+	}
+}
+
+/* Compares what the ROM returned in regs and at addr with the host answer */
+static void crossCheck(u16 function, const RMREGS* romRegs, const RMREGS* hostRegs, u32 addr, const u8* host, int length)
+{
+	check(function, "status", romRegs->x.ax, hostRegs->x.ax);
+	if (romRegs->x.ax != BE_VBE_SUCCESS || hostRegs->x.ax != BE_VBE_SUCCESS)
+		return;
+
+	switch (function)
+	{
+	case 0x4F00:
+	{
+		u32 list = farToLinear(BE_rdl(addr + INFO_MODE_LIST));
+		int i = 0;
+
+		check(function, "version", BE_rdw(addr + INFO_VERSION), get16(host + INFO_VERSION));
+		check(function, "total memory", BE_rdw(addr + INFO_TOTAL_MEMORY), get16(host + INFO_TOTAL_MEMORY));
+		// The host list is in the reserved area of its own block
+		for (;; ++i)
+		{
+			u16 romMode = BE_rdw(list + i * 2);
+			u16 hostMode = INFO_RESERVED + i * 2 < length ? get16(host + INFO_RESERVED + i * 2) : 0xFFFF;
+			check(function, "mode list", romMode, hostMode);
+			if (romMode != hostMode || romMode == 0xFFFF || i == BE_VBE_MAX_MODES)
+				break;
+		}
+		break;
+	}
+	case 0x4F01:
+		check(function, "attributes", BE_rdw(addr + MODE_ATTRIBUTES), get16(host + MODE_ATTRIBUTES));
+		check(function, "bytes per line", BE_rdw(addr + MODE_BYTES_PER_LINE), get16(host + MODE_BYTES_PER_LINE));
+		check(function, "width", BE_rdw(addr + MODE_WIDTH), get16(host + MODE_WIDTH));
+		check(function, "height", BE_rdw(addr + MODE_HEIGHT), get16(host + MODE_HEIGHT));
+		check(function, "bits per pixel", BE_rdb(addr + MODE_BITS_PER_PIXEL), host[MODE_BITS_PER_PIXEL]);
+		check(function, "memory model", BE_rdb(addr + MODE_MEMORY_MODEL), host[MODE_MEMORY_MODEL]);
+		check(function, "framebuffer", BE_rdl(addr + MODE_FRAMEBUFFER), get32(host + MODE_FRAMEBUFFER));
+		break;
+	case 0x4F03:
+		check(function, "mode", romRegs->x.bx, hostRegs->x.bx);
+		break;
+	case 0x4F05:
+		if (hostRegs->h.bh == 1)
+			check(function, "window", romRegs->x.dx, hostRegs->x.dx);
+		break;
+	case 0x4F09:
+		checkBlock(function, "palette", addr, host, length);
+		break;
+	case 0x4F15:
+		if (length != 0)
+			checkBlock(function, "edid", addr, host, length);
+		break;
+	}
+}
+
+/* Runs the host provider, then the ROM through runRom on the same input, and
+ * compares the two. The ROM result is the one left in regs and guest memory.
+ * Returns 0 without running anything when the host does not implement AX */
+static int checkedCall(RMREGS* regs, RMSREGS* sregs, int (*runRom)(RMREGS*, RMSREGS*))
+{
+	u8 saved[1024], host[1024];
+	RMREGS hostRegs = *regs;
+	RMSREGS hostSregs = *sregs;
+	u16 function = regs->x.ax;
+	u32 addr = guestAddress(regs, sregs);
+	int length = resultLength(regs, addr);
+
+	// The host answers first, the ROM then overwrites it
+	copyFromGuest(addr, saved, length);
+	if (!vbeService(&hostRegs, &hostSregs))
+		return 0;
+	copyFromGuest(addr, host, length);
+	copyToGuest(addr, saved, length);
+	runRom(regs, sregs);
+	crossCheck(function, regs, &hostRegs, addr, host, length);
+	return 1;
+}
+
+int BE_vbeCall(RMREGS* regs, RMSREGS* sregs)
+{
+	switch (vbePath)
+	{
+	case BE_VBE_FAST:
+		if (vbeService(regs, sregs))
+			return regs->x.ax;
+		return romCall(regs, sregs);
+
+	case BE_VBE_CHECKED:
+		if (checkedCall(regs, sregs, romCall))
+			return regs->x.ax;
+		return romCall(regs, sregs);
+
+	default:
+		return romCall(regs, sregs);
+	}
+}
+
+/* Runs the int 10h handler the ROM hooked from inside the int 10h being
+ * serviced: on the caller's stack, with the handler's iret landing on a halt
+ * at NESTED_RETURN, and the interrupted machine state put back afterwards */
+static int romInt10(RMREGS* regs, RMSREGS* sregs)
+{
+	X86EMU_regs interrupted = M.x86;
+	BE_vbePath path = vbePath;
+	u32 frame;
+
+	M.x86.R_EAX = regs->e.eax;
+	M.x86.R_EBX = regs->e.ebx;
+	M.x86.R_ECX = regs->e.ecx;
+	M.x86.R_EDX = regs->e.edx;
+	M.x86.R_ESI = regs->e.esi;
+	M.x86.R_EDI = regs->e.edi;
+	M.x86.R_ES = sregs->es;
+
+	BE_wrb(NESTED_RETURN, 0xF1);
+	M.x86.R_SP -= 6;
+	frame = ((u32)M.x86.R_SS << 4) + M.x86.R_SP;
+	BE_wrw(frame, NESTED_RETURN);
+	BE_wrw(frame + 2, 0);
+	BE_wrw(frame + 4, (u16)M.x86.R_FLG);
+	M.x86.R_FLG &= ~(F_IF | F_TF);
+	M.x86.R_CS = BE_rdw(0x10 * 4 + 2);
+	M.x86.R_IP = BE_rdw(0x10 * 4);
+	vbePath = BE_VBE_ROM;
+	X86EMU_exec();
+	vbePath = path;
+
+	regs->e.eax = M.x86.R_EAX;
+	regs->e.ebx = M.x86.R_EBX;
+	regs->e.ecx = M.x86.R_ECX;
+	regs->e.edx = M.x86.R_EDX;
+	regs->e.esi = M.x86.R_ESI;
+	regs->e.edi = M.x86.R_EDI;
+	sregs->es = M.x86.R_ES;
+	M.x86 = interrupted;
+	return regs->x.ax;
+}
+
+/* Called by the int 10h handler in bios.c. Answers on the host when the fast
+ * path is selected or when no ROM has hooked int 10h yet, and runs both the
+ * host and the ROM handler when the checked path is */
+int _BE_vbeInt10(void)
+{
+	RMREGS regs;
+	RMSREGS sregs;
+	int hooked = BE_rdw(0x10 * 4 + 2) != BIOS_SEG;
+
+	if (vbePath == BE_VBE_ROM && hooked)
+		return 0;
+
+	regs.e.eax = M.x86.R_EAX;
+	regs.e.ebx = M.x86.R_EBX;
+	regs.e.ecx = M.x86.R_ECX;
+	regs.e.edx = M.x86.R_EDX;
+	regs.e.esi = M.x86.R_ESI;
+	regs.e.edi = M.x86.R_EDI;
+	sregs.es = M.x86.R_ES;
+	if (vbePath == BE_VBE_CHECKED && hooked)
+	{
+		if (!checkedCall(&regs, &sregs, romInt10))
+			return 0;
+		M.x86.R_ECX = regs.e.ecx;
+		M.x86.R_ESI = regs.e.esi;
+		M.x86.R_EDI = regs.e.edi;
+		M.x86.R_ES = sregs.es;
+	}
+	else if (!vbeService(&regs, &sregs))
+		return 0;
+
+	M.x86.R_EAX = regs.e.eax;
+	M.x86.R_EBX = regs.e.ebx;
+	M.x86.R_EDX = regs.e.edx;
+	return 1;
+}
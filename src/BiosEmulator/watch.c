@@ -0,0 +1,202 @@
+#include "include/watch.h"
+#include "biosemui.h"
+
+#include <string.h>
+#include <stdio.h>
+
+// One bit per I/O port, watched memory pages are flagged with BE_PAGE_WATCH
+u8 _BE_watchPorts[(1 << 16) / 8];
+
+static BE_watchpoint watchpoints[BE_WATCH_MAX];
+static BE_watchSnapshotFunc snapshotHandler;
+
+static void setBit(u8* bitmap, u32 bit)
+{
+	bitmap[bit >> 3] |= 1 << (bit & 7);
+}
+
+static void markWatchpoint(const BE_watchpoint* watchpoint, int set)
+{
+	if (watchpoint->space == BE_WATCH_IO)
+	{
+		for (u32 port = watchpoint->start; set && port <= watchpoint->end && port <= 0xffff; ++port)
+			setBit(_BE_watchPorts, port);
+		return;
+	}
+
+	for (u32 page = watchpoint->start >> 12;; ++page)
+	{
+		if (set)
+			_X86EMU_pageFlags[page] |= BE_PAGE_WATCH;
+		else
+			_X86EMU_pageFlags[page] &= ~BE_PAGE_WATCH;
+		if (page == watchpoint->end >> 12)
+			break;
+	}
+}
+
+// Clears the pages and ports of every watchpoint, then sets them again for the ones in use
+static void rebuildBitmaps(void)
+{
+	for (int i = 0; i < BE_WATCH_MAX; ++i)
+		markWatchpoint(&watchpoints[i], 0);
+	memset(_BE_watchPorts, 0, sizeof(_BE_watchPorts));
+	for (int i = 0; i < BE_WATCH_MAX; ++i)
+	{
+		if (watchpoints[i].inUse)
+			markWatchpoint(&watchpoints[i], 1);
+	}
+}
+
+int BE_watchAdd(const BE_watchpoint* watchpoint)
+{
+	if (watchpoint->end < watchpoint->start || (watchpoint->access & (BE_WATCH_READ | BE_WATCH_WRITE)) == 0)
+	{
+		printf("BE_watchAdd: bad watchpoint %#x-%#x\n", watchpoint->start, watchpoint->end);
+		return -1;
+	}
+
+	for (int i = 0; i < BE_WATCH_MAX; ++i)
+	{
+		if (watchpoints[i].inUse)
+			continue;
+
+		watchpoints[i] = *watchpoint;
+		watchpoints[i].hits = 0;
+		watchpoints[i].inUse = 1;
+		markWatchpoint(&watchpoints[i], 1);
+		return i;
+	}
+
+	printf("BE_watchAdd: too many watchpoints\n");
+	return -1;
+}
+
+void BE_watchRemove(int handle)
+{
+	if (handle < 0 || handle >= BE_WATCH_MAX || !watchpoints[handle].inUse)
+		return;
+
+	watchpoints[handle].inUse = 0;
+	rebuildBitmaps();
+}
+
+void BE_watchReset(void)
+{
+	for (int i = 0; i < BE_WATCH_MAX; ++i)
+		watchpoints[i].inUse = 0;
+	rebuildBitmaps();
+	memset(watchpoints, 0, sizeof(watchpoints));
+}
+
+const BE_watchpoint* BE_watchGet(int handle)
+{
+	if (handle < 0 || handle >= BE_WATCH_MAX || !watchpoints[handle].inUse)
+		return NULL;
+	return &watchpoints[handle];
+}
+
+void BE_watchSetSnapshotHandler(BE_watchSnapshotFunc handler)
+{
+	snapshotHandler = handler;
+}
+
+// Byte lanes of a value of size bytes, or of the first bytes of a range
+static u32 laneMask(u32 bytes)
+{
+	return bytes >= 4 ? 0xffffffff : (1u << (bytes * 8)) - 1;
+}
+
+// mask and compareValue describe the bytes from the watch start on. The access value is lined up
+// with them, and only the bytes both the access and the watched range cover are compared
+static int valueMatches(const BE_watchpoint* watchpoint, u32 addr, int size, u32 value)
+{
+	if (watchpoint->compare == BE_WATCH_ANY)
+		return 1;
+
+	u32 lanes = laneMask(size);
+	if (addr <= watchpoint->start)
+	{
+		u32 skip = (watchpoint->start - addr) * 8;
+		value >>= skip;
+		lanes >>= skip;
+	}
+	else
+	{
+		u32 offset = addr - watchpoint->start;
+		if (offset >= 4)
+			return 0;
+		value <<= offset * 8;
+		lanes <<= offset * 8;
+	}
+
+	// end - start + 1 wraps for a watch of the whole space
+	u32 last = watchpoint->end - watchpoint->start;
+	u32 mask = watchpoint->mask & lanes & laneMask(last < 4 ? last + 1 : 4);
+	if (mask == 0)
+		return 0;
+
+	u32 masked = value & mask;
+	switch (watchpoint->compare)
+	{
+	case BE_WATCH_EQ:
+		return masked == (watchpoint->compareValue & mask);
+	case BE_WATCH_NE:
+		return masked != (watchpoint->compareValue & mask);
+	case BE_WATCH_ALL_SET:
+		return masked == mask;
+	case BE_WATCH_ANY_SET:
+		return masked != 0;
+	default:
+		return 1;
+	}
+}
+
+static void dumpRegisters(void)
+{
+	printf("  EAX=%08x EBX=%08x ECX=%08x EDX=%08x\n", M.x86.R_EAX, M.x86.R_EBX, M.x86.R_ECX, M.x86.R_EDX);
+	printf("  ESI=%08x EDI=%08x EBP=%08x ESP=%08x\n", M.x86.R_ESI, M.x86.R_EDI, M.x86.R_EBP, M.x86.R_ESP);
+	printf("  CS=%04x DS=%04x ES=%04x SS=%04x FS=%04x GS=%04x IP=%04x FLAGS=%08x\n", M.x86.R_CS, M.x86.R_DS,
+		   M.x86.R_ES, M.x86.R_SS, M.x86.R_FS, M.x86.R_GS, M.x86.R_IP, M.x86.R_FLG);
+}
+
+static void fire(int handle, BE_watchpoint* watchpoint, int access, u32 addr, u32 value)
+{
+	if (watchpoint->actions & BE_WATCH_LOG)
+	{
+		printf("watchpoint %d: %s %s %#x value %#x at %04x:%04x (hit %u)\n", handle,
+			   watchpoint->space == BE_WATCH_IO ? "port" : "mem", access == BE_WATCH_WRITE ? "write" : "read",
+			   addr, value, M.x86.R_CS, M.x86.R_IP, watchpoint->hits);
+	}
+
+	if (watchpoint->actions & BE_WATCH_SNAPSHOT)
+	{
+		if (snapshotHandler != NULL)
+			snapshotHandler(handle, watchpoint, addr, value);
+		else
+			dumpRegisters();
+	}
+
+	// The instruction in flight completes, X86EMU_exec returns before the next one
+	if (watchpoint->actions & BE_WATCH_HALT)
+		X86EMU_halt_sys();
+}
+
+void BE_watchCheck(int space, int access, u32 addr, int size, u32 value)
+{
+	u32 last = addr + size - 1;
+	for (int i = 0; i < BE_WATCH_MAX; ++i)
+	{
+		BE_watchpoint* watchpoint = &watchpoints[i];
+		if (!watchpoint->inUse || watchpoint->space != space || !(watchpoint->access & access))
+			continue;
+		if (addr > watchpoint->end || last < watchpoint->start)
+			continue;
+		if (!valueMatches(watchpoint, addr, size, value))
+			continue;
+
+		++watchpoint->hits;
+		if (watchpoint->count == 0 || watchpoint->hits == watchpoint->count)
+			fire(i, watchpoint, access, addr, value);
+	}
+}
@@ -80,6 +80,35 @@ void x86emu_intr_raise(
     M.x86.intr |= INTR_SYNCH;
 }
 
+static u64 instructionCount = 0;	/* instructions run since the budget was set */
+static u64 instructionBudget = ~0ULL;
+
+/****************************************************************************
+PARAMETERS:
+budget	- Number of instructions X86EMU_exec may run, 0 for no limit
+
+REMARKS:
+Starts counting instructions from zero. Once the budget is used up,
+X86EMU_exec returns before running the next instruction, from this call and
+every following one, until a new budget is set.
+****************************************************************************/
+void X86EMU_setInstructionBudget(
+    u64 budget)
+{
+    instructionCount = 0;
+    instructionBudget = budget != 0 ? budget : ~0ULL;
+}
+
+u64 X86EMU_instructionCount(void)
+{
+    return instructionCount;
+}
+
+int X86EMU_budgetExhausted(void)
+{
+    return instructionCount >= instructionBudget;
+}
+
 /****************************************************************************
 REMARKS:
 Main execution loop for the emulator. We return from here when the system
@@ -89,6 +118,7 @@ original real mode call.
 void X86EMU_exec(void)
 {
     u8 op1;
+    u32 pc;
 
     M.x86.intr = 0;
     DB(x86emu_end_instr();)
@@ -116,7 +146,15 @@ DB(		if (M.x86.R_SP != 0) {
 		x86emu_intr_handle();
 	    }
 	}
-	op1 = (*sys_rdb)(((u32)M.x86.R_CS << 4) + (M.x86.R_IP++));
+	if (instructionCount >= instructionBudget)
+	    return;
+	instructionCount++;
+	pc = ((u32)M.x86.R_CS << 4) + M.x86.R_IP;
+	if ((pc >> X86EMU_PAGE_SHIFT) != _X86EMU_codeFetchPage ||
+	    ((pc + 15) >> X86EMU_PAGE_SHIFT) != _X86EMU_codeFetchPage)
+	    x86emu_mark_code(pc);
+	op1 = (*sys_rdb)(pc);
+	M.x86.R_IP++;
 	(*x86emu_optab[op1])(op1);
 	if (M.x86.debug & DEBUG_EXIT) {
 	    M.x86.debug &= ~DEBUG_EXIT;
@@ -48,6 +48,9 @@ X86EMU_intrFuncs _X86EMU_intrTab[256];
 
 int debug_intr;
 
+u8 _X86EMU_pageFlags[1 << (32 - X86EMU_PAGE_SHIFT)];
+u32 _X86EMU_codeFetchPage = 0xFFFFFFFF;	/* page holding the whole last marked fetch window */
+
 /*----------------------------- Implementation ----------------------------*/
 
 /****************************************************************************
@@ -325,3 +328,67 @@ void X86EMU_prepareForInt(int num)
 	M.x86.R_IP = mem_access_word(num * 4);
 	M.x86.intr = 0;
 }
+
+/****************************************************************************
+PARAMETERS:
+pc  - Linear address of the instruction about to be fetched
+
+REMARKS:
+Marks the pages holding the instruction at pc as containing executed code.
+An instruction is at most 15 bytes long, so the page of its last possible
+byte is marked as well. A window that fits in one page is cached in
+_X86EMU_codeFetchPage, and X86EMU_exec only calls this when either end of
+the next window lies outside the cached page. Windows that straddle two
+pages are not cached, so both pages are marked every time.
+****************************************************************************/
+void x86emu_mark_code(u32 pc)
+{
+	u32 first = pc >> X86EMU_PAGE_SHIFT;
+	u32 last = (pc + 15) >> X86EMU_PAGE_SHIFT;
+
+	_X86EMU_pageFlags[first] |= X86EMU_PAGE_CODE;
+	_X86EMU_pageFlags[last] |= X86EMU_PAGE_CODE;
+	_X86EMU_codeFetchPage = first == last ? first : 0xFFFFFFFF;
+}
+
+/****************************************************************************
+PARAMETERS:
+addr    - Emulator memory address written
+size    - Size of the write in bytes
+
+REMARKS:
+Called by the memory write functions after a store to guest memory when
+X86EMU_PAGE_FLAGS has X86EMU_PAGE_CODE set for the written range. Every
+such page loses the flag, so later stores to it stay on the fast path until
+code runs there again.
+****************************************************************************/
+void X86EMU_codeWritten(u32 addr, int size)
+{
+	u32 page = addr >> X86EMU_PAGE_SHIFT;
+	u32 last = (addr + size - 1) >> X86EMU_PAGE_SHIFT;
+
+	for (; page <= last; page++) {
+		if (!(_X86EMU_pageFlags[page] & X86EMU_PAGE_CODE))
+			continue;
+		_X86EMU_pageFlags[page] &= ~X86EMU_PAGE_CODE;
+		DB(if (DEBUG_MEM_TRACE())
+			printk("code page %#x modified at %04x:%04x\n",
+			       page << X86EMU_PAGE_SHIFT, M.x86.saved_cs, M.x86.saved_ip);)
+	}
+
+	/* The fetch cache may point at a page that just lost its flag */
+	_X86EMU_codeFetchPage = 0xFFFFFFFF;
+}
+
+/****************************************************************************
+REMARKS:
+Forgets which pages held code.
+****************************************************************************/
+void X86EMU_codeReset(void)
+{
+	u32 page;
+
+	for (page = 0; page < X86EMU_CODE_PAGES; page++)
+		_X86EMU_pageFlags[page] &= ~X86EMU_PAGE_CODE;
+	_X86EMU_codeFetchPage = 0xFFFFFFFF;
+}
@@ -0,0 +1,14 @@
+#include "ConfigItems.h"
+#include "cJSON.h"
+
+#include <stdlib.h>
+
+int hexConfigItem(const cJSON* item, uint32_t* value)
+{
+    const char* text = cJSON_GetStringValue(item);
+    if (text == NULL)
+        return 0;
+    char* end;
+    *value = (uint32_t)strtoul(text, &end, 16);
+    return *text != '\0' && *end == '\0';
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdint.h>
+
+struct cJSON;
+
+// A configuration string holding a hex number without prefix, e.g. "C0000". Returns 0 when
+// item is not such a string
+int hexConfigItem(const struct cJSON* item, uint32_t* value);
@@ -3,51 +3,327 @@
 #include <stdlib.h>
 #include <string.h>
 
-// if on a 64bit system, we need to use mmap to allocate memory within the first 4GB of memory
-#if __x86_64__ || __ppc64__ || __powerpc64__ || __aarch64__
 #include <sys/mman.h>
-#endif
 
-uintptr_t allocateIn4GBRange(uint32_t size)
+// Host memory backing guest RAM, BARs and rom images. Guest physical addresses are assigned
+// separately (see BiosEmulator/mmio.c), so none of this has to live in the low 4GB any more.
+
+#define ARENA_MIN_ORDER 12
+#define ARENA_MAX_ORDERS 32
+
+// Buddy allocator state. The arena is a power of two in size and aligned to its own size,
+// so every block of order n is naturally aligned to 1 << n in absolute terms as well.
+static uintptr_t arenaBase = 0;
+static uint32_t arenaSize = 0;
+static int arenaTopOrder = 0;
+static uint64_t* freeMaps[ARENA_MAX_ORDERS];  // bit i set => block i of order n is free
+static uint64_t* freeMapStorage = NULL;
+static uint8_t* allocOrders = NULL;            // per minimum block: order + 1 of the allocation starting there
+
+static HugePagePolicy hugePagePolicy = HUGE_PAGES_OFF;
+
+static int orderFor(uint32_t size)
+{
+    int order = ARENA_MIN_ORDER;
+    while (order < ARENA_MAX_ORDERS && ((uint64_t)1 << order) < size)
+        ++order;
+    return order;
+}
+
+static int testBit(const uint64_t* map, uint32_t bit)
+{
+    return (map[bit >> 6] >> (bit & 63)) & 1;
+}
+
+static void setBit(uint64_t* map, uint32_t bit)
+{
+    map[bit >> 6] |= (uint64_t)1 << (bit & 63);
+}
+
+static void clearBit(uint64_t* map, uint32_t bit)
+{
+    map[bit >> 6] &= ~((uint64_t)1 << (bit & 63));
+}
+
+static int64_t takeBlock(int order)
+{
+    if (order > arenaTopOrder)
+        return -1;
+
+    uint32_t words = ((arenaSize >> order) + 63) / 64;
+    for (uint32_t w = 0; w < words; ++w)
+    {
+        if (freeMaps[order][w] == 0)
+            continue;
+        uint32_t index = w * 64 + __builtin_ctzll(freeMaps[order][w]);
+        clearBit(freeMaps[order], index);
+        return (int64_t)index << order;
+    }
+
+    // Nothing free at this order, split a bigger block and keep its upper half free
+    int64_t offset = takeBlock(order + 1);
+    if (offset < 0)
+        return -1;
+    setBit(freeMaps[order], (uint32_t)(offset >> order) + 1);
+    return offset;
+}
+
+static void releaseBlock(uint32_t offset, int order)
+{
+    while (order < arenaTopOrder)
+    {
+        uint32_t buddy = (offset >> order) ^ 1;
+        if (!testBit(freeMaps[order], buddy))
+            break;
+        clearBit(freeMaps[order], buddy);
+        offset &= ~((uint32_t)1 << order);
+        ++order;
+    }
+    setBit(freeMaps[order], offset >> order);
+}
+
+static void resetFreeMaps(void)
 {
-#if __x86_64__ || __ppc64__ || __powerpc64__ || __aarch64__
-    // Using mmap to allocate within the first 4GB of memory'
-    // This is because the PCI configuration only supports 32 bit addresses
-    void* addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_32BIT | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    uint32_t totalBits = 0;
+    for (int order = ARENA_MIN_ORDER; order <= arenaTopOrder; ++order)
+        totalBits += ((arenaSize >> order) + 63) / 64 * 64;
+    memset(freeMapStorage, 0, totalBits / 8);
+    memset(allocOrders, 0, arenaSize >> ARENA_MIN_ORDER);
+    setBit(freeMaps[arenaTopOrder], 0);
+}
+
+int arenaInit(uint32_t size)
+{
+    if (arenaBase != 0)
+        return 1;
+
+    int order = orderFor(size);
+    if (order >= ARENA_MAX_ORDERS)
+    {
+        printf("Arena size %u is too large\n", size);
+        return 0;
+    }
+    uint32_t alignedSize = (uint32_t)1 << order;
+
+    // Reserve twice the size so we can trim it down to a naturally aligned window.
+    // MAP_NORESERVE: pages only cost memory once something touches them.
+    uint64_t reserveSize = (uint64_t)alignedSize * 2;
+    void* addr = mmap(NULL, reserveSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
     if (addr == MAP_FAILED)
     {
-        printf("Could not allocate memory\n");
+        printf("Could not reserve arena memory\n");
         return 0;
     }
 
-    uint64_t _addr = (uint64_t)addr;
-    uint32_t addr32 = (uint32_t)_addr & 0x00000000ffffffff;
-    if (_addr != addr32)
+    uint64_t start = (uint64_t)addr;
+    uint64_t alignedStart = (start + alignedSize - 1) & ~((uint64_t)alignedSize - 1);
+    if (alignedStart > start)
+        munmap(addr, alignedStart - start);
+    if (alignedStart + alignedSize < start + reserveSize)
+        munmap((void*)(alignedStart + alignedSize), start + reserveSize - (alignedStart + alignedSize));
+
+    uint32_t totalWords = 0;
+    for (int o = ARENA_MIN_ORDER; o <= order; ++o)
+        totalWords += ((alignedSize >> o) + 63) / 64;
+    freeMapStorage = calloc(totalWords, sizeof(uint64_t));
+    allocOrders = calloc(alignedSize >> ARENA_MIN_ORDER, 1);
+    if (freeMapStorage == NULL || allocOrders == NULL)
     {
-        munmap(addr, size);
+        free(freeMapStorage);
+        free(allocOrders);
+        freeMapStorage = NULL;
+        allocOrders = NULL;
+        munmap((void*)alignedStart, alignedSize);
         printf("Could not allocate memory\n");
         return 0;
     }
-#else
-    // On 32 bit systems, we can just use malloc
-    void* addr = malloc(size);
+
+    uint64_t* map = freeMapStorage;
+    for (int o = ARENA_MIN_ORDER; o <= order; ++o)
+    {
+        freeMaps[o] = map;
+        map += ((alignedSize >> o) + 63) / 64;
+    }
+
+    arenaBase = (uintptr_t)alignedStart;
+    arenaSize = alignedSize;
+    arenaTopOrder = order;
+    resetFreeMaps();
+    return 1;
+}
+
+void arenaDestroy(void)
+{
+    if (arenaBase == 0)
+        return;
+    munmap((void*)arenaBase, arenaSize);
+    free(freeMapStorage);
+    free(allocOrders);
+    freeMapStorage = NULL;
+    allocOrders = NULL;
+    arenaBase = 0;
+    arenaSize = 0;
+}
+
+// Drops every allocation at once and hands the pages back to the kernel
+void arenaReset(void)
+{
+    if (arenaBase == 0)
+        return;
+    // Mapping fresh anonymous memory over the whole window also removes file mappings placed in it
+    mmap((void*)arenaBase, arenaSize, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    resetFreeMaps();
+}
+
+int arenaContains(const void* ptr)
+{
+    uintptr_t addr = (uintptr_t)ptr;
+    return arenaBase != 0 && addr >= arenaBase && addr - arenaBase < arenaSize;
+}
+
+void* arenaAlloc(uint32_t size, uint32_t alignment)
+{
+    if (arenaBase == 0 || size == 0)
+        return NULL;
+
+    int order = orderFor(size > alignment ? size : alignment);
+    if (order > arenaTopOrder)
+        return NULL;
+
+    int64_t offset = takeBlock(order);
+    if (offset < 0)
+        return NULL;
+
+    allocOrders[offset >> ARENA_MIN_ORDER] = (uint8_t)(order + 1);
+    return (void*)(arenaBase + (uintptr_t)offset);
+}
+
+void arenaFree(void* ptr)
+{
+    if (!arenaContains(ptr))
+        return;
+
+    uint32_t offset = (uint32_t)((uintptr_t)ptr - arenaBase);
+    int order = allocOrders[offset >> ARENA_MIN_ORDER] - 1;
+    if (order < ARENA_MIN_ORDER)
+    {
+        printf("Bad arena free of %p\n", ptr);
+        return;
+    }
+    allocOrders[offset >> ARENA_MIN_ORDER] = 0;
+
+    // Give the pages back and make sure the next user sees zeroes, whatever was mapped here
+    mmap(ptr, (size_t)1 << order, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    releaseBlock(offset, order);
+}
+
+void* allocateHostMemory(uint32_t size)
+{
+    return allocateAlignedHostMemory(size, ARENA_MIN_BLOCK);
+}
+
+void* allocateAlignedHostMemory(uint32_t size, uint32_t alignment)
+{
+    void* fromArena = arenaAlloc(size, alignment);
+    if (fromArena != NULL)
+        return fromArena;
+
+    // Outside the arena we only get page alignment
+    void* addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED)
+    {
+        printf("Could not allocate memory\n");
+        return NULL;
+    }
+    return addr;
+}
+
+void freeHostMemory(void* addr, uint32_t size)
+{
+    if (addr == NULL)
+        return;
+
+    if (arenaContains(addr))
+    {
+        arenaFree(addr);
+        return;
+    }
+    munmap(addr, size);
+}
+
+void setHugePagePolicy(HugePagePolicy policy)
+{
+    hugePagePolicy = policy;
+}
+
+int parseHugePagePolicy(const char* name, HugePagePolicy* policy)
+{
+    if (strcmp(name, "off") == 0)
+        *policy = HUGE_PAGES_OFF;
+    else if (strcmp(name, "transparent") == 0)
+        *policy = HUGE_PAGES_TRANSPARENT;
+    else if (strcmp(name, "explicit") == 0)
+        *policy = HUGE_PAGES_EXPLICIT;
+    else
+        return 0;
+    return 1;
+}
+
+static uint32_t largeSize(uint32_t size)
+{
+    return (size + HUGE_PAGE_SIZE - 1) & ~(uint32_t)(HUGE_PAGE_SIZE - 1);
+}
+
+// Maps size bytes aligned on HUGE_PAGE_SIZE outside the arena by trimming an oversized reservation
+static void* mapAlignedLarge(uint32_t size)
+{
+    uint64_t reserveSize = (uint64_t)size + HUGE_PAGE_SIZE;
+    void* addr = mmap(NULL, reserveSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED)
+        return NULL;
+
+    uint64_t start = (uint64_t)addr;
+    uint64_t alignedStart = (start + HUGE_PAGE_SIZE - 1) & ~((uint64_t)HUGE_PAGE_SIZE - 1);
+    if (alignedStart > start)
+        munmap(addr, alignedStart - start);
+    if (alignedStart + size < start + reserveSize)
+        munmap((void*)(alignedStart + size), start + reserveSize - (alignedStart + size));
+    return (void*)alignedStart;
+}
+
+void* allocateLargeHostMemory(uint32_t size)
+{
+    if (size == 0)
+        return NULL;
+    size = largeSize(size);
+
+    // Arena blocks are naturally aligned, so a block of this size is huge page aligned as well
+    void* addr = arenaAlloc(size, HUGE_PAGE_SIZE);
+    if (addr == NULL)
+        addr = mapAlignedLarge(size);
     if (addr == NULL)
     {
         printf("Could not allocate memory\n");
         return NULL;
     }
 
-    uint32_t addr32 = (uint32_t)addr;
-#endif
+    if (hugePagePolicy == HUGE_PAGES_EXPLICIT)
+    {
+        // Replace the 4KB pages in place. The kernel checks the hugetlb reservation before it
+        // touches the existing mapping, but put anonymous memory back anyway if it fails.
+        void* huge = mmap(addr, size, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (huge != MAP_FAILED)
+            return addr;
+        mmap(addr, size, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    }
 
-    return (uintptr_t)addr32;   
+    if (hugePagePolicy != HUGE_PAGES_OFF)
+        madvise(addr, size, MADV_HUGEPAGE);
+    return addr;
 }
 
-void freeIn4GBRange(void* addr, uint32_t size)
+void freeLargeHostMemory(void* addr, uint32_t size)
 {
-#if __x86_64__ || __ppc64__ || __powerpc64__ || __aarch64__
-    munmap(addr, size);
-#else
-    free(addr);
-#endif
+    // arenaFree maps plain anonymous memory back over the block, which also drops huge pages
+    freeHostMemory(addr, largeSize(size));
 }
@@ -2,5 +2,36 @@
 
 #include <stdint.h>
 
-uintptr_t allocateIn4GBRange(uint32_t size);
-void freeIn4GBRange(void* addr, uint32_t size);
+// Default size of the arena reserved by arenaInit, enough for a ROM image and a set of BARs
+#define ARENA_DEFAULT_SIZE (256 * 1024 * 1024)
+#define ARENA_MIN_BLOCK 4096
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// How large allocations (guest RAM, bus memory, big BARs) are backed
+typedef enum HugePagePolicy
+{
+    HUGE_PAGES_OFF,          // plain 4KB pages
+    HUGE_PAGES_TRANSPARENT,  // 2MB aligned and madvise(MADV_HUGEPAGE)
+    HUGE_PAGES_EXPLICIT      // MAP_HUGETLB, falling back to transparent huge pages
+} HugePagePolicy;
+
+void* allocateHostMemory(uint32_t size);
+void* allocateAlignedHostMemory(uint32_t size, uint32_t alignment);
+void freeHostMemory(void* addr, uint32_t size);
+
+// Large allocations are always rounded up to and aligned on HUGE_PAGE_SIZE, whatever the policy,
+// so they must be released with freeLargeHostMemory
+void setHugePagePolicy(HugePagePolicy policy);
+int parseHugePagePolicy(const char* name, HugePagePolicy* policy);
+void* allocateLargeHostMemory(uint32_t size);
+void freeLargeHostMemory(void* addr, uint32_t size);
+
+// Buddy arena for host backing memory. Once initialized, allocateHostMemory sub-allocates from it
+// and only falls back to a dedicated mmap for requests that do not fit.
+int arenaInit(uint32_t size);
+void arenaDestroy(void);
+void arenaReset(void);
+int arenaContains(const void* addr);
+void* arenaAlloc(uint32_t size, uint32_t alignment);
+void arenaFree(void* addr);
@@ -0,0 +1,147 @@
+#include "MemoryMap.h"
+#include "ConfigItems.h"
+#include "MemAllocator.h"
+#include "cJSON.h"
+#include "BiosEmulator/include/memmap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Host buffers allocated for regions with a file or fill pattern
+static void* backings[BE_MEM_MAX_REGIONS];
+static uint32_t backingSizes[BE_MEM_MAX_REGIONS];
+static int backingFromFile[BE_MEM_MAX_REGIONS];
+static int backingCount = 0;
+
+static int loadFile(const char* filename, unsigned char* buffer, uint32_t size)
+{
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL)
+    {
+        printf("Could not open file %s\n", filename);
+        return 0;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long fileSize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (fileSize < 0 || (uint32_t)fileSize > size)
+    {
+        printf("File %s does not fit its memory region (%ld > %u bytes)\n", filename, fileSize, size);
+        fclose(file);
+        return 0;
+    }
+
+    size_t read = fread(buffer, 1, fileSize, file);
+    fclose(file);
+    if (read != (size_t)fileSize)
+    {
+        printf("Could not read file %s\n", filename);
+        return 0;
+    }
+    return 1;
+}
+
+static unsigned char* createBacking(const cJSON* entry, BE_memType type, uint32_t size)
+{
+    const cJSON* fileItem = cJSON_GetObjectItem(entry, "file");
+    const cJSON* fillItem = cJSON_GetObjectItem(entry, "fill");
+    if (fileItem == NULL && fillItem == NULL)
+        return NULL;
+
+    // Unwritten ROM reads like an erased part, RAM starts out zeroed
+    uint32_t fill = type == BE_MEM_ROM ? 0xFF : 0x00;
+    if (fillItem != NULL && !hexConfigItem(fillItem, &fill))
+    {
+        printf("memory_map: fill must be a hex byte\n");
+        return NULL;
+    }
+
+    if (backingCount == BE_MEM_MAX_REGIONS)
+    {
+        printf("memory_map: too many regions\n");
+        return NULL;
+    }
+
+    unsigned char* backing = allocateHostMemory(size);
+    if (backing == NULL)
+        return NULL;
+    backings[backingCount] = backing;
+    backingSizes[backingCount] = size;
+    backingFromFile[backingCount] = fileItem != NULL;
+    ++backingCount;
+
+    memset(backing, (int)(fill & 0xFF), size);
+    if (fileItem != NULL && !loadFile(cJSON_GetStringValue(fileItem), backing, size))
+        return NULL;
+    return backing;
+}
+
+int loadMemoryMap(const cJSON* map)
+{
+    unloadMemoryMap();
+    if (!cJSON_IsArray(map))
+    {
+        printf("memory_map must be an array of regions\n");
+        return 0;
+    }
+
+    const cJSON* entry;
+    cJSON_ArrayForEach(entry, map)
+    {
+        uint32_t start;
+        uint32_t size;
+        BE_memType type;
+        const char* typeName = cJSON_GetStringValue(cJSON_GetObjectItem(entry, "type"));
+        if (!hexConfigItem(cJSON_GetObjectItem(entry, "start"), &start) ||
+            !hexConfigItem(cJSON_GetObjectItem(entry, "size"), &size) ||
+            typeName == NULL || !BE_memTypeFromName(typeName, &type))
+        {
+            printf("memory_map: every region needs a hex start and size and a type of ram, rom, mmio or unmapped\n");
+            goto error;
+        }
+
+        // Checked before a backing of that size is allocated
+        if (!BE_memmapCheck(start, size))
+            goto error;
+
+        unsigned char* backing = NULL;
+        if (type == BE_MEM_RAM || type == BE_MEM_ROM)
+        {
+            int wantsBacking = cJSON_GetObjectItem(entry, "file") != NULL || cJSON_GetObjectItem(entry, "fill") != NULL;
+            backing = createBacking(entry, type, size);
+            if (wantsBacking && backing == NULL)
+                goto error;
+        }
+
+        if (!BE_memmapAdd(start, size, type, backing))
+            goto error;
+    }
+    return 1;
+
+error:
+    unloadMemoryMap();
+    return 0;
+}
+
+void unloadMemoryMap(void)
+{
+    BE_memmapClear();
+    for (int i = 0; i < backingCount; ++i)
+        freeHostMemory(backings[i], backingSizes[i]);
+    backingCount = 0;
+}
+
+int memoryMapFileBacking(int index, const void** data, uint32_t* size)
+{
+    for (int i = 0; i < backingCount; ++i)
+    {
+        if (!backingFromFile[i] || index-- != 0)
+            continue;
+        *data = backings[i];
+        *size = backingSizes[i];
+        return 1;
+    }
+    return 0;
+}
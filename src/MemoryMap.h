@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+
+struct cJSON;
+
+// Declares the regions of a "memory_map" JSON array with the emulator, see BiosEmulator/include/memmap.h
+int loadMemoryMap(const struct cJSON* map);
+void unloadMemoryMap(void);
+
+// The index-th region loaded from a "file", as the emulator sees it. Returns 0 past the last one
+int memoryMapFileBacking(int index, const void** data, uint32_t* size);
@@ -0,0 +1,253 @@
+#include "OptionRom.h"
+#include "BiosEmulator/include/biosemu.h"
+#include "cJSON.h"
+#include <stdio.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define PCIR_VENDOR_ID 0x04
+#define PCIR_DEVICE_ID 0x06
+#define PCIR_LENGTH 0x0a
+#define PCIR_REVISION 0x0c
+#define PCIR_CLASS_CODE 0x0d
+#define PCIR_IMAGE_LENGTH 0x10
+#define PCIR_REVISION_LEVEL 0x12
+#define PCIR_CODE_TYPE 0x14
+#define PCIR_INDICATOR 0x15
+#define PCIR_MIN_LENGTH 0x18
+
+#define PNP_REVISION 0x04
+#define PNP_LENGTH 0x05
+#define PNP_DEVICE_TYPE 0x12
+#define PNP_MANUFACTURER 0x0e
+#define PNP_PRODUCT 0x10
+#define PNP_BCV 0x16
+#define PNP_DISCONNECT 0x18
+#define PNP_BEV 0x1a
+#define PNP_MIN_LENGTH 0x20
+
+static uint16_t read16(const unsigned char* p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t read24(const unsigned char* p)
+{
+    return p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16);
+}
+
+// Copies the zero terminated string at offset, empty when it does not lie inside the image
+static void readString(const unsigned char* image, uint32_t size, uint16_t offset, char* string)
+{
+    uint32_t i = 0;
+    if (offset != 0)
+    {
+        for (; i < OPTION_ROM_STRING_SIZE - 1 && offset + i < size && image[offset + i] != 0; ++i)
+            string[i] = (char)image[offset + i];
+    }
+    string[i] = 0;
+}
+
+// Legacy images have no PCI data structure, they are treated as x86 code for any device
+static void parsePcir(const unsigned char* data, uint32_t size, OptionRom* rom)
+{
+    uint16_t offset = read16(data + ROM_HEADER_PCIR_OFFSET);
+    if (offset == 0 || offset + PCIR_MIN_LENGTH > size || memcmp(data + offset, "PCIR", 4) != 0)
+    {
+        printf("Option rom has no PCI data structure\n");
+        rom->imageLength = rom->length;
+        rom->lastImage = 1;
+        return;
+    }
+
+    const unsigned char* pcir = data + offset;
+    rom->pcirOffset = offset;
+    rom->vendorID = read16(pcir + PCIR_VENDOR_ID);
+    rom->deviceID = read16(pcir + PCIR_DEVICE_ID);
+    rom->pcirRevision = pcir[PCIR_REVISION];
+    rom->classCode = read24(pcir + PCIR_CLASS_CODE);
+    rom->imageLength = (uint32_t)read16(pcir + PCIR_IMAGE_LENGTH) * ROM_BLOCK_SIZE;
+    rom->revisionLevel = read16(pcir + PCIR_REVISION_LEVEL);
+    rom->codeType = pcir[PCIR_CODE_TYPE];
+    rom->lastImage = (pcir[PCIR_INDICATOR] & 0x80) != 0;
+    if (read16(pcir + PCIR_LENGTH) < PCIR_MIN_LENGTH)
+        printf("Option rom PCI data structure is too short (%u bytes)\n", read16(pcir + PCIR_LENGTH));
+}
+
+// The PnP header is optional, a malformed one is reported and ignored
+static void parsePnp(const unsigned char* data, uint32_t size, OptionRom* rom)
+{
+    uint16_t offset = read16(data + ROM_HEADER_PNP_OFFSET);
+    if (offset == 0 || offset + PNP_MIN_LENGTH > size || memcmp(data + offset, "$PnP", 4) != 0)
+        return;
+
+    const unsigned char* pnp = data + offset;
+    unsigned char sum = 0;
+    for (int i = 0; i < pnp[PNP_LENGTH] * 16 && offset + i < size; ++i)
+        sum += pnp[i];
+    if (sum != 0)
+        printf("Option rom PnP header checksum is wrong\n");
+
+    rom->pnpOffset = offset;
+    rom->deviceType = read24(pnp + PNP_DEVICE_TYPE);
+    rom->bootConnectionVector = read16(pnp + PNP_BCV);
+    rom->disconnectVector = read16(pnp + PNP_DISCONNECT);
+    rom->bootEntryVector = read16(pnp + PNP_BEV);
+    readString(data, size, read16(pnp + PNP_MANUFACTURER), rom->manufacturer);
+    readString(data, size, read16(pnp + PNP_PRODUCT), rom->product);
+}
+
+int parseOptionRom(const unsigned char* data, uint32_t size, OptionRom* rom)
+{
+    memset(rom, 0, sizeof(*rom));
+    if (size < ROM_BLOCK_SIZE || data[0] != 0x55 || data[1] != 0xAA)
+    {
+        printf("Option rom image has no 0x55AA signature\n");
+        return 0;
+    }
+
+    rom->image = data;
+    rom->length = data[ROM_HEADER_SIZE_OFFSET] * ROM_BLOCK_SIZE;
+    if (rom->length == 0 || rom->length > size)
+    {
+        printf("Option rom initialization size %u does not fit the %u bytes of the image\n", rom->length, size);
+        return 0;
+    }
+    rom->checksumValid = optionRomChecksum(data, rom->length) == 0;
+
+    parsePcir(data, size, rom);
+    parsePnp(data, size, rom);
+    return 1;
+}
+
+uint8_t optionRomChecksum(const unsigned char* data, uint32_t length)
+{
+    uint32_t i = 0;
+    uint8_t sum = 0;
+#ifdef __SSE2__
+    // psadbw against zero adds 8 bytes into each 64 bit lane, 16 bytes per instruction
+    __m128i zero = _mm_setzero_si128();
+    __m128i total = zero;
+    for (; i + 16 <= length; i += 16)
+        total = _mm_add_epi64(total, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(data + i)), zero));
+    sum = (uint8_t)(_mm_cvtsi128_si32(total) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(total, total)));
+#endif
+    for (; i < length; ++i)
+        sum += data[i];
+    return sum;
+}
+
+int parseOptionRomContainer(const unsigned char* data, uint32_t size, OptionRomContainer* container)
+{
+    uint32_t offset = 0;
+
+    container->count = 0;
+    container->x86Image = -1;
+    while (offset < size && container->count < OPTION_ROM_MAX_IMAGES)
+    {
+        OptionRom* rom = &container->images[container->count];
+        if (!parseOptionRom(data + offset, size - offset, rom))
+        {
+            // Dumps of the whole ROM chip pad the space after the last image
+            if (container->count == 0)
+                return 0;
+            printf("Option rom container has no further image at offset %u\n", offset);
+            break;
+        }
+        rom->offset = offset;
+
+        if (rom->codeType == PCIR_CODE_X86 && container->x86Image < 0)
+            container->x86Image = container->count;
+        ++container->count;
+
+        uint32_t next = rom->imageLength > rom->length ? rom->imageLength : rom->length;
+        if (rom->lastImage || next > size - offset)
+            break;
+        offset += next;
+    }
+    if (container->count == OPTION_ROM_MAX_IMAGES)
+        printf("Option rom container has more than %d images, ignoring the rest\n", OPTION_ROM_MAX_IMAGES);
+    return 1;
+}
+
+static const char* codeTypeName(uint8_t codeType)
+{
+    switch (codeType)
+    {
+    case PCIR_CODE_X86: return "x86";
+    case PCIR_CODE_OPEN_FIRMWARE: return "open firmware";
+    case PCIR_CODE_HP_PA_RISC: return "hp pa-risc";
+    case PCIR_CODE_EFI: return "efi";
+    default: return "unknown";
+    }
+}
+
+void printOptionRom(const OptionRom* rom)
+{
+    if (rom->pcirOffset == 0)
+        printf("option rom at %06x: legacy image, %u bytes to initialize, checksum %s\n", rom->offset, rom->length,
+               rom->checksumValid ? "ok" : "wrong");
+    else
+        printf("option rom at %06x: %04x:%04x class %06x revision %u, %s code, %u bytes to initialize, image %u bytes, "
+               "checksum %s\n", rom->offset, rom->vendorID, rom->deviceID, rom->classCode, rom->revisionLevel,
+               codeTypeName(rom->codeType), rom->length, rom->imageLength, rom->checksumValid ? "ok" : "wrong");
+    if (rom->pnpOffset == 0)
+        return;
+    printf("  pnp: \"%s\" \"%s\" type %06x bcv %04x bev %04x dv %04x\n", rom->manufacturer, rom->product,
+           rom->deviceType, rom->bootConnectionVector, rom->bootEntryVector, rom->disconnectVector);
+}
+
+cJSON* optionRomToJson(const OptionRom* rom)
+{
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json, "offset", rom->offset);
+    cJSON_AddNumberToObject(json, "length", rom->length);
+    cJSON_AddBoolToObject(json, "checksum_valid", rom->checksumValid);
+    if (rom->pcirOffset != 0)
+    {
+        cJSON_AddNumberToObject(json, "vendor_id", rom->vendorID);
+        cJSON_AddNumberToObject(json, "device_id", rom->deviceID);
+        cJSON_AddNumberToObject(json, "class_code", rom->classCode);
+        cJSON_AddNumberToObject(json, "revision_level", rom->revisionLevel);
+        cJSON_AddNumberToObject(json, "image_length", rom->imageLength);
+    }
+    cJSON_AddStringToObject(json, "code_type", rom->pcirOffset != 0 ? codeTypeName(rom->codeType) : "legacy");
+    if (rom->pnpOffset != 0)
+    {
+        cJSON_AddStringToObject(json, "manufacturer", rom->manufacturer);
+        cJSON_AddStringToObject(json, "product", rom->product);
+        cJSON_AddNumberToObject(json, "device_type", rom->deviceType);
+        cJSON_AddNumberToObject(json, "bcv", rom->bootConnectionVector);
+        cJSON_AddNumberToObject(json, "bev", rom->bootEntryVector);
+    }
+    return json;
+}
+
+uint16_t callOptionRomInit(uint16_t segment, uint16_t busDevFn)
+{
+    RMREGS regs;
+    RMSREGS sregs;
+
+    // No ISA PnP card select number or read port, and no PnP BIOS installation structure at ES:DI
+    memset(&regs, 0, sizeof(regs));
+    memset(&sregs, 0, sizeof(sregs));
+    regs.x.ax = busDevFn;
+    regs.x.bx = 0xffff;
+    regs.x.dx = 0xffff;
+    BE_callRealMode(segment, ROM_HEADER_INIT_OFFSET, &regs, &sregs);
+    return regs.x.ax;
+}
+
+uint16_t callOptionRomVector(uint16_t segment, uint16_t vector, uint16_t busDevFn)
+{
+    RMREGS regs;
+    RMSREGS sregs;
+
+    memset(&regs, 0, sizeof(regs));
+    memset(&sregs, 0, sizeof(sregs));
+    regs.x.ax = busDevFn;
+    BE_callRealMode(segment, vector, &regs, &sregs);
+    return regs.x.ax;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdint.h>
+
+struct cJSON;
+
+// Offsets in the option ROM header
+#define ROM_HEADER_SIZE_OFFSET 0x02     // initialization size in 512 byte units
+#define ROM_HEADER_INIT_OFFSET 0x03     // init vector, a jump the BIOS far calls
+#define ROM_HEADER_PCIR_OFFSET 0x18
+#define ROM_HEADER_PNP_OFFSET 0x1a
+
+#define ROM_BLOCK_SIZE 512
+
+// PCI data structure code types
+#define PCIR_CODE_X86 0x00
+#define PCIR_CODE_OPEN_FIRMWARE 0x01
+#define PCIR_CODE_HP_PA_RISC 0x02
+#define PCIR_CODE_EFI 0x03
+
+#define OPTION_ROM_STRING_SIZE 64
+#define OPTION_ROM_MAX_IMAGES 16
+
+// What the headers of one option ROM image say, see the PCI Firmware and PnP BIOS specifications
+typedef struct OptionRom
+{
+    const unsigned char* image;     // first byte of the image, inside the mapped file
+    uint32_t offset;                // of the image in the container
+    uint32_t length;                // initialization size in bytes
+    uint8_t checksumValid;          // the initialization size sums to 0
+
+    // PCI data structure ("PCIR"), valid when pcirOffset is not 0
+    uint16_t pcirOffset;
+    uint16_t vendorID;
+    uint16_t deviceID;
+    uint32_t classCode;
+    uint32_t imageLength;           // bytes up to the next image in the container
+    uint16_t revisionLevel;
+    uint8_t pcirRevision;
+    uint8_t codeType;
+    uint8_t lastImage;
+
+    // PnP expansion header ("$PnP"), valid when pnpOffset is not 0
+    uint16_t pnpOffset;
+    uint16_t bootConnectionVector;  // BCV, 0 when absent
+    uint16_t bootEntryVector;       // BEV, 0 when absent
+    uint16_t disconnectVector;
+    uint32_t deviceType;            // base type, sub type and interface
+    char manufacturer[OPTION_ROM_STRING_SIZE];
+    char product[OPTION_ROM_STRING_SIZE];
+} OptionRom;
+
+// Parses the image at data, size is what is left of the file from there. Returns 0 when the image
+// has no signature or does not fit, a missing PCI data structure or PnP header is not an error
+int parseOptionRom(const unsigned char* data, uint32_t size, OptionRom* rom);
+void printOptionRom(const OptionRom* rom);
+struct cJSON* optionRomToJson(const OptionRom* rom);
+
+// The images of an expansion ROM, chained through the PCIR image lengths up to the last image indicator.
+// The images point into the mapped file, nothing is copied
+typedef struct OptionRomContainer
+{
+    OptionRom images[OPTION_ROM_MAX_IMAGES];
+    int count;
+    int x86Image;                   // index of the image to emulate, -1 when there is none
+} OptionRomContainer;
+
+// Walks the images of the file once, summing each image as it goes. Returns 0 when the first image is malformed
+int parseOptionRomContainer(const unsigned char* data, uint32_t size, OptionRomContainer* container);
+
+// Sum of the bytes, 0 for a valid image
+uint8_t optionRomChecksum(const unsigned char* data, uint32_t length);
+
+// Far calls the init vector of the image copied to segment, with AX = bus << 8 | devfn
+// and no PnP BIOS as the PnP specification describes. Returns AX
+uint16_t callOptionRomInit(uint16_t segment, uint16_t busDevFn);
+
+// Far calls a BCV or BEV of the image at segment. Returns AX
+uint16_t callOptionRomVector(uint16_t segment, uint16_t vector, uint16_t busDevFn);
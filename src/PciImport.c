@@ -0,0 +1,248 @@
+#include "PciImport.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+// The smallest dump lspci prints for an unprivileged user is the 64 byte header
+#define PCI_DUMP_MIN_SIZE 64
+
+static int hexDigit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Reads hex digits at *p, returns the number of digits consumed
+static int parseHex(const char** p, const char* end, uint32_t* value)
+{
+    int digits = 0;
+    int digit;
+    *value = 0;
+    while (*p < end && digits < 8 && (digit = hexDigit(**p)) >= 0)
+    {
+        *value = (*value << 4) | digit;
+        ++*p;
+        ++digits;
+    }
+    return digits;
+}
+
+// "[dddd:]bb:dd.f" at the start of a device header line, returns domain << 16 | bus << 8 | devfn or -1
+static int64_t parseSlot(const char* p, const char* end)
+{
+    uint32_t fields[3];
+    int count = 0;
+    for (;;)
+    {
+        if (count == 3 || parseHex(&p, end, &fields[count]) == 0 || p == end)
+            return -1;
+        char separator = *p++;
+        ++count;
+        if (separator == '.')
+            break;
+        if (separator != ':')
+            return -1;
+    }
+
+    uint32_t function;
+    if (count < 2 || parseHex(&p, end, &function) != 1 || function > 7)
+        return -1;
+
+    uint32_t domain = count == 3 ? fields[0] & 0xffff : 0;
+    return (int64_t)(domain << 16 | (fields[count - 2] & 0xff) << 8 | (fields[count - 1] & 0x1f) << 3 | function);
+}
+
+// "oo: xx xx ..." with up to 16 bytes
+static int parseDataLine(const char* p, const char* end, uint32_t offset, PciDump* dump)
+{
+    while (p + 3 <= end && p[0] == ' ')
+    {
+        int high = hexDigit(p[1]);
+        int low = hexDigit(p[2]);
+        if (high < 0 || low < 0)
+            break;
+        if (offset >= PCI_DUMP_CONFIG_SIZE)
+            return 0;
+        dump->config[offset++] = (unsigned char)(high << 4 | low);
+        p += 3;
+    }
+    if (offset > dump->length)
+        dump->length = offset;
+    return 1;
+}
+
+int parseLspciDump(const char* text, size_t length, PciDumpHandler handler, void* context)
+{
+    // One dump reused for every function, so parsing does not allocate
+    PciDump dump;
+    int inDevice = 0;
+    int count = 0;
+    const char* end = text + length;
+
+    for (const char* line = text; line < end;)
+    {
+        const char* eol = memchr(line, '\n', end - line);
+        if (eol == NULL)
+            eol = end;
+
+        const char* p = line;
+        uint32_t value;
+        int digits = parseHex(&p, eol, &value);
+        if (digits > 0 && p + 1 < eol && p[0] == ':' && p[1] == ' ')
+        {
+            // Config bytes, they belong to the last device header
+            if (!inDevice || !parseDataLine(p + 1, eol, value, &dump))
+            {
+                printf("Malformed lspci dump near offset %ld\n", (long)(line - text));
+                return -1;
+            }
+        }
+        else if (digits > 0)
+        {
+            int64_t slot = parseSlot(line, eol);
+            if (slot >= 0)
+            {
+                if (inDevice && dump.length >= PCI_DUMP_MIN_SIZE)
+                {
+                    ++count;
+                    if (!handler(&dump, context))
+                        return count;
+                }
+                memset(dump.config, 0, sizeof(dump.config));
+                memset(dump.resourceSizes, 0, sizeof(dump.resourceSizes));
+                dump.domain = (uint16_t)(slot >> 16);
+                dump.bus = (uint8_t)(slot >> 8);
+                dump.device = (uint8_t)((slot >> 3) & 0x1f);
+                dump.function = (uint8_t)(slot & 7);
+                dump.length = 0;
+                inDevice = 1;
+            }
+        }
+        line = eol + 1;
+    }
+
+    if (inDevice && dump.length >= PCI_DUMP_MIN_SIZE)
+    {
+        ++count;
+        handler(&dump, context);
+    }
+    return count;
+}
+
+int readLspciFile(const char* filename, PciDumpHandler handler, void* context)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        printf("Could not open file %s\n", filename);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        printf("Could not stat file %s\n", filename);
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    // The dump is parsed straight out of the page cache
+    void* text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (text == MAP_FAILED)
+    {
+        printf("Could not map file %s\n", filename);
+        return -1;
+    }
+
+    int count = parseLspciDump(text, st.st_size, handler, context);
+    munmap(text, st.st_size);
+    return count;
+}
+
+typedef struct SlotSearch
+{
+    int slot;
+    PciDump* dump;
+    int found;
+} SlotSearch;
+
+static int matchSlot(const PciDump* dump, void* context)
+{
+    SlotSearch* search = context;
+    if (search->slot >= 0 && search->slot != (dump->bus << 8 | dump->device << 3 | dump->function))
+        return 1;
+    memcpy(search->dump, dump, sizeof(PciDump));
+    search->found = 1;
+    return 0;
+}
+
+int findLspciDevice(const char* filename, int slot, PciDump* dump)
+{
+    SlotSearch search = { slot, dump, 0 };
+    if (readLspciFile(filename, matchSlot, &search) < 0)
+        return 0;
+    if (!search.found)
+    {
+        printf("No device %02x:%02x.%x in %s\n", (slot >> 8) & 0xff, (slot >> 3) & 0x1f, slot & 7, filename);
+        return 0;
+    }
+    return 1;
+}
+
+int readSysfsConfig(const char* filename, PciDump* dump)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        printf("Could not open file %s\n", filename);
+        return 0;
+    }
+
+    memset(dump, 0, sizeof(PciDump));
+    ssize_t length = read(fd, dump->config, sizeof(dump->config));
+    close(fd);
+    if (length < PCI_DUMP_MIN_SIZE)
+    {
+        printf("File %s is too short for a PCI config space\n", filename);
+        return 0;
+    }
+    dump->length = (uint32_t)length;
+    return 1;
+}
+
+int readSysfsResource(const char* filename, uint64_t sizes[PCI_DUMP_RESOURCES])
+{
+    FILE* file = fopen(filename, "r");
+    if (file == NULL)
+    {
+        printf("Could not open file %s\n", filename);
+        return 0;
+    }
+
+    // One "start end flags" line per resource, all zero when the resource is not implemented
+    memset(sizes, 0, sizeof(uint64_t) * PCI_DUMP_RESOURCES);
+    unsigned long long start, last, flags;
+    for (int i = 0; i < PCI_DUMP_RESOURCES; ++i)
+    {
+        if (fscanf(file, "%llx %llx %llx", &start, &last, &flags) != 3)
+            break;
+        if (last > start)
+            sizes[i] = last - start + 1;
+    }
+    fclose(file);
+    return 1;
+}
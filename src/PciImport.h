@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PCI_DUMP_CONFIG_SIZE 4096
+
+// Six bars and the expansion rom, in the order of /sys/bus/pci/devices/*/resource
+#define PCI_DUMP_RESOURCES 7
+
+// Config space of one function as captured on a real machine
+typedef struct PciDump
+{
+    uint16_t domain;
+    uint8_t bus;
+    uint8_t device;
+    uint8_t function;
+    uint32_t length;    // bytes captured: 64, 256 or 4096 depending on privileges and -xxx/-xxxx
+    unsigned char config[PCI_DUMP_CONFIG_SIZE];
+    uint64_t resourceSizes[PCI_DUMP_RESOURCES]; // 0 when unknown, lspci dumps carry no sizes
+} PciDump;
+
+// Called once per function found in a dump, return 0 to stop parsing.
+// The dump is reused for the next function, copy what has to outlive the call.
+typedef int (*PciDumpHandler)(const PciDump* dump, void* context);
+
+// Parses "lspci -x", "-xxx" or "-xxxx" output. Returns the number of functions handed to the handler, -1 on malformed input
+int parseLspciDump(const char* text, size_t length, PciDumpHandler handler, void* context);
+int readLspciFile(const char* filename, PciDumpHandler handler, void* context);
+
+// Finds one function in an lspci dump by bus/device/function, or the first one when slot is negative
+int findLspciDevice(const char* filename, int slot, PciDump* dump);
+
+// Reads a raw config blob, like /sys/bus/pci/devices/*/config
+int readSysfsConfig(const char* filename, PciDump* dump);
+
+// Reads the sizes of the bars and the expansion rom from a sysfs "resource" file
+int readSysfsResource(const char* filename, uint64_t sizes[PCI_DUMP_RESOURCES]);
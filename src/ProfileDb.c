@@ -0,0 +1,486 @@
+#include "ProfileDb.h"
+#include "cJSON.h"
+#include "BiosEmulator/include/pci_accessReg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#define PROFILE_PAGE_SIZE 4096
+
+// Directories nested deeper than this are not searched, sysfs style trees are two levels deep
+#define PROFILE_MAX_DEPTH 8
+
+// The database currently mapped by loadProfileDb
+static const unsigned char* dbBase = NULL;
+static size_t dbSize = 0;
+
+// Profiles collected by compileProfileDb
+typedef struct ProfileList
+{
+    ProfileRecord* records;
+    uint32_t count;
+    uint32_t capacity;
+    const char* name;
+} ProfileList;
+
+static int endsWith(const char* text, const char* suffix)
+{
+    size_t length = strlen(text);
+    size_t suffixLength = strlen(suffix);
+    return length >= suffixLength && strcmp(text + length - suffixLength, suffix) == 0;
+}
+
+static int addProfile(ProfileList* list, const PciDump* dump)
+{
+    if (list->count == list->capacity)
+    {
+        uint32_t capacity = list->capacity == 0 ? 64 : list->capacity * 2;
+        ProfileRecord* records = realloc(list->records, capacity * sizeof(ProfileRecord));
+        if (records == NULL)
+        {
+            printf("Could not allocate memory\n");
+            return 0;
+        }
+        list->records = records;
+        list->capacity = capacity;
+    }
+
+    ProfileRecord* record = &list->records[list->count++];
+    memset(record, 0, sizeof(ProfileRecord));
+    snprintf(record->name, sizeof(record->name), "%s", list->name);
+    record->configLength = dump->length < PCI_DUMP_CONFIG_SIZE ? dump->length : PCI_DUMP_CONFIG_SIZE;
+    memcpy(record->config, dump->config, record->configLength);
+    for (int i = 0; i < PCI_DUMP_RESOURCES; ++i)
+        record->resourceSizes[i] = dump->resourceSizes[i] > 0xffffffff ? 0 : (uint32_t)dump->resourceSizes[i];
+    return 1;
+}
+
+static int addDump(const PciDump* dump, void* context)
+{
+    return addProfile(context, dump);
+}
+
+static cJSON* readJsonFile(const char* filename)
+{
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL)
+    {
+        printf("Could not open file %s\n", filename);
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char* text = calloc(1, size + 1);
+    if (text == NULL || fread(text, 1, size, file) != (size_t)size)
+    {
+        printf("Could not read file %s\n", filename);
+        free(text);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+
+    cJSON* json = cJSON_Parse(text);
+    free(text);
+    if (json == NULL)
+        printf("Could not parse file %s\n", filename);
+    return json;
+}
+
+// "config" next to a "resource" file is the sysfs layout, "name.config" pairs with "name.resource"
+static void resourcePath(const char* path, char* resource, size_t size)
+{
+    size_t length = strlen(path);
+    if (endsWith(path, ".config"))
+        snprintf(resource, size, "%.*s.resource", (int)(length - 7), path);
+    else
+        snprintf(resource, size, "%.*sresource", (int)(length - 6), path);
+}
+
+static int addFile(ProfileList* list, const char* path, const char* name)
+{
+    static PciDump dump;
+    list->name = path;
+
+    if (endsWith(name, ".json"))
+    {
+        cJSON* json = readJsonFile(path);
+        if (json == NULL)
+            return 0;
+        int built = buildProfileFromJson(json, &dump);
+        cJSON_Delete(json);
+        return built && addProfile(list, &dump);
+    }
+
+    if (strcmp(name, "config") == 0 || endsWith(name, ".config"))
+    {
+        if (!readSysfsConfig(path, &dump))
+            return 0;
+
+        char resource[PATH_MAX];
+        resourcePath(path, resource, sizeof(resource));
+        if (access(resource, R_OK) == 0 && !readSysfsResource(resource, dump.resourceSizes))
+            return 0;
+        return addProfile(list, &dump);
+    }
+
+    if (endsWith(name, ".txt") || endsWith(name, ".lspci"))
+        return readLspciFile(path, addDump, list) >= 0;
+
+    // Resource files and anything else are not profiles on their own
+    return 1;
+}
+
+static int addDirectory(ProfileList* list, const char* directory, int depth)
+{
+    DIR* dir = opendir(directory);
+    if (dir == NULL)
+    {
+        printf("Could not open directory %s\n", directory);
+        return 0;
+    }
+
+    int result = 1;
+    struct dirent* entry;
+    while (result && (entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+        struct stat st;
+        if (stat(path, &st) != 0)
+            continue;
+
+        if (S_ISDIR(st.st_mode))
+        {
+            if (depth < PROFILE_MAX_DEPTH)
+                result = addDirectory(list, path, depth + 1);
+        }
+        else if (S_ISREG(st.st_mode))
+            result = addFile(list, path, entry->d_name);
+    }
+    closedir(dir);
+    return result;
+}
+
+static int compareIds(const void* a, const void* b)
+{
+    const ProfileIndexEntry* left = a;
+    const ProfileIndexEntry* right = b;
+    if (left->vendorID != right->vendorID)
+        return left->vendorID - right->vendorID;
+    if (left->deviceID != right->deviceID)
+        return left->deviceID - right->deviceID;
+    if (left->subsystemVendorID != right->subsystemVendorID)
+        return left->subsystemVendorID - right->subsystemVendorID;
+    if (left->subsystemID != right->subsystemID)
+        return left->subsystemID - right->subsystemID;
+    return (int)left->record - (int)right->record;
+}
+
+static int compareClasses(const void* a, const void* b)
+{
+    const ProfileIndexEntry* left = a;
+    const ProfileIndexEntry* right = b;
+    if (left->classCode != right->classCode)
+        return left->classCode < right->classCode ? -1 : 1;
+    return (int)left->record - (int)right->record;
+}
+
+static uint16_t configWord(const unsigned char* config, int offset)
+{
+    return (uint16_t)(config[offset] | config[offset + 1] << 8);
+}
+
+static void indexProfile(const ProfileRecord* record, uint32_t number, ProfileIndexEntry* entry)
+{
+    const unsigned char* config = record->config;
+    entry->vendorID = configWord(config, 0x00);
+    entry->deviceID = configWord(config, 0x02);
+    // Subsystem ids only exist in type 0 headers
+    int isDevice = (config[0x0e] & 0x7f) == 0;
+    entry->subsystemVendorID = isDevice ? configWord(config, 0x2c) : 0;
+    entry->subsystemID = isDevice ? configWord(config, 0x2e) : 0;
+    entry->classCode = config[0x09] | config[0x0a] << 8 | config[0x0b] << 16;
+    entry->record = number;
+}
+
+static int writeDatabase(const ProfileList* list, const char* output)
+{
+    ProfileDbHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PROFILE_DB_MAGIC, sizeof(header.magic));
+    header.version = PROFILE_DB_VERSION;
+    header.profileCount = list->count;
+    header.recordSize = sizeof(ProfileRecord);
+    header.idIndexOffset = sizeof(ProfileDbHeader);
+    header.classIndexOffset = header.idIndexOffset + list->count * sizeof(ProfileIndexEntry);
+    uint32_t indexEnd = header.classIndexOffset + list->count * sizeof(ProfileIndexEntry);
+    header.recordsOffset = (indexEnd + PROFILE_PAGE_SIZE - 1) & ~(PROFILE_PAGE_SIZE - 1);
+
+    ProfileIndexEntry* ids = malloc((list->count + 1) * sizeof(ProfileIndexEntry));
+    ProfileIndexEntry* classes = malloc((list->count + 1) * sizeof(ProfileIndexEntry));
+    if (ids == NULL || classes == NULL)
+    {
+        printf("Could not allocate memory\n");
+        free(ids);
+        free(classes);
+        return 0;
+    }
+    for (uint32_t i = 0; i < list->count; ++i)
+        indexProfile(&list->records[i], i, &ids[i]);
+    memcpy(classes, ids, list->count * sizeof(ProfileIndexEntry));
+    qsort(ids, list->count, sizeof(ProfileIndexEntry), compareIds);
+    qsort(classes, list->count, sizeof(ProfileIndexEntry), compareClasses);
+
+    // Written next to the target and renamed over it, so running analyzers keep their mapping
+    char temporary[PATH_MAX];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", output);
+    FILE* file = fopen(temporary, "wb");
+    if (file == NULL)
+    {
+        printf("Could not create file %s\n", temporary);
+        free(ids);
+        free(classes);
+        return 0;
+    }
+
+    static const unsigned char padding[PROFILE_PAGE_SIZE];
+    int written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                  fwrite(ids, sizeof(ProfileIndexEntry), list->count, file) == list->count &&
+                  fwrite(classes, sizeof(ProfileIndexEntry), list->count, file) == list->count &&
+                  fwrite(padding, 1, header.recordsOffset - indexEnd, file) == header.recordsOffset - indexEnd &&
+                  fwrite(list->records, sizeof(ProfileRecord), list->count, file) == list->count;
+    written = fclose(file) == 0 && written;
+    free(ids);
+    free(classes);
+
+    if (!written || rename(temporary, output) != 0)
+    {
+        printf("Could not write file %s\n", output);
+        unlink(temporary);
+        return 0;
+    }
+    return 1;
+}
+
+int compileProfileDb(const char* directory, const char* output)
+{
+    ProfileList list = { NULL, 0, 0, NULL };
+    int result = addDirectory(&list, directory, 0) && writeDatabase(&list, output);
+    if (result)
+        printf("Compiled %u profiles into %s\n", list.count, output);
+    free(list.records);
+    return result;
+}
+
+static const ProfileDbHeader* dbHeader(void)
+{
+    return (const ProfileDbHeader*)dbBase;
+}
+
+static int validateDatabase(const char* filename)
+{
+    const ProfileDbHeader* header = dbHeader();
+    if (dbSize < sizeof(ProfileDbHeader) || memcmp(header->magic, PROFILE_DB_MAGIC, sizeof(header->magic)) != 0)
+    {
+        printf("File %s is not a profile database\n", filename);
+        return 0;
+    }
+    if (header->version != PROFILE_DB_VERSION || header->recordSize != sizeof(ProfileRecord))
+    {
+        printf("Profile database %s has version %u, expected %u\n", filename, header->version, PROFILE_DB_VERSION);
+        return 0;
+    }
+
+    uint64_t indexSize = (uint64_t)header->profileCount * sizeof(ProfileIndexEntry);
+    uint64_t recordsSize = (uint64_t)header->profileCount * sizeof(ProfileRecord);
+    if (header->idIndexOffset + indexSize > dbSize || header->classIndexOffset + indexSize > dbSize ||
+        header->recordsOffset + recordsSize > dbSize)
+    {
+        printf("Profile database %s is truncated\n", filename);
+        return 0;
+    }
+
+    // Lookups index the records and copy configs without further checks
+    const ProfileIndexEntry* ids = (const ProfileIndexEntry*)(dbBase + header->idIndexOffset);
+    const ProfileIndexEntry* classes = (const ProfileIndexEntry*)(dbBase + header->classIndexOffset);
+    const ProfileRecord* records = (const ProfileRecord*)(dbBase + header->recordsOffset);
+    for (uint32_t i = 0; i < header->profileCount; ++i)
+    {
+        if (ids[i].record >= header->profileCount || classes[i].record >= header->profileCount ||
+            records[i].configLength > PCI_DUMP_CONFIG_SIZE)
+        {
+            printf("Profile database %s is corrupt at profile %u\n", filename, i);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int loadProfileDb(const char* filename)
+{
+    unloadProfileDb();
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        printf("Could not open file %s\n", filename);
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        printf("Could not stat file %s\n", filename);
+        close(fd);
+        return 0;
+    }
+
+    void* base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        printf("Could not map file %s\n", filename);
+        return 0;
+    }
+
+    dbBase = base;
+    dbSize = st.st_size;
+    if (!validateDatabase(filename))
+    {
+        unloadProfileDb();
+        return 0;
+    }
+    return 1;
+}
+
+void unloadProfileDb(void)
+{
+    if (dbBase != NULL)
+        munmap((void*)dbBase, dbSize);
+    dbBase = NULL;
+    dbSize = 0;
+}
+
+static const ProfileRecord* recordAt(uint32_t record)
+{
+    const ProfileRecord* records = (const ProfileRecord*)(dbBase + dbHeader()->recordsOffset);
+    return &records[record];
+}
+
+const ProfileRecord* findProfile(uint16_t vendorID, uint16_t deviceID, int32_t subsystemVendorID, int32_t subsystemID)
+{
+    if (dbBase == NULL)
+        return NULL;
+
+    const ProfileIndexEntry* ids = (const ProfileIndexEntry*)(dbBase + dbHeader()->idIndexOffset);
+    uint32_t count = dbHeader()->profileCount;
+    uint32_t key = (uint32_t)vendorID << 16 | deviceID;
+
+    // Lower bound on vendor and device, then walk the subsystems
+    uint32_t low = 0;
+    uint32_t high = count;
+    while (low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        if (((uint32_t)ids[middle].vendorID << 16 | ids[middle].deviceID) < key)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    for (uint32_t i = low; i < count && ids[i].vendorID == vendorID && ids[i].deviceID == deviceID; ++i)
+    {
+        if ((subsystemVendorID == PROFILE_ANY_SUBSYSTEM || ids[i].subsystemVendorID == subsystemVendorID) &&
+            (subsystemID == PROFILE_ANY_SUBSYSTEM || ids[i].subsystemID == subsystemID))
+            return recordAt(ids[i].record);
+    }
+    return NULL;
+}
+
+const ProfileRecord* findProfileByClass(uint32_t classCode)
+{
+    if (dbBase == NULL)
+        return NULL;
+
+    const ProfileIndexEntry* classes = (const ProfileIndexEntry*)(dbBase + dbHeader()->classIndexOffset);
+    uint32_t low = 0;
+    uint32_t high = dbHeader()->profileCount;
+    while (low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        if (classes[middle].classCode < classCode)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    if (low < dbHeader()->profileCount && classes[low].classCode == classCode)
+        return recordAt(classes[low].record);
+    return NULL;
+}
+
+int loadProfile(const char* id, PciDump* dump)
+{
+    if (dbBase == NULL)
+    {
+        printf("Profile %s requested but no profile database is loaded\n", id);
+        return 0;
+    }
+
+    const ProfileRecord* record = NULL;
+    if (strncmp(id, "class:", 6) == 0)
+        record = findProfileByClass((uint32_t)strtoul(id + 6, NULL, 16));
+    else
+    {
+        uint32_t fields[4];
+        int32_t subsystem[2] = { PROFILE_ANY_SUBSYSTEM, PROFILE_ANY_SUBSYSTEM };
+        int count = 0;
+        const char* p = id;
+        char* end;
+        while (count < 4)
+        {
+            fields[count++] = (uint32_t)strtoul(p, &end, 16);
+            if (*end != ':')
+                break;
+            p = end + 1;
+        }
+        if (*end != '\0' || (count != 2 && count != 4))
+        {
+            printf("Bad profile id %s, expected vvvv:dddd, vvvv:dddd:ssss:ssss or class:cccccc\n", id);
+            return 0;
+        }
+        if (count == 4)
+        {
+            subsystem[0] = (int32_t)(fields[2] & 0xffff);
+            subsystem[1] = (int32_t)(fields[3] & 0xffff);
+        }
+        record = findProfile((uint16_t)fields[0], (uint16_t)fields[1], subsystem[0], subsystem[1]);
+    }
+
+    if (record == NULL)
+    {
+        printf("No profile %s in the profile database\n", id);
+        return 0;
+    }
+
+    memset(dump, 0, sizeof(PciDump));
+    dump->length = record->configLength;
+    memcpy(dump->config, record->config, record->configLength);
+    for (int i = 0; i < PCI_DUMP_RESOURCES; ++i)
+        dump->resourceSizes[i] = record->resourceSizes[i];
+    return 1;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+#include "PciImport.h"
+
+// A device profile database is one file that is mapped read-only and used in place:
+//
+//   ProfileDbHeader
+//   ProfileIndexEntry[profileCount]    sorted by vendor, device, subsystem vendor, subsystem id
+//   ProfileIndexEntry[profileCount]    sorted by class code
+//   ProfileRecord[profileCount]        starting on a page boundary, one config space each
+//
+// All fields are little endian. Lookups are binary searches over the mapping,
+// loading a database costs an open, an mmap and a header check.
+
+#define PROFILE_DB_MAGIC "BAPRODB"
+#define PROFILE_DB_VERSION 1
+#define PROFILE_NAME_SIZE 96
+
+typedef struct ProfileDbHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t profileCount;
+    uint32_t recordSize;        // sizeof(ProfileRecord), guards against layout changes
+    uint32_t idIndexOffset;
+    uint32_t classIndexOffset;
+    uint32_t recordsOffset;
+} ProfileDbHeader;
+
+typedef struct ProfileIndexEntry
+{
+    uint16_t vendorID;
+    uint16_t deviceID;
+    uint16_t subsystemVendorID;
+    uint16_t subsystemID;
+    uint32_t classCode;         // base class, subclass and programming interface
+    uint32_t record;
+} ProfileIndexEntry;
+
+typedef struct ProfileRecord
+{
+    char name[PROFILE_NAME_SIZE];   // file the profile was compiled from
+    uint32_t configLength;
+    uint32_t resourceSizes[PCI_DUMP_RESOURCES];
+    unsigned char config[PCI_DUMP_CONFIG_SIZE];
+} ProfileRecord;
+
+// Matches any subsystem in findProfile
+#define PROFILE_ANY_SUBSYSTEM -1
+
+// Compiles every json profile, sysfs config blob and lspci dump below directory into a database
+int compileProfileDb(const char* directory, const char* output);
+
+int loadProfileDb(const char* filename);
+void unloadProfileDb(void);
+
+const ProfileRecord* findProfile(uint16_t vendorID, uint16_t deviceID, int32_t subsystemVendorID, int32_t subsystemID);
+const ProfileRecord* findProfileByClass(uint32_t classCode);
+
+// Looks up "vvvv:dddd", "vvvv:dddd:ssss:ssss" or "class:cccccc" in the loaded database
+int loadProfile(const char* id, PciDump* dump);
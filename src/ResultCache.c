@@ -0,0 +1,278 @@
+#include "ResultCache.h"
+#include "MemoryMap.h"
+#include "BiosEmulator/include/pci_accessReg.h"
+#include "cJSON.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// SHA-256 as in FIPS 180-4
+typedef struct Sha256
+{
+    uint32_t state[8];
+    uint64_t length;
+    unsigned char block[64];
+    uint32_t used;
+} Sha256;
+
+static const uint32_t sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static uint32_t rotr(uint32_t value, int bits)
+{
+    return (value >> bits) | (value << (32 - bits));
+}
+
+static void sha256Block(Sha256* sha, const unsigned char* block)
+{
+    uint32_t w[64];
+    uint32_t v[8];
+
+    for (int i = 0; i < 16; ++i)
+        w[i] = (uint32_t)block[i * 4] << 24 | block[i * 4 + 1] << 16 | block[i * 4 + 2] << 8 | block[i * 4 + 3];
+    for (int i = 16; i < 64; ++i)
+    {
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    memcpy(v, sha->state, sizeof(v));
+    for (int i = 0; i < 64; ++i)
+    {
+        uint32_t t1 = v[7] + (rotr(v[4], 6) ^ rotr(v[4], 11) ^ rotr(v[4], 25)) + ((v[4] & v[5]) ^ (~v[4] & v[6])) +
+                      sha256K[i] + w[i];
+        uint32_t t2 = (rotr(v[0], 2) ^ rotr(v[0], 13) ^ rotr(v[0], 22)) + ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+        memmove(&v[1], &v[0], 7 * sizeof(v[0]));
+        v[4] += t1;
+        v[0] = t1 + t2;
+    }
+    for (int i = 0; i < 8; ++i)
+        sha->state[i] += v[i];
+}
+
+static void sha256Init(Sha256* sha)
+{
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(sha->state, initial, sizeof(initial));
+    sha->length = 0;
+    sha->used = 0;
+}
+
+static void sha256Update(Sha256* sha, const void* data, size_t size)
+{
+    const unsigned char* bytes = data;
+
+    sha->length += size;
+    if (sha->used != 0)
+    {
+        size_t part = 64 - sha->used < size ? 64 - sha->used : size;
+        memcpy(sha->block + sha->used, bytes, part);
+        sha->used += part;
+        bytes += part;
+        size -= part;
+        if (sha->used < 64)
+            return;
+        sha256Block(sha, sha->block);
+        sha->used = 0;
+    }
+    for (; size >= 64; bytes += 64, size -= 64)
+        sha256Block(sha, bytes);
+    memcpy(sha->block, bytes, size);
+    sha->used = size;
+}
+
+static void sha256Final(Sha256* sha, unsigned char* digest)
+{
+    uint64_t bits = sha->length * 8;
+    unsigned char padding[72] = { 0x80 };
+    size_t padLength = (sha->used < 56 ? 56 : 120) - sha->used;
+
+    for (int i = 0; i < 8; ++i)
+        padding[padLength + i] = (unsigned char)(bits >> (56 - i * 8));
+    sha256Update(sha, padding, padLength + 8);
+    for (int i = 0; i < 32; ++i)
+        digest[i] = (unsigned char)(sha->state[i / 4] >> (24 - (i % 4) * 8));
+}
+
+// Length prefixed, so the boundaries between the inputs are part of the key
+static void hashPart(Sha256* sha, const void* data, size_t size)
+{
+    uint64_t length = size;
+    sha256Update(sha, &length, sizeof(length));
+    sha256Update(sha, data, size);
+}
+
+// The executable stands in for the emulator version, hashed once per process
+static const unsigned char* executableDigest(void)
+{
+    static unsigned char digest[32];
+    static int done = 0;
+    if (done)
+        return digest;
+
+    Sha256 sha;
+    sha256Init(&sha);
+    uint32_t version = RESULT_CACHE_VERSION;
+    sha256Update(&sha, &version, sizeof(version));
+
+    int fd = open("/proc/self/exe", O_RDONLY);
+    if (fd >= 0)
+    {
+        unsigned char buffer[65536];
+        ssize_t count;
+        while ((count = read(fd, buffer, sizeof(buffer))) > 0)
+            sha256Update(&sha, buffer, count);
+        close(fd);
+    }
+    sha256Final(&sha, digest);
+    done = 1;
+    return digest;
+}
+
+void computeResultKey(const unsigned char* rom, uint32_t romSize, const cJSON* options, const char* settings,
+                      char* key)
+{
+    Sha256 sha;
+    unsigned char digest[32];
+
+    sha256Init(&sha);
+    sha256Update(&sha, executableDigest(), 32);
+    hashPart(&sha, rom, romSize);
+
+    // The effective configuration, whether it came from the json, a profile or a dump
+    const unsigned char* config;
+    const unsigned char* writable;
+    for (int i = 0; (config = PCI_deviceConfig(i, &writable)) != NULL; ++i)
+    {
+        hashPart(&sha, config, PCI_CONFIG_SIZE);
+        hashPart(&sha, writable, PCI_CONFIG_SIZE);
+    }
+
+    // Memory map regions loaded from files, the json only names the files
+    const void* backing;
+    uint32_t backingSize;
+    for (int i = 0; memoryMapFileBacking(i, &backing, &backingSize); ++i)
+        hashPart(&sha, backing, backingSize);
+
+    // Options without the names of the files already hashed by content
+    cJSON* copy = cJSON_Duplicate(options, 1);
+    cJSON_DeleteItemFromObject(copy, "rom");
+    cJSON_DeleteItemFromObject(copy, "profile_db");
+    cJSON_DeleteItemFromObject(copy, "result_cache");
+    cJSON_DeleteItemFromObject(copy, "output_file");
+    char* text = cJSON_PrintUnformatted(copy);
+    if (text != NULL)
+        hashPart(&sha, text, strlen(text));
+    free(text);
+    cJSON_Delete(copy);
+    hashPart(&sha, settings, strlen(settings));
+
+    sha256Final(&sha, digest);
+    for (int i = 0; i < 32; ++i)
+        sprintf(key + i * 2, "%02x", digest[i]);
+}
+
+static int copyToStdout(int fd)
+{
+    char buffer[65536];
+    ssize_t count;
+    while ((count = read(fd, buffer, sizeof(buffer))) > 0)
+    {
+        if (fwrite(buffer, 1, count, stdout) != (size_t)count)
+            return 0;
+    }
+    fflush(stdout);
+    return count == 0;
+}
+
+int replayResult(const char* directory, const char* key)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", directory, key);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    int replayed = copyToStdout(fd);
+    close(fd);
+    return replayed;
+}
+
+// The capture running, captureFd is -1 when there is none
+static int savedStdout = -1;
+static int captureFd = -1;
+static char capturePath[PATH_MAX];
+static char resultPath[PATH_MAX];
+
+int beginResultCapture(const char* directory, const char* key)
+{
+    // Only the user running the analyzer reads or plants cached reports
+    if (mkdir(directory, 0700) != 0 && access(directory, W_OK) != 0)
+    {
+        printf("Could not use result cache directory %s\n", directory);
+        return 0;
+    }
+
+    snprintf(resultPath, sizeof(resultPath), "%s/%s", directory, key);
+    snprintf(capturePath, sizeof(capturePath), "%s/%s.XXXXXX", directory, key);
+    captureFd = mkstemp(capturePath);
+    if (captureFd < 0)
+    {
+        printf("Could not create file in %s\n", directory);
+        return 0;
+    }
+
+    fflush(stdout);
+    savedStdout = dup(STDOUT_FILENO);
+    if (savedStdout < 0 || dup2(captureFd, STDOUT_FILENO) < 0)
+    {
+        if (savedStdout >= 0)
+            close(savedStdout);
+        savedStdout = -1;
+        close(captureFd);
+        captureFd = -1;
+        unlink(capturePath);
+        printf("Could not capture the report\n");
+        return 0;
+    }
+    return 1;
+}
+
+void endResultCapture(int keep)
+{
+    if (captureFd < 0)
+        return;
+
+    fflush(stdout);
+    if (savedStdout >= 0)
+    {
+        dup2(savedStdout, STDOUT_FILENO);
+        close(savedStdout);
+        savedStdout = -1;
+    }
+
+    // The report goes out whether or not it is kept
+    int copied = lseek(captureFd, 0, SEEK_SET) == 0 && copyToStdout(captureFd);
+    if (!copied)
+        printf("Could not read the captured report %s\n", capturePath);
+    int synced = keep && copied && fsync(captureFd) == 0;
+    close(captureFd);
+    captureFd = -1;
+
+    if (!synced || rename(capturePath, resultPath) != 0)
+        unlink(capturePath);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+
+struct cJSON;
+
+// Reports of earlier runs, one file per run in a cache directory, named by the SHA-256 of
+// everything the report depends on: the rom image bytes, the register files of the emulated
+// devices, the memory map regions loaded from files, the analyzer executable and the json options. A hit replays the report instead
+// of emulating. Reports are written to a temporary file and renamed into place, so readers
+// and concurrent writers of the same key only ever see complete reports.
+
+// Bump when the report changes without the executable changing
+#define RESULT_CACHE_VERSION 1
+#define RESULT_KEY_SIZE 65  // hex digest and terminator
+
+// Hashes the inputs of a run, the PCI devices and the memory map must be loaded already. settings describes what
+// else changes the report, like the command line options
+void computeResultKey(const unsigned char* rom, uint32_t romSize, const struct cJSON* options, const char* settings,
+                      char* key);
+
+// Copies the cached report of key to stdout. Returns 0 on a miss
+int replayResult(const char* directory, const char* key);
+
+// Sends stdout to a temporary file in directory until endResultCapture. Returns 0 when the
+// cache cannot be written, the run then goes on uncached
+int beginResultCapture(const char* directory, const char* key);
+
+// Restores stdout and copies the captured report to it. The report is stored when keep is set,
+// otherwise the temporary file is removed. Does nothing when no capture is running, so a caller
+// can end every run with it
+void endResultCapture(int keep);
@@ -0,0 +1,196 @@
+#include "RomImage.h"
+#include "MemAllocator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <sys/mman.h>
+
+// Images currently mapped, so several analyses of the same file share one mapping
+static RomImage* mappedImages = NULL;
+// Unused images kept mapped, see keepUnusedROMs
+static int unusedLimit = 0;
+static uint64_t useClock = 0;
+
+static uint32_t mappedSize(uint32_t size);
+
+static void freeImage(RomImage** link)
+{
+    RomImage* image = *link;
+    *link = image->next;
+    // Replaces the file mapping with fresh anonymous memory or unmaps it, see MemAllocator.c
+    freeHostMemory((void*)image->data, mappedSize(image->size));
+    free(image);
+}
+
+// Unmaps the least recently used unused images beyond the limit
+static void trimUnused(void)
+{
+    for (;;)
+    {
+        RomImage** oldest = NULL;
+        int unused = 0;
+        for (RomImage** link = &mappedImages; *link != NULL; link = &(*link)->next)
+        {
+            if ((*link)->refCount > 0)
+                continue;
+            ++unused;
+            if (oldest == NULL || (*link)->lastUse < (*oldest)->lastUse)
+                oldest = link;
+        }
+        if (unused <= unusedLimit)
+            return;
+        freeImage(oldest);
+    }
+}
+
+// An unused image of the same file that changed since it was mapped is dropped on the way
+static RomImage* findMapped(const struct stat* st)
+{
+    RomImage** link = &mappedImages;
+    while (*link != NULL)
+    {
+        RomImage* image = *link;
+        if (image->device == st->st_dev && image->inode == st->st_ino)
+        {
+            if (image->size == (uint32_t)st->st_size && image->changeTime.tv_sec == st->st_ctim.tv_sec &&
+                image->changeTime.tv_nsec == st->st_ctim.tv_nsec)
+                return image;
+            if (image->refCount == 0)
+            {
+                freeImage(link);
+                continue;
+            }
+        }
+        link = &image->next;
+    }
+    return NULL;
+}
+
+static int validateHeader(int fd, const char* filename, off_t size)
+{
+    if (size < ROM_MIN_SIZE || size > ROM_MAX_SIZE)
+    {
+        printf("File %s has an invalid size for an option rom (%lld bytes)\n", filename, (long long)size);
+        return 0;
+    }
+
+    unsigned char signature[2];
+    if (pread(fd, signature, sizeof(signature), 0) != sizeof(signature))
+    {
+        printf("Could not read file %s\n", filename);
+        return 0;
+    }
+
+    // Check if the first two bytes are 0x55 0xAA
+    if (signature[0] != 0x55 || signature[1] != 0xAA)
+    {
+        printf("File %s is not a bios extension\n", filename);
+        return 0;
+    }
+    return 1;
+}
+
+static uint32_t mappedSize(uint32_t size)
+{
+    return (size + ARENA_MIN_BLOCK - 1) & ~(uint32_t)(ARENA_MIN_BLOCK - 1);
+}
+
+static const unsigned char* mapFile(int fd, const char* filename, uint32_t size)
+{
+    // Take a slot from the host memory arena and map the file over it.
+    // MAP_PRIVATE and PROT_READ: nothing is copied, pages come straight from the page cache
+    // and are shared with every other process mapping the same file
+    void* slot = allocateHostMemory(mappedSize(size));
+    if (slot == NULL)
+        return NULL;
+
+    void* addr = mmap(slot, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
+    if (addr == MAP_FAILED)
+    {
+        freeHostMemory(slot, mappedSize(size));
+        printf("Could not map file %s\n", filename);
+        return NULL;
+    }
+    return (const unsigned char*)slot;
+}
+
+const RomImage* mapROM(const char* filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        printf("Could not open file %s\n", filename);
+        return NULL;
+    }
+
+    const RomImage* image = mapROMFd(fd, filename);
+    close(fd);
+    return image;
+}
+
+const RomImage* mapROMFd(int fd, const char* filename)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        printf("Could not stat file %s\n", filename);
+        return NULL;
+    }
+
+    RomImage* image = findMapped(&st);
+    if (image != NULL)
+    {
+        ++image->refCount;
+        image->lastUse = ++useClock;
+        return image;
+    }
+
+    if (!validateHeader(fd, filename, st.st_size))
+        return NULL;
+
+    const unsigned char* data = mapFile(fd, filename, (uint32_t)st.st_size);
+    if (data == NULL)
+        return NULL;
+
+    image = malloc(sizeof(RomImage));
+    if (image == NULL)
+    {
+        printf("Could not allocate memory\n");
+        freeHostMemory((void*)data, mappedSize((uint32_t)st.st_size));
+        return NULL;
+    }
+
+    image->data = data;
+    image->size = (uint32_t)st.st_size;
+    image->device = st.st_dev;
+    image->inode = st.st_ino;
+    image->changeTime = st.st_ctim;
+    image->refCount = 1;
+    image->lastUse = ++useClock;
+    image->next = mappedImages;
+    mappedImages = image;
+    return image;
+}
+
+void unmapROM(const RomImage* constImage)
+{
+    if (constImage == NULL)
+        return;
+
+    RomImage* image = mappedImages;
+    while (image != NULL && image != constImage)
+        image = image->next;
+    if (image == NULL || --image->refCount > 0)
+        return;
+    trimUnused();
+}
+
+void keepUnusedROMs(int count)
+{
+    unusedLimit = count;
+    trimUnused();
+}
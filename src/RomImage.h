@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#define ROM_MIN_SIZE 512
+#define ROM_MAX_SIZE (16 * 1024 * 1024)
+
+// A read-only, copy-free view of an option ROM file.
+// Mapping the same file twice returns the same image with its reference count bumped.
+// A file is the same while its device, inode, size and st_ctim are.
+typedef struct RomImage
+{
+    const unsigned char* data;
+    uint32_t size;
+    dev_t device;
+    ino_t inode;
+    struct timespec changeTime;     // st_ctim, a write or touch in the same second still changes it
+    int refCount;
+    uint64_t lastUse;               // when it was last mapped, the least recent unused image goes first
+    struct RomImage* next;
+} RomImage;
+
+const RomImage* mapROM(const char* filename);
+// Same for a file opened by someone else, fd stays open. filename is only used in messages
+const RomImage* mapROMFd(int fd, const char* filename);
+void unmapROM(const RomImage* image);
+
+// Keeps up to count images mapped after their last unmapROM, so a long running process
+// maps a rom once for many analyses. 0, the default, unmaps them right away
+void keepUnusedROMs(int count);
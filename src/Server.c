@@ -0,0 +1,244 @@
+#include "Server.h"
+#include "cJSON.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void requestStop(int signal)
+{
+    (void)signal;
+    stopRequested = 1;
+}
+
+// Without SA_RESTART, so the signal interrupts accept
+static void installSignals(void)
+{
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = requestStop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    // A client that goes away mid report must not take the server with it
+    signal(SIGPIPE, SIG_IGN);
+}
+
+static int openSocket(const char* socketPath)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address.sun_path))
+    {
+        printf("Socket path %s is too long\n", socketPath);
+        return -1;
+    }
+    strcpy(address.sun_path, socketPath);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        printf("Could not create socket\n");
+        return -1;
+    }
+
+    // A socket file left behind by an earlier server that did not shut down
+    unlink(socketPath);
+    // Connecting takes write permission on the socket file, which bind creates with the umask applied
+    mode_t mask = umask(0177);
+    int bound = bind(fd, (struct sockaddr*)&address, sizeof(address)) == 0;
+    umask(mask);
+    if (!bound || listen(fd, 16) != 0)
+    {
+        printf("Could not listen on %s\n", socketPath);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Takes the descriptors passed with one message. Returns 0 when the request passed more than one
+// so far, all of them are closed then
+static int takeDescriptors(struct msghdr* message, int* romFd)
+{
+    // Descriptors that did not fit the control buffer were dropped by the kernel
+    int ok = !(message->msg_flags & MSG_CTRUNC);
+    for (struct cmsghdr* header = CMSG_FIRSTHDR(message); header != NULL; header = CMSG_NXTHDR(message, header))
+    {
+        if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+            continue;
+        size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; ++i)
+        {
+            int fd;
+            memcpy(&fd, CMSG_DATA(header) + i * sizeof(int), sizeof(fd));
+            if (ok && *romFd < 0)
+                *romFd = fd;
+            else
+            {
+                close(fd);
+                ok = 0;
+            }
+        }
+    }
+
+    if (!ok && *romFd >= 0)
+    {
+        close(*romFd);
+        *romFd = -1;
+    }
+    return ok;
+}
+
+// Reads the request up to the end of the stream or a NUL byte, and the rom fd when one was passed.
+// Returns the request text, NULL on errors
+static char* receiveRequest(int client, int* romFd)
+{
+    char* request = malloc(SERVER_MAX_REQUEST);
+    size_t length = 0;
+
+    *romFd = -1;
+    if (request == NULL)
+        return NULL;
+    // One byte is left for the terminating NUL
+    while (length < SERVER_MAX_REQUEST - 1)
+    {
+        // Room for a few descriptors, so a client passing more than one is seen and refused
+        union
+        {
+            struct cmsghdr header;
+            char space[CMSG_SPACE(4 * sizeof(int))];
+        } control;
+        struct iovec iov = { request + length, SERVER_MAX_REQUEST - 1 - length };
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control.space;
+        message.msg_controllen = sizeof(control.space);
+
+        ssize_t count = recvmsg(client, &message, MSG_CMSG_CLOEXEC);
+        if (count < 0)
+        {
+            if (errno == EINTR && !stopRequested)
+                continue;
+            break;
+        }
+        if (!takeDescriptors(&message, romFd))
+            break;
+
+        if (count == 0)
+        {
+            request[length] = 0;
+            return request;
+        }
+        char* end = memchr(request + length, 0, count);
+        length += count;
+        if (end != NULL)
+            return request;
+    }
+
+    free(request);
+    if (*romFd >= 0)
+    {
+        close(*romFd);
+        *romFd = -1;
+    }
+    return NULL;
+}
+
+// Keys a request may not use, they name files the server would write
+static const char* const refusedKeys[] = { "output_file", "result_cache" };
+
+static int acceptRequest(const cJSON* conf)
+{
+    for (size_t i = 0; i < sizeof(refusedKeys) / sizeof(refusedKeys[0]); ++i)
+    {
+        if (cJSON_GetObjectItem(conf, refusedKeys[i]) != NULL)
+        {
+            printf("Requests may not use %s\n", refusedKeys[i]);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Runs the request with stdout on the client connection
+static void serveClient(int client, ServerAnalyze analyze)
+{
+    struct timeval receiveTimeout = { SERVER_RECEIVE_TIMEOUT, 0 };
+    struct timeval sendTimeout = { SERVER_SEND_TIMEOUT, 0 };
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &receiveTimeout, sizeof(receiveTimeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+
+    int romFd;
+    char* request = receiveRequest(client, &romFd);
+
+    fflush(stdout);
+    int savedStdout = dup(STDOUT_FILENO);
+    if (savedStdout < 0 || dup2(client, STDOUT_FILENO) < 0)
+    {
+        if (savedStdout >= 0)
+            close(savedStdout);
+        free(request);
+        if (romFd >= 0)
+            close(romFd);
+        return;
+    }
+
+    int ok = 0;
+    cJSON* conf = request != NULL ? cJSON_Parse(request) : NULL;
+    if (request == NULL)
+        printf("Could not receive the request\n");
+    else if (conf == NULL)
+        printf("Could not parse the request\n");
+    else if (acceptRequest(conf))
+        ok = analyze(conf, "request", romFd);
+    printf("status %d\n", ok ? 0 : 1);
+
+    fflush(stdout);
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+    cJSON_Delete(conf);
+    free(request);
+    if (romFd >= 0)
+        close(romFd);
+}
+
+int runServer(const char* socketPath, ServerAnalyze analyze)
+{
+    installSignals();
+    int listener = openSocket(socketPath);
+    if (listener < 0)
+        return 0;
+
+    printf("Serving analysis requests on %s\n", socketPath);
+    fflush(stdout);
+    while (!stopRequested)
+    {
+        int client = accept(listener, NULL, NULL);
+        if (client < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            printf("Could not accept a connection\n");
+            break;
+        }
+        serveClient(client, analyze);
+        close(client);
+    }
+
+    close(listener);
+    unlink(socketPath);
+    return 1;
+}
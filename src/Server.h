@@ -0,0 +1,34 @@
+#pragma once
+
+struct cJSON;
+
+// Analyzer daemon on a unix domain stream socket.
+//
+// A client connects, sends one json configuration as for -f and shuts down its sending side
+// (or ends the document with a NUL byte). The rom may come as an open file descriptor passed
+// with SCM_RIGHTS, "rom" is not needed then. A request that passes more than one descriptor is
+// refused and all of them are closed. The report is
+// streamed back on the same connection as it is written, followed by a last line
+// "status 0" or "status 1", and the server closes the connection.
+//
+// Requests are served one at a time, the emulator is a single instance. The process keeps
+// the host memory arena, the profile database, the result cache key of the executable and
+// the mappings of the last SERVER_ROM_CACHE roms between requests. The emulator itself is not
+// kept warm: every request runs BE_init and BE_exit, which set up guest memory, the BIOS data
+// area and the devices afresh, so no guest state carries over from one request to the next.
+//
+// A request that hangs would hold up every client after it: requests run under an instruction
+// budget, and a client that stops reading its report is dropped. Requests may not name files
+// for the server to write, "output_file" and "result_cache" are refused. The socket is only
+// accessible to the user running the server.
+
+#define SERVER_MAX_REQUEST (1024 * 1024)    // bytes, with the terminating NUL
+#define SERVER_RECEIVE_TIMEOUT 10   // seconds a client may take to send its request
+#define SERVER_SEND_TIMEOUT 10      // seconds a client may leave its report unread
+#define SERVER_INSTRUCTION_BUDGET 200000000ULL  // limit of a request unless -b gives one
+#define SERVER_ROM_CACHE 16         // unused rom mappings kept for later requests
+
+typedef int (*ServerAnalyze)(const struct cJSON* conf, const char* confName, int romFd);
+
+// Serves requests on socketPath until SIGINT or SIGTERM. Returns 0 when the socket cannot be set up
+int runServer(const char* socketPath, ServerAnalyze analyze);
@@ -0,0 +1,175 @@
+#include "Watchpoints.h"
+#include "ConfigItems.h"
+#include "cJSON.h"
+#include "BiosEmulator/include/watch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct WatchName
+{
+    const char* name;
+    int value;
+} WatchName;
+
+static const WatchName spaceNames[] = {
+    { "mem", BE_WATCH_MEM }, { "io", BE_WATCH_IO }, { NULL, 0 }
+};
+
+static const WatchName accessNames[] = {
+    { "read", BE_WATCH_READ }, { "write", BE_WATCH_WRITE }, { "rw", BE_WATCH_READ | BE_WATCH_WRITE }, { NULL, 0 }
+};
+
+static const WatchName compareNames[] = {
+    { "any", BE_WATCH_ANY }, { "eq", BE_WATCH_EQ }, { "ne", BE_WATCH_NE }, { "all_set", BE_WATCH_ALL_SET },
+    { "any_set", BE_WATCH_ANY_SET }, { NULL, 0 }
+};
+
+static const WatchName actionNames[] = {
+    { "log", BE_WATCH_LOG }, { "snapshot", BE_WATCH_SNAPSHOT }, { "halt", BE_WATCH_HALT }, { NULL, 0 }
+};
+
+// A missing item keeps the default in value
+static int nameItem(const cJSON* item, const WatchName* names, int* value)
+{
+    if (item == NULL)
+        return 1;
+    const char* text = cJSON_GetStringValue(item);
+    for (int i = 0; text != NULL && names[i].name != NULL; ++i)
+    {
+        if (strcmp(text, names[i].name) == 0)
+        {
+            *value = names[i].value;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int parseWatchpoint(const cJSON* entry, BE_watchpoint* watchpoint)
+{
+    int compare = BE_WATCH_ANY;
+    const cJSON* item;
+
+    memset(watchpoint, 0, sizeof(*watchpoint));
+    watchpoint->space = BE_WATCH_MEM;
+    watchpoint->access = BE_WATCH_READ | BE_WATCH_WRITE;
+    watchpoint->mask = 0xffffffff;
+    watchpoint->actions = BE_WATCH_LOG;
+
+    if (!hexConfigItem(cJSON_GetObjectItem(entry, "start"), &watchpoint->start))
+    {
+        printf("watchpoints: every watchpoint needs a hex start\n");
+        return 0;
+    }
+    watchpoint->end = watchpoint->start;
+    item = cJSON_GetObjectItem(entry, "end");
+    if (item != NULL && !hexConfigItem(item, &watchpoint->end))
+    {
+        printf("watchpoints: end must be a hex address\n");
+        return 0;
+    }
+
+    if (!nameItem(cJSON_GetObjectItem(entry, "space"), spaceNames, &watchpoint->space) ||
+        !nameItem(cJSON_GetObjectItem(entry, "access"), accessNames, &watchpoint->access) ||
+        !nameItem(cJSON_GetObjectItem(entry, "compare"), compareNames, &compare))
+    {
+        printf("watchpoints: space must be mem or io, access read, write or rw, "
+               "compare any, eq, ne, all_set or any_set\n");
+        return 0;
+    }
+    watchpoint->compare = (BE_watchCompare)compare;
+
+    item = cJSON_GetObjectItem(entry, "mask");
+    if (item != NULL && !hexConfigItem(item, &watchpoint->mask))
+    {
+        printf("watchpoints: mask must be hex\n");
+        return 0;
+    }
+    item = cJSON_GetObjectItem(entry, "value");
+    if (item != NULL && !hexConfigItem(item, &watchpoint->compareValue))
+    {
+        printf("watchpoints: value must be hex\n");
+        return 0;
+    }
+    item = cJSON_GetObjectItem(entry, "count");
+    if (item != NULL)
+    {
+        if (!cJSON_IsNumber(item) || item->valuedouble < 0)
+        {
+            printf("watchpoints: count must be a number\n");
+            return 0;
+        }
+        watchpoint->count = (uint32_t)item->valuedouble;
+    }
+
+    item = cJSON_GetObjectItem(entry, "actions");
+    if (item != NULL)
+    {
+        const cJSON* action;
+        watchpoint->actions = 0;
+        cJSON_ArrayForEach(action, item)
+        {
+            int value;
+            if (!nameItem(action, actionNames, &value))
+            {
+                printf("watchpoints: actions must be a list of log, snapshot and halt\n");
+                return 0;
+            }
+            watchpoint->actions |= value;
+        }
+    }
+    return 1;
+}
+
+int loadWatchpoints(const cJSON* list)
+{
+    BE_watchReset();
+    if (!cJSON_IsArray(list))
+    {
+        printf("watchpoints must be an array of watchpoints\n");
+        return 0;
+    }
+
+    const cJSON* entry;
+    cJSON_ArrayForEach(entry, list)
+    {
+        BE_watchpoint watchpoint;
+        if (!parseWatchpoint(entry, &watchpoint) || BE_watchAdd(&watchpoint) < 0)
+        {
+            BE_watchReset();
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void printWatchpointHits(void)
+{
+    for (int i = 0; i < BE_WATCH_MAX; ++i)
+    {
+        const BE_watchpoint* watchpoint = BE_watchGet(i);
+        if (watchpoint != NULL)
+            printf("watchpoint %d: %s %#x-%#x %u hits\n", i, watchpoint->space == BE_WATCH_IO ? "port" : "mem",
+                   watchpoint->start, watchpoint->end, watchpoint->hits);
+    }
+}
+
+cJSON* watchpointHitsToJson(void)
+{
+    cJSON* json = cJSON_CreateArray();
+    for (int i = 0; i < BE_WATCH_MAX; ++i)
+    {
+        const BE_watchpoint* watchpoint = BE_watchGet(i);
+        if (watchpoint == NULL)
+            continue;
+        cJSON* entry = cJSON_CreateObject();
+        cJSON_AddStringToObject(entry, "space", watchpoint->space == BE_WATCH_IO ? "io" : "mem");
+        cJSON_AddNumberToObject(entry, "start", watchpoint->start);
+        cJSON_AddNumberToObject(entry, "end", watchpoint->end);
+        cJSON_AddNumberToObject(entry, "hits", watchpoint->hits);
+        cJSON_AddItemToArray(json, entry);
+    }
+    return json;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+struct cJSON;
+
+// Declares the entries of a "watchpoints" JSON array with the emulator, see BiosEmulator/include/watch.h.
+// Watchpoints of an earlier call are dropped first
+int loadWatchpoints(const struct cJSON* list);
+
+// The hits of every watchpoint, as text lines or as a json array
+void printWatchpointHits(void);
+struct cJSON* watchpointHitsToJson(void);